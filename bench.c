@@ -0,0 +1,215 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "utils.h"
+#include "galois_field.h"
+#include "matrix.h"
+#include "packet.h"
+#include "fountain.h"
+#include "decoding.h"
+
+#define BENCH_LOSS 0.1 // Simulated loss rate
+#define BENCH_BYTES (16 * 1024 * 1024) // Data to transfer for each configuration
+#define BENCH_KERNEL_BYTES (512 * 1024 * 1024) // Rows processed by each row kernel
+
+/* Codec benchmark : transfer BENCH_BYTES through generations of k packets with BENCH_LOSS random loss.
+ * The sender transmits every packet in clear, then repairs until the receiver has delivered the generation. */
+
+typedef struct benchresult_t {
+    double encodeTime; // Seconds spent building packets
+    double decodeTime; // Seconds spent in the decoder
+    long nSent; // Packets sent
+    long nReceived; // Packets received
+    long nDelivered; // Source packets delivered
+} benchresult;
+
+double elapsed(struct timeval start, struct timeval end){
+    return (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+/* Build the packet number n of a generation : clear while n < k, then coded */
+void buildPacket(int codec, int coeffs, int field, matrix* source, int k, uint16_t blockNo, uint32_t seqNo, int n, degreedistribution* degrees, uint8_t* buffer, int* bufLen){
+    datapacket packet;
+    uint8_t coefficients[MAX_COEFFS_BYTES];
+    int neighbours[FOUNTAIN_BLKSIZE], degree, i;
+    
+    packet.blockNo = blockNo;
+    packet.prevBlockSize = (blockNo > 0) ? k : 0;
+    packet.seqNo = seqNo;
+    packet.repairNo = (n < k) ? 0 : (n - k);
+    packet.firstPacket = 0;
+    packet.size = PACKETSIZE;
+    
+    if(n < k){
+        packet.packetNumber = n | FLAG_CLEAR;
+        packet.payloadAndSize = source->data[n];
+        dataPacketToBuffer(packet, buffer, bufLen);
+        return;
+    }
+    
+    packet.packetNumber = k | FLAG_CODED;
+    packet.payloadAndSize = calloc(PACKETSIZE, sizeof(uint8_t));
+    if(codec == CODEC_FOUNTAIN){
+        degree = getFountainNeighbours(neighbours, k, seqNo, degrees);
+        for(i = 0; i < degree; i++){
+            rowXor(packet.payloadAndSize, source->data[neighbours[i]], PACKETSIZE);
+        }
+    } else {
+        if(coeffs == COEFFS_MDS){
+            getCauchyCoefficients(field, coefficients, k, packet.repairNo);
+        } else {
+            getCoefficients(field, coefficients, k, repairSeed(blockNo, packet.repairNo), 0);
+        }
+        for(i = 0; i < k; i++){
+            fieldRowMulSub(field, packet.payloadAndSize, source->data[i], fieldGet(field, coefficients, i), PACKETSIZE);
+        }
+    }
+    dataPacketToBuffer(packet, buffer, bufLen);
+    free(packet.payloadAndSize);
+}
+
+benchresult runBench(int codec, int coeffs, int field, int k){
+    benchresult result = {0, 0, 0, 0, 0};
+    decoderstate* decState = decoderStateInit();
+    degreedistribution* degrees = degreeDistributionInit();
+    matrix* source = mCreate(k, PACKETSIZE);
+    uint8_t buffer[PACKETSIZE + 100];
+    int bufLen, nGenerations = BENCH_BYTES / (k * (PACKETSIZE - 2)), generation, i, n;
+    uint16_t size = htons(PACKETSIZE - 2);
+    uint32_t seqNo = 0;
+    long delivered;
+    struct timeval start, end;
+    
+    decState->codec = codec;
+    decState->coeffs = coeffs;
+    decState->field = field;
+    decoderSelectKernels(decState);
+    srandom(1);
+    for(i = 0; i < k; i++){
+        memcpy(source->data[i], &size, 2);
+        for(n = 2; n < PACKETSIZE; n++){
+            source->data[i][n] = (uint8_t)random();
+        }
+    }
+    
+    for(generation = 0; generation < nGenerations; generation++){
+        delivered = decState->nDataToSend;
+        for(n = 0; (decState->nDataToSend - delivered < k * (PACKETSIZE - 2)) && (n < 4 * k); n++){
+            gettimeofday(&start, NULL);
+            buildPacket(codec, coeffs, field, source, k, generation, seqNo, n, degrees, buffer, &bufLen);
+            gettimeofday(&end, NULL);
+            result.encodeTime += elapsed(start, end);
+            result.nSent++;
+            seqNo++;
+            
+            if((1.0 * random() / RAND_MAX) < BENCH_LOSS){
+                continue;
+            }
+            result.nReceived++;
+            gettimeofday(&start, NULL);
+            handleInCoded(decState, buffer, bufLen);
+            gettimeofday(&end, NULL);
+            result.decodeTime += elapsed(start, end);
+        }
+        
+        // Only the delivered bytes matter : drop them and the ACKs
+        result.nDelivered += (decState->nDataToSend - delivered) / (PACKETSIZE - 2);
+        for(i = 0; i < decState->nAckToSend; i++){
+            free(decState->ackToSend[i]);
+        }
+        free(decState->ackToSend);
+        decState->ackToSend = 0;
+        free(decState->ackToSendSize);
+        decState->ackToSendSize = 0;
+        decState->nAckToSend = 0;
+    }
+    
+    mFree(source);
+    degreeDistributionFree(degrees);
+    decoderStateFree(decState);
+    return result;
+}
+
+void printBench(char* name, int k, benchresult result){
+    double megabytes = result.nDelivered * (PACKETSIZE - 2) / (1024.0 * 1024.0);
+    printf("%-15s k = %5d : overhead %6.2f %% ; encode %8.2f MB/s ; decode %8.2f MB/s\n", name, k,
+           100.0 * (result.nReceived - result.nDelivered) / result.nDelivered,
+           megabytes / result.encodeTime, megabytes / result.decodeTime);
+}
+
+/* Row kernel benchmark : GF(2^8) multiply-subtract of rows of size bytes, generic and specialized for size, in MB/s of rows */
+void benchRowKernels(int size){
+    uint8_t* a = malloc(size);
+    uint8_t* b = malloc(size);
+    int i, n, nRows = BENCH_KERNEL_BYTES / size;
+    double generic, fixed;
+    rowkernels* kernels = getRowKernels(size);
+    struct timeval start, end;
+    
+    for(i = 0; i < size; i++){
+        a[i] = random();
+        b[i] = random();
+    }
+    gettimeofday(&start, NULL);
+    for(n = 0; n < nRows; n++){
+        fieldRowMulSubKernels(FIELD_GF256, 0, a, b, 2 + n % 250, size);
+    }
+    gettimeofday(&end, NULL);
+    generic = BENCH_KERNEL_BYTES / (1024.0 * 1024.0 * elapsed(start, end));
+    gettimeofday(&start, NULL);
+    for(n = 0; n < nRows; n++){
+        fieldRowMulSubKernels(FIELD_GF256, kernels, a, b, 2 + n % 250, size);
+    }
+    gettimeofday(&end, NULL);
+    fixed = BENCH_KERNEL_BYTES / (1024.0 * 1024.0 * elapsed(start, end));
+    
+    printf("Row kernel %5d bytes : generic %8.2f MB/s ; specialized %8.2f MB/s (%+.0f %%)\n", size, generic, fixed, 100 * (fixed - generic) / generic);
+    free(a);
+    free(b);
+}
+
+int main(int argc, char **argv){
+    int rlncSizes[3] = {32, 64, BLKSIZE}, fountainSizes[5] = {32, BLKSIZE, 512, 1024, FOUNTAIN_BLKSIZE}, i;
+    int fields[4] = {FIELD_GF2, FIELD_GF16, FIELD_GF256, FIELD_GF65536};
+    int kernelSizes[6] = {16, 64, 127, 1380, 1452, 8960};
+    char* fieldNames[4] = {"RLNC GF(2)", "RLNC GF(2^4)", "RLNC GF(2^8)", "RLNC GF(2^16)"};
+    
+    printf("Transfer of %d MB with %.0f %% loss, overhead = received packets beyond the source packets\n", BENCH_BYTES / (1024 * 1024), 100 * BENCH_LOSS);
+    for(i = 0; i < 3; i++){
+        printBench("RLNC", rlncSizes[i], runBench(CODEC_BLOCK, COEFFS_DENSE, FIELD_GF256, rlncSizes[i]));
+    }
+    for(i = 0; i < 3; i++){
+        printBench("RLNC MDS", rlncSizes[i], runBench(CODEC_BLOCK, COEFFS_MDS, FIELD_GF256, rlncSizes[i]));
+    }
+    for(i = 0; i < 4; i++){
+        printBench(fieldNames[i], BLKSIZE, runBench(CODEC_BLOCK, COEFFS_DENSE, fields[i], BLKSIZE));
+    }
+    for(i = 0; i < 5; i++){
+        printBench("Fountain", fountainSizes[i], runBench(CODEC_FOUNTAIN, COEFFS_DENSE, FIELD_GF256, fountainSizes[i]));
+    }
+    galoisInit();
+    for(i = 0; i < 6; i++){
+        benchRowKernels(kernelSizes[i]);
+    }
+    
+    return 0;
+}
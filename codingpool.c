@@ -0,0 +1,122 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "codingpool.h"
+#include <sched.h>
+
+void* codingThread(void* ring);
+int ringPush(jobring* ring, codingjob job);
+
+codingpool* codingPoolInit(int nThreads){
+    int i;
+    codingpool* ret = malloc(sizeof(codingpool));
+    
+    ret->nThreads = nThreads;
+    ret->threads = malloc(nThreads * sizeof(pthread_t));
+    ret->rings = malloc(nThreads * sizeof(jobring));
+    ret->nextRing = 0;
+    
+    for(i = 0; i < nThreads; i++){
+        atomic_init(&(ret->rings[i].head), 0);
+        atomic_init(&(ret->rings[i].tail), 0);
+        sem_init(&(ret->rings[i].nReady), 0, 0);
+        ret->rings[i].pool = ret;
+        if(pthread_create(&(ret->threads[i]), NULL, codingThread, &(ret->rings[i])) != 0){
+            perror("pthread_create()");
+            exit(1);
+        }
+    }
+    
+    return ret;
+}
+
+// Stop the threads once they are done with their jobs
+void codingPoolFree(codingpool* pool){
+    int i;
+    codingjob stop = {0, 0, 0};
+    
+    for(i = 0; i < pool->nThreads; i++){
+        while(!ringPush(&(pool->rings[i]), stop)){
+            sched_yield();
+        }
+    }
+    for(i = 0; i < pool->nThreads; i++){
+        pthread_join(pool->threads[i], NULL);
+        sem_destroy(&(pool->rings[i].nReady));
+    }
+    free(pool->threads);
+    free(pool->rings);
+    free(pool);
+}
+
+/* Hand a job over to the next coding thread, counting it in nPending until it is done. The job must not touch
+ * anything the loop thread modifies until codingPoolWait(nPending) returns. It runs inline if the ring of that thread is full. */
+void codingPoolSubmit(codingpool* pool, void (*run)(void* args), void* args, atomic_int* nPending){
+    codingjob job = {run, args, nPending};
+    
+    atomic_fetch_add(nPending, 1);
+    if(!ringPush(&(pool->rings[pool->nextRing]), job)){
+        run(args);
+        atomic_fetch_sub(nPending, 1);
+    }
+    pool->nextRing = (pool->nextRing + 1) % pool->nThreads;
+}
+
+// Wait until the jobs counted in nPending are done ; their results are visible to the caller afterwards
+void codingPoolWait(atomic_int* nPending){
+    while(atomic_load(nPending) > 0){
+        sched_yield();
+    }
+}
+
+int codingPoolIsDone(atomic_int* nPending){
+    return (atomic_load(nPending) == 0);
+}
+
+// False if the ring is full
+int ringPush(jobring* ring, codingjob job){
+    unsigned int head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    
+    if(head - atomic_load_explicit(&(ring->tail), memory_order_acquire) >= CODING_RING_SIZE){
+        return false;
+    }
+    ring->jobs[head & (CODING_RING_SIZE - 1)] = job;
+    atomic_store_explicit(&(ring->head), head + 1, memory_order_release);
+    sem_post(&(ring->nReady));
+    return true;
+}
+
+void* codingThread(void* ring){
+    jobring* r = (jobring*)ring;
+    codingjob job;
+    unsigned int tail;
+    
+    while(1){
+        while(sem_wait(&(r->nReady)) != 0); // Interrupted by a signal
+        
+        tail = atomic_load_explicit(&(r->tail), memory_order_relaxed);
+        job = r->jobs[tail & (CODING_RING_SIZE - 1)];
+        atomic_store_explicit(&(r->tail), tail + 1, memory_order_release);
+        if(job.run == 0){
+            return 0;
+        }
+        
+        job.run(job.args);
+        atomic_fetch_sub(job.nPending, 1);
+    }
+}
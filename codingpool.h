@@ -0,0 +1,64 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _CODINGPOOL_
+#define _CODINGPOOL_
+
+#include "utils.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#define CODING_RING_SIZE 256 // Jobs waiting for each coding thread ; a power of two
+#define MAX_CODING_THREADS 32
+#define CODING_POOL_MIN_PACKETS 8 // Coded packets combining fewer packets are generated inline : the hand-over would cost more than the work
+
+typedef struct codingjob_t {
+    void (*run)(void* args); // 0 stops the thread
+    void* args;
+    atomic_int* nPending; // Counter of the submitter, decremented once the job is done
+} codingjob;
+
+struct codingpool_t;
+
+typedef struct jobring_t { // Single producer (the loop thread), single consumer (one coding thread) : no lock
+    codingjob jobs[CODING_RING_SIZE];
+    atomic_uint head; // Next job written by the producer
+    atomic_uint tail; // Next job read by the consumer
+    sem_t nReady; // Wakes the consumer up
+    struct codingpool_t* pool;
+} jobring;
+
+typedef struct codingpool_t {
+    int nThreads;
+    pthread_t* threads;
+    jobring* rings; // One per thread
+    int nextRing; // Ring of the next job, round robin
+} codingpool;
+
+codingpool* codingPoolInit(int nThreads);
+
+void codingPoolFree(codingpool* pool);
+
+void codingPoolSubmit(codingpool* pool, void (*run)(void* args), void* args, atomic_int* nPending);
+
+void codingPoolWait(atomic_int* nPending);
+
+int codingPoolIsDone(atomic_int* nPending);
+
+#endif
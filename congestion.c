@@ -0,0 +1,308 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "congestion.h"
+
+void vegasOnAck(congestionstate* cc, double shortTermRtt, double longTermRtt);
+void bbrOnAck(congestionstate* cc, uint32_t seqNo, int rtt, struct timeval now);
+void bbrOnRoundEnd(congestionstate* cc, struct timeval now);
+double bbrTargetWindow(congestionstate cc, double gain);
+
+congestionstate* congestionInit(int algorithm){
+    int i;
+    congestionstate* ret = malloc(sizeof(congestionstate));
+    
+    ret->algorithm = algorithm;
+    ret->congestionWindow = BASE_WINDOW;
+    ret->slowStartMode = true;
+    ret->maxWindow = MAX_WINDOW;
+    ret->nUsers = 1;
+    ret->nInFlight = 0;
+    
+    ret->mode = BBR_STARTUP;
+    for(i = 0; i < BBR_BW_ROUNDS; i++){
+        ret->bandwidthSamples[i] = 0;
+    }
+    ret->maxBandwidth = 0;
+    ret->fullBandwidth = 0;
+    ret->fullBandwidthRounds = 0;
+    ret->minRtt = 0;
+    ret->minRttStamp.tv_sec = 0;
+    ret->minRttStamp.tv_usec = 0;
+    ret->probeRttDone.tv_sec = 0;
+    ret->probeRttDone.tv_usec = 0;
+    ret->pacingGain = BBR_STARTUP_GAIN;
+    ret->cycleIndex = 0;
+    
+    ret->lastSentSeqNo = 0;
+    ret->roundEndSeqNo = 0;
+    ret->roundCount = 0;
+    ret->ackedInRound = 0;
+    ret->roundStart.tv_sec = 0;
+    ret->roundStart.tv_usec = 0;
+    
+    return ret;
+}
+
+// Freed along with the last encoder that uses it
+void congestionFree(congestionstate* cc){
+    cc->nUsers--;
+    if(cc->nUsers == 0){
+        free(cc);
+    }
+}
+
+// One more encoder draws from the window of cc
+congestionstate* congestionShare(congestionstate* cc){
+    cc->nUsers++;
+    return cc;
+}
+
+// Go back to a saved state of the controller ; what the encoders sharing it have sent since is kept
+void congestionRestore(congestionstate* cc, congestionstate saved){
+    saved.nUsers = cc->nUsers;
+    saved.nInFlight = cc->nInFlight;
+    saved.lastSentSeqNo = cc->lastSentSeqNo;
+    *cc = saved;
+}
+
+void congestionOnSend(congestionstate* cc, uint32_t seqNo){
+    cc->lastSentSeqNo = seqNo;
+}
+
+/* rtt is the sample for packet seqNo (uSeconds) ; shortTermRtt and longTermRtt the averages of the encoder, already updated */
+void congestionOnAck(congestionstate* cc, uint32_t seqNo, int rtt, double shortTermRtt, double longTermRtt, struct timeval now){
+    switch(cc->algorithm){
+        case CC_BBR:
+            bbrOnAck(cc, seqNo, rtt, now);
+            break;
+        default:
+            vegasOnAck(cc, shortTermRtt, longTermRtt);
+    }
+    if(cc->congestionWindow > cc->maxWindow){
+        cc->congestionWindow = cc->maxWindow;
+    }
+    
+    do_debug("Congestion Window after actualizing = %f\n", cc->congestionWindow);
+}
+
+void congestionOnTimeout(congestionstate* cc){
+    int i;
+    switch(cc->algorithm){
+        case CC_BBR:
+            // The model is stale : rebuild it from scratch
+            for(i = 0; i < BBR_BW_ROUNDS; i++){
+                cc->bandwidthSamples[i] = 0;
+            }
+            cc->maxBandwidth = 0;
+            cc->fullBandwidth = 0;
+            cc->fullBandwidthRounds = 0;
+            cc->mode = BBR_STARTUP;
+            cc->pacingGain = BBR_STARTUP_GAIN;
+            cc->ackedInRound = 0;
+            cc->roundStart.tv_sec = 0;
+            cc->roundStart.tv_usec = 0;
+            cc->congestionWindow = BASE_WINDOW;
+            break;
+        default:
+            cc->slowStartMode = true;
+            cc->congestionWindow = BASE_WINDOW;
+    }
+}
+
+// Start from a window learnt on the same path, instead of BASE_WINDOW
+void congestionSeed(congestionstate* cc, float window){
+    if(window < BASE_WINDOW){
+        window = BASE_WINDOW;
+    } else if(window > cc->maxWindow){
+        window = cc->maxWindow;
+    }
+    cc->congestionWindow = window;
+    cc->slowStartMode = (window <= SS_THRESHOLD); // Slow start would only double a window that is known to fit
+}
+
+// Maximum number of packets in flight
+int congestionWindow(congestionstate cc){
+    if((cc.algorithm == CC_BBR) && (cc.mode == BBR_PROBE_RTT) && (cc.congestionWindow > BBR_PROBE_RTT_WINDOW)){
+        return BBR_PROBE_RTT_WINDOW;
+    }
+    return (int)cc.congestionWindow;
+}
+
+/* Packets in flight allowed to one of the encoders sharing the state, which has nInFlight of them : the room the others
+ * leave in the window, but at least its fair share, so that a new mux is not starved by the busy ones. */
+int congestionAllowance(congestionstate cc, int nInFlight){
+    int window = congestionWindow(cc), share, room;
+    
+    if(cc.nUsers <= 1){
+        return window;
+    }
+    share = (window + cc.nUsers - 1) / cc.nUsers;
+    room = window - (cc.nInFlight - nInFlight);
+    return (room > share) ? room : share;
+}
+
+// Rate at which packets should leave (packets per uSecond), 0 if they may leave as soon as the window allows
+double congestionPacingRate(congestionstate cc){
+    if(cc.algorithm == CC_BBR){
+        return cc.pacingGain * cc.maxBandwidth;
+    }
+    return 0;
+}
+
+void vegasOnAck(congestionstate* cc, double shortTermRtt, double longTermRtt){
+    float delta;
+    
+    if(cc->slowStartMode){
+        cc->congestionWindow += 1;
+        if(cc->congestionWindow > SS_THRESHOLD){
+            cc->slowStartMode = false;
+        } 
+    } else {// Congestion avoidance mode
+        delta = 1 - (longTermRtt / shortTermRtt);
+        if(delta < ALPHA){
+            // Increase the window :
+            cc->congestionWindow += (INCREMENT / cc->congestionWindow);
+        } else if(delta > BETA) {
+            // Decrease the window
+            cc->congestionWindow -= (INCREMENT / cc->congestionWindow);
+        }
+        // If delta is in between, do not update the window
+        
+        // Avoid floating-point errors ; the window should never get lower than the BASE !
+        if(cc->congestionWindow < BASE_WINDOW){
+            cc->congestionWindow = BASE_WINDOW;
+        }
+    }
+}
+
+void bbrOnAck(congestionstate* cc, uint32_t seqNo, int rtt, struct timeval now){
+    double target;
+    
+    cc->ackedInRound++;
+    
+    // ~~ Min RTT filter ; when it gets old, drain the queue to measure it again ~~
+    if(rtt > 0){
+        if((cc->minRtt == 0) || (rtt <= cc->minRtt)){
+            cc->minRtt = rtt;
+            cc->minRttStamp = now;
+        } else if((cc->mode != BBR_PROBE_RTT) && (diffUSec(now, cc->minRttStamp) > BBR_MIN_RTT_WINDOW)){
+            do_debug("BBR : min RTT expired, probing it\n");
+            cc->mode = BBR_PROBE_RTT;
+            cc->pacingGain = 1;
+            cc->probeRttDone = now;
+            addUSec(&(cc->probeRttDone), (cc->minRtt > BBR_PROBE_RTT_DURATION) ? (long)cc->minRtt : BBR_PROBE_RTT_DURATION);
+            cc->minRtt = rtt;
+            cc->minRttStamp = now;
+        }
+    }
+    if((cc->mode == BBR_PROBE_RTT) && isSooner(cc->probeRttDone, now)){
+        cc->mode = (cc->fullBandwidthRounds >= BBR_FULL_BW_ROUNDS) ? BBR_PROBE_BW : BBR_STARTUP;
+        cc->pacingGain = (cc->mode == BBR_PROBE_BW) ? 1 : BBR_STARTUP_GAIN;
+    }
+    
+    // ~~ A round trip ends when a packet sent after its start is acknowledged ~~
+    if(diffSerial32(seqNo, cc->roundEndSeqNo) >= 0){
+        bbrOnRoundEnd(cc, now);
+    }
+    
+    // ~~ Window : grow by one packet per ACK, towards a few bandwidth-delay products ~~
+    target = bbrTargetWindow(*cc, (cc->mode == BBR_STARTUP) ? BBR_STARTUP_GAIN : BBR_CWND_GAIN);
+    if((cc->mode == BBR_STARTUP) || (target == 0)){
+        if((target == 0) || (cc->congestionWindow < target)){
+            cc->congestionWindow += 1;
+        }
+    } else if(cc->congestionWindow + 1 < target){
+        cc->congestionWindow += 1;
+    } else {
+        cc->congestionWindow = target;
+    }
+    
+    if(cc->congestionWindow < BASE_WINDOW){
+        cc->congestionWindow = BASE_WINDOW;
+    } else if(cc->congestionWindow > cc->maxWindow){
+        cc->congestionWindow = cc->maxWindow;
+    }
+}
+
+void bbrOnRoundEnd(congestionstate* cc, struct timeval now){
+    int i;
+    long elapsed = diffUSec(now, cc->roundStart);
+    static const double gainCycle[BBR_GAIN_CYCLE] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+    
+    // ~~ Delivery rate over the round, max-filtered over the last rounds ~~
+    if((cc->roundStart.tv_sec != 0) && (elapsed > 0)){
+        cc->bandwidthSamples[cc->roundCount % BBR_BW_ROUNDS] = 1.0 * cc->ackedInRound / elapsed;
+        cc->maxBandwidth = 0;
+        for(i = 0; i < BBR_BW_ROUNDS; i++){
+            if(cc->bandwidthSamples[i] > cc->maxBandwidth){
+                cc->maxBandwidth = cc->bandwidthSamples[i];
+            }
+        }
+    }
+    cc->roundCount++;
+    cc->ackedInRound = 0;
+    cc->roundStart = now;
+    cc->roundEndSeqNo = cc->lastSentSeqNo + 1;
+    
+    switch(cc->mode){
+        case BBR_STARTUP:
+            // The pipe is full when the bandwidth stops growing
+            if(cc->maxBandwidth >= cc->fullBandwidth * BBR_FULL_BW_GROWTH){
+                cc->fullBandwidth = cc->maxBandwidth;
+                cc->fullBandwidthRounds = 0;
+            } else if(++(cc->fullBandwidthRounds) >= BBR_FULL_BW_ROUNDS){
+                do_debug("BBR : bandwidth of %f packets/us reached, drain the queue\n", cc->maxBandwidth);
+                cc->mode = BBR_DRAIN;
+                cc->pacingGain = 1 / BBR_STARTUP_GAIN;
+            }
+            break;
+        case BBR_DRAIN:
+            // Startup queued about one extra bandwidth-delay product : a round at the inverse gain drains it
+            cc->mode = BBR_PROBE_BW;
+            cc->cycleIndex = 0;
+            cc->pacingGain = gainCycle[0];
+            break;
+        case BBR_PROBE_BW:
+            cc->cycleIndex = (cc->cycleIndex + 1) % BBR_GAIN_CYCLE;
+            cc->pacingGain = gainCycle[cc->cycleIndex];
+            break;
+        default:
+            break;
+    }
+}
+
+// gain bandwidth-delay products, in packets ; 0 while the model is unknown
+double bbrTargetWindow(congestionstate cc, double gain){
+    return gain * cc.maxBandwidth * cc.minRtt;
+}
+
+void congestionPrint(congestionstate cc){
+    const char* modes[4] = {"startup", "drain", "probe bandwidth", "probe RTT"};
+    
+    if(cc.algorithm == CC_BBR){
+        printf("\tCongestion control = BBR (%s)\n", modes[cc.mode]);
+        printf("\tBottleneck bandwidth = %f packets/us, min RTT = %f us, pacing gain = %f\n", cc.maxBandwidth, cc.minRtt, cc.pacingGain);
+    } else {
+        printf("\tCongestion control = Vegas%s\n", cc.slowStartMode ? " (slow start)" : "");
+    }
+    printf("\tCongestion window = %f\n", cc.congestionWindow);
+    if(cc.nUsers > 1){
+        printf("\tShared by %d encoders, %d packets in flight\n", cc.nUsers, cc.nInFlight);
+    }
+}
@@ -0,0 +1,103 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _CONGESTION_
+#define _CONGESTION_
+
+#include "utils.h"
+
+#define CC_VEGAS 0x00 // Delay-based : compares the short and long term RTT averages
+#define CC_BBR 0x01 // Rate-based : paces at the estimated bottleneck bandwidth, window = a few bandwidth-delay products. Ignores losses
+
+#define BASE_WINDOW 8.0 // Number of tokens to start with
+#define SS_THRESHOLD 16.0 // Slow start threshold
+#define MAX_WINDOW 5000 // Largest congestion window : the window is clamped to it
+#define HIGH_BDP_MAX_WINDOW 65536 // Same in high-BDP mode : 1Gbps over 600ms is about 55000 packets
+#define ALPHA 0.05
+#define BETA 0.2  // Alpha and Beta are Thresholds for the congestion-control algorithm
+#define INCREMENT 3.0 // The increment factor for modifying the CWN
+
+#define BBR_STARTUP_GAIN 2.885 // 2 / ln(2) : doubles the sending rate every round
+#define BBR_CWND_GAIN 2.0 // The window allows that many bandwidth-delay products in flight
+#define BBR_BW_ROUNDS 10 // The bandwidth estimate is the maximum of the samples of the last rounds
+#define BBR_FULL_BW_GROWTH 1.25 // Startup ends when the bandwidth did not grow that much ...
+#define BBR_FULL_BW_ROUNDS 3 // ... for that many rounds
+#define BBR_GAIN_CYCLE 8 // Probing cycle : one round at 5/4 of the bandwidth, one at 3/4 to drain the queue, then cruise
+#define BBR_MIN_RTT_WINDOW 10000000 // Refresh the min RTT when it is that old (uSeconds) ...
+#define BBR_PROBE_RTT_DURATION 200000 // ... by keeping BBR_PROBE_RTT_WINDOW packets in flight during that long (uSeconds)
+#define BBR_PROBE_RTT_WINDOW 4
+
+#define BBR_STARTUP 0
+#define BBR_DRAIN 1
+#define BBR_PROBE_BW 2
+#define BBR_PROBE_RTT 3
+
+typedef struct congestionstate_t {
+    int algorithm; // CC_VEGAS or CC_BBR
+    float congestionWindow; // Maximum number of packets in flight
+    int slowStartMode;
+    int maxWindow; // MAX_WINDOW, or HIGH_BDP_MAX_WINDOW in high-BDP mode
+    
+    // ~~ Coupled mode : the encoders of the muxes to the same peer share one state ~~
+    int nUsers; // Encoders sharing this state, 1 if uncoupled
+    int nInFlight; // Packets in flight, for all of them
+    
+    // ~~ BBR model ~~
+    int mode; // BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW or BBR_PROBE_RTT
+    double bandwidthSamples[BBR_BW_ROUNDS]; // Delivery rate of the last rounds (packets per uSecond)
+    double maxBandwidth; // Maximum of the samples
+    double fullBandwidth; // Bandwidth at the last significant growth, during startup
+    int fullBandwidthRounds; // Rounds without significant growth
+    double minRtt; // Smallest RTT seen in the last BBR_MIN_RTT_WINDOW (uSeconds), 0 if none
+    struct timeval minRttStamp;
+    struct timeval probeRttDone; // End of BBR_PROBE_RTT
+    double pacingGain;
+    int cycleIndex;
+    
+    uint32_t lastSentSeqNo; // Highest sequence number sent. The state numbers packets on its own, across the encoders sharing it
+    uint32_t roundEndSeqNo; // A round trip ends when this packet gets acknowledged
+    uint64_t roundCount;
+    int ackedInRound; // Packets acknowledged since roundStart
+    struct timeval roundStart;
+} congestionstate;
+
+congestionstate* congestionInit(int algorithm);
+
+void congestionFree(congestionstate* cc);
+
+congestionstate* congestionShare(congestionstate* cc);
+
+void congestionRestore(congestionstate* cc, congestionstate saved);
+
+void congestionOnSend(congestionstate* cc, uint32_t seqNo);
+
+void congestionOnAck(congestionstate* cc, uint32_t seqNo, int rtt, double shortTermRtt, double longTermRtt, struct timeval now);
+
+void congestionOnTimeout(congestionstate* cc);
+
+void congestionSeed(congestionstate* cc, float window);
+
+int congestionWindow(congestionstate cc);
+
+int congestionAllowance(congestionstate cc, int nInFlight);
+
+double congestionPacingRate(congestionstate cc);
+
+void congestionPrint(congestionstate cc);
+
+#endif
@@ -18,21 +18,34 @@
 
 #include "decoding.h"
 
+void allocateBlock(decoderstate* state);
+void handleInBlock(decoderstate* state, datapacket* packet);
+void handleInSliding(decoderstate* state, datapacket* packet);
+void handleInFountain(decoderstate* state, datapacket* packet);
+void dropFirstBlock(decoderstate* state);
+int slideDecoderWindow(decoderstate* state, int nPackets);
+int deliveredPrefix(decoderstate state);
+int updateDecodedPrefix(decoderstate* state, int blockNo);
+
 int appendCodedPayload(decoderstate* state, uint8_t* coeffsVector, uint8_t* dataVector, int blockNo);
 void extractData(decoderstate* state);
+void reduceFullBlocks(decoderstate* state);
+void runReductionJob(void* job);
+int isReducing(decoderstate state, int blockNo);
+void extractDataSliding(decoderstate* state);
+void extractDataFountain(decoderstate* state);
 
-int isZeroAndOneAt(uint8_t* vector, int index, int size);
+int isZeroAndOneAt(int field, uint8_t* vector, int index, int size);
+void getCodedCoefficients(decoderstate state, datapacket packet, uint8_t* vector, int nPackets);
 
+void setLossEntry(lossInformationBuffer* buffer, int index, int isReceived);
 void countLoss(decoderstate state, uint16_t* lost, uint16_t* total);
 
 void handleInCoded(decoderstate* state, uint8_t* buffer, int size){
     do_debug("in handleInCoded\n");
     datapacket* packet = bufferToData(buffer, size);
-    matrix *coeffs, *tmp;
     int bufLen, i, delta;
-    uint8_t* dataVector;
-    uint8_t* coeffVector;
-    uint8_t ackBuffer[100];
+    uint8_t ackBuffer[ACK_MAX_LENGTH];
     uint16_t loss, total;
     
     //printf("Data received :\n");
@@ -40,39 +53,144 @@ void handleInCoded(decoderstate* state, uint8_t* buffer, int size){
     
     do_debug("p->packetNumber = %2x\n", packet->packetNumber);
     
-    // ~~ Allocate blocks & coefficient matrix if necessary ~~
-    while(state->currBlock + state->numBlock - 1 < packet->blockNo){
-        do_debug("CurrBlock = %d, numBlock = %d, blockNo of received Data = %d\n", state->currBlock, state->numBlock, packet->blockNo);
+    if(state->codec == CODEC_SLIDING){
+        handleInSliding(state, packet);
+    } else if(state->codec == CODEC_FOUNTAIN){
+        handleInFountain(state, packet);
+    } else {
+        handleInBlock(state, packet);
+    }
+    
+    // ~~ Update the loss information buffer ~~
+    delta = diffSerial32(packet->seqNo, state->lastSeqReceived);
+    if(delta > 0){
+        // Packets skipped over are lost (until they show up) ; past a whole buffer, only the last ones matter
+        for(i = max(1, delta - state->lossBuffer->size + 1); i < delta; i++){
+            setLossEntry(state->lossBuffer, (state->lossBuffer->currentIndex + i) % state->lossBuffer->size, false);
+        }
+        state->lossBuffer->currentIndex = (state->lossBuffer->currentIndex + delta) % state->lossBuffer->size;
+        setLossEntry(state->lossBuffer, state->lossBuffer->currentIndex, true);
+        state->lastSeqReceived = packet->seqNo;
+    } else if(-delta < state->lossBuffer->size){
+        setLossEntry(state->lossBuffer, (state->lossBuffer->currentIndex + delta + state->lossBuffer->size) % state->lossBuffer->size, true);
+    }
+    
+    // ~~ Send an ACK back ~~
+    ackpacket ack;
+    // Report on every block we know about, so that the encoder does not over-send for the later ones
+    ack.ack_nBlocks = (state->numBlock < MAX_ACK_BLOCKS) ? state->numBlock : MAX_ACK_BLOCKS;
+    ack.ack_dofs = malloc(MAX_ACK_BLOCKS * sizeof(uint16_t));
+    ack.ack_decodedPrefix = calloc(MAX_ACK_BLOCKS, sizeof(uint16_t));
+    for(i = 0; i < ack.ack_nBlocks; i++){
+        if(state->codec == CODEC_BLOCK){
+            // The rows of a generation being reduced cannot be read yet : report its last prefix
+            ack.ack_decodedPrefix[i] = isReducing(*state, i) ? state->decodedPrefix[i] : updateDecodedPrefix(state, i);
+        }
+        if(state->codec == CODEC_SLIDING){
+            // Degrees of freedom received beyond what has been delivered, for the window only
+            ack.ack_dofs[i] = state->nPacketsInBlock[0] - deliveredPrefix(*state);
+        } else {
+            // Include the number of packets received
+            ack.ack_dofs[i] = state->nPacketsInBlock[i];
+        }
+    }
+    
+    ack.ack_seqNo = packet->seqNo;
+    ack.ack_currBlock = state->currBlock;
+    if((state->codec == CODEC_SLIDING) && (state->numBlock > 0)){
+        ack.ack_currBlock += deliveredPrefix(*state);
+    }
+    
+    countLoss(*state, &loss, &total);
+    ack.ack_loss = loss;
+    ack.ack_total = total;
+        
+    //printf("ACK to send :\n");
+    //ackPacketPrint(ack);
+    
+    ackPacketToBuffer(ack, ackBuffer, &bufLen);
+    free(ack.ack_dofs);
+    free(ack.ack_decodedPrefix);
+    
+    state->ackToSend = realloc(state->ackToSend, (state->nAckToSend + 1) * sizeof(uint8_t*));
+    state->ackToSendSize = realloc(state->ackToSendSize, (state->nAckToSend + 1) * sizeof(int));
+
+    state->ackToSend[state->nAckToSend] = malloc(bufLen * sizeof(uint8_t));
+    memcpy(state->ackToSend[state->nAckToSend], ackBuffer, bufLen);
+    state->ackToSendSize[state->nAckToSend] = bufLen;
+    state->nAckToSend ++;
+    
+    free(packet->payloadAndSize);
+    free(packet);
+}
+
+void allocateBlock(decoderstate* state){
+    int i, maxPackets = (state->codec == CODEC_FOUNTAIN) ? FOUNTAIN_BLKSIZE : BLKSIZE;
+    if(state->codec == CODEC_FOUNTAIN){
+        state->fountainBlocks = realloc(state->fountainBlocks, (state->numBlock + 1) * sizeof(fountaindecoder*));
+        state->fountainBlocks[state->numBlock] = fountainDecoderInit();
+    } else {
         state->blocks = realloc(state->blocks, (state->numBlock + 1) * sizeof(matrix*));
         state->blocks[state->numBlock] = mCreate(BLKSIZE, PACKETSIZE);
         state->coefficients = realloc(state->coefficients, (state->numBlock + 1) * sizeof(matrix*));
-        state->coefficients[state->numBlock] = mCreate(BLKSIZE, BLKSIZE);
-        
-        state->nPacketsInBlock = realloc(state->nPacketsInBlock, (state->numBlock + 1) * sizeof(int));
-        state->nPacketsInBlock[state->numBlock] = 0;
-        
-        state->isSentPacketInBlock = realloc(state->isSentPacketInBlock, (state->numBlock + 1) * sizeof(int*));
-        state->isSentPacketInBlock[state->numBlock] = malloc(BLKSIZE * sizeof(int));
-        for(i = 0; i<BLKSIZE; i++){
-            state->isSentPacketInBlock[state->numBlock][i] = false;
-        } 
-        
-        state->numBlock ++;
+        state->coefficients[state->numBlock] = mCreate(BLKSIZE, fieldRowBytes(state->field, BLKSIZE));
+    }
+    
+    state->nPacketsInBlock = realloc(state->nPacketsInBlock, (state->numBlock + 1) * sizeof(int));
+    state->nPacketsInBlock[state->numBlock] = 0;
+    state->blockSize = realloc(state->blockSize, (state->numBlock + 1) * sizeof(int));
+    state->blockSize[state->numBlock] = 0;
+    state->decodedPrefix = realloc(state->decodedPrefix, (state->numBlock + 1) * sizeof(int));
+    state->decodedPrefix[state->numBlock] = 0;
+    state->reductions = realloc(state->reductions, (state->numBlock + 1) * sizeof(reductionjob*));
+    state->reductions[state->numBlock] = 0;
+    
+    state->isSentPacketInBlock = realloc(state->isSentPacketInBlock, (state->numBlock + 1) * sizeof(int*));
+    state->isSentPacketInBlock[state->numBlock] = malloc(maxPackets * sizeof(int));
+    for(i = 0; i<maxPackets; i++){
+        state->isSentPacketInBlock[state->numBlock][i] = false;
+    } 
+    
+    state->numBlock ++;
+}
+
+void handleInBlock(decoderstate* state, datapacket* packet){
+    matrix *coeffs;
+    uint8_t* dataVector;
+    uint8_t* coeffVector;
+    int blockIndex = diffSerial16(packet->blockNo, state->currBlock); // Block numbers wrap around
+    
+    if(blockIndex >= maxBufferedBlocks(state->codec, state->isHighBdp)){
+        do_debug("Packet received for block %u, beyond the blocks we may buffer. Drop.\n", packet->blockNo);
+        state->stats_nOutdated++;
+        return;
+    }
+    
+    // ~~ Allocate blocks & coefficient matrix if necessary ~~
+    while(state->numBlock <= blockIndex){
+        do_debug("CurrBlock = %d, numBlock = %d, blockNo of received Data = %d\n", state->currBlock, state->numBlock, packet->blockNo);
+        allocateBlock(state);
+    }
+    
+    // ~~ A packet from block n means block n-1 is closed, and tells us its size ~~
+    if((packet->prevBlockSize != 0) && (blockIndex >= 1)){
+        state->blockSize[blockIndex - 1] = packet->prevBlockSize;
     }
     
-    if(packet->blockNo >= state->currBlock){
-        if((packet->packetNumber & BITMASK_NO) >= state->nPacketsInBlock[packet->blockNo - state->currBlock]){ // Try to append
+    if(blockIndex >= 0){
+        if(state->reductions[blockIndex] != 0){
+            do_debug("Received packet for a full rank block. Drop.\n");
+            state->stats_nAppendedNotInnovativeCounter++;
+        } else if((packet->packetNumber & BITMASK_NO) >= state->nPacketsInBlock[blockIndex]){ // Try to append
             // Compute coefficients
-            coeffs = mCreate(1, BLKSIZE);
+            coeffs = mCreate(1, MAX_COEFFS_BYTES);
             dataVector = calloc(PACKETSIZE, sizeof(uint8_t));
-            coeffVector = calloc(BLKSIZE, sizeof(uint8_t));
+            coeffVector = calloc(MAX_COEFFS_BYTES, sizeof(uint8_t));
             if(((packet->packetNumber) & BITMASK_FLAG) ==  FLAG_CLEAR){
-                coeffs->data[0][((packet->packetNumber) & BITMASK_NO)] = 1;
+                fieldSet(state->field, coeffs->data[0], (packet->packetNumber) & BITMASK_NO, 1);
             } else if(((packet->packetNumber) & BITMASK_FLAG) ==  FLAG_CODED){
-                srandom(packet->seqNo);
-                tmp = getRandomMatrix(1, BLKSIZE);
-                memcpy(coeffs->data[0], tmp->data[0], packet->packetNumber & BITMASK_NO);
-                mFree(tmp);
+                getCodedCoefficients(*state, *packet, coeffs->data[0], packet->packetNumber & BITMASK_NO);
+                state->stats_nCoded++;
             } else {
                 printf("handleInCoded : received a bogus data packet. DIE.");
                 exit(1);
@@ -80,16 +198,16 @@ void handleInCoded(decoderstate* state, uint8_t* buffer, int size){
             
             // ~~ Append to the matrix and eventually decode ~~
             memcpy(dataVector, packet->payloadAndSize, packet->size);
-            memcpy(coeffVector, coeffs->data[0], BLKSIZE);
+            memcpy(coeffVector, coeffs->data[0], MAX_COEFFS_BYTES);
             
             mFree(coeffs);
             
-            if(appendCodedPayload(state, coeffVector, dataVector, packet->blockNo - state->currBlock)){
+            if(appendCodedPayload(state, coeffVector, dataVector, blockIndex)){
                 do_debug("Received an innovative packet\n");
                 state->stats_nInnovative++;
             } else {
                 do_debug("Received packet was not innovative. Drop.\n");
-                if(packet->blockNo - state->currBlock == 0){
+                if(blockIndex == 0){
                     state->stats_nAppendedNotInnovativeGaloisFirstBlock++;
                 } else {
                     state->stats_nAppendedNotInnovativeGaloisOtherBlock++;
@@ -108,80 +226,216 @@ void handleInCoded(decoderstate* state, uint8_t* buffer, int size){
     }
     
     // ~~ Try to decode ~~
+    reduceFullBlocks(state);
     if((state->numBlock > 0) && (state->nPacketsInBlock[0] > 0)){
         do_debug("Calling extractData() while numBlock = %d, currBlock = %d, nPacketInBlock[0] = %d\n", state->numBlock, state->currBlock, state->nPacketsInBlock[0]);
         extractData(state);
     }
+}
+
+void handleInFountain(decoderstate* state, datapacket* packet){
+    int neighbours[FOUNTAIN_BLKSIZE], degree, index = packet->packetNumber & BITMASK_NO;
+    int blockIndex = diffSerial16(packet->blockNo, state->currBlock);
+    int isClear = (((packet->packetNumber) & BITMASK_FLAG) == FLAG_CLEAR);
+    uint8_t* dataVector;
+    fountaindecoder* decoder;
     
+    if(blockIndex >= maxBufferedBlocks(state->codec, state->isHighBdp)){
+        do_debug("Packet received for block %u, beyond the blocks we may buffer. Drop.\n", packet->blockNo);
+        state->stats_nOutdated++;
+        return;
+    }
     
-    // ~~ Update the loss information buffer ~~
-    delta = packet->seqNo - state->lastSeqReceived;
-    if(delta > 0){
-        for(i = state->lossBuffer->currentIndex + 1; i < (state->lossBuffer->currentIndex + delta); i++){
-            state->lossBuffer->isReceived[i % LOSS_BUFFER_SIZE] = false;
+    while(state->numBlock <= blockIndex){
+        allocateBlock(state);
+    }
+    
+    if((packet->prevBlockSize != 0) && (blockIndex >= 1)){
+        state->blockSize[blockIndex - 1] = packet->prevBlockSize;
+    }
+    
+    // Clear packets carry their position in the block, coded packets the size of the block
+    if((blockIndex >= 0) && (isClear ? (index < FOUNTAIN_BLKSIZE) : ((index > 0) && (index <= FOUNTAIN_BLKSIZE)))){
+        decoder = state->fountainBlocks[blockIndex];
+        dataVector = calloc(PACKETSIZE, sizeof(uint8_t));
+        memcpy(dataVector, packet->payloadAndSize, packet->size);
+        
+        if(isClear){
+            neighbours[0] = index;
+            degree = 1;
+        } else {
+            degree = getFountainNeighbours(neighbours, index, packet->seqNo, state->degrees);
+            state->stats_nCoded++;
         }
-        state->lossBuffer->isReceived[(state->lossBuffer->currentIndex + delta) % LOSS_BUFFER_SIZE] = true;
-        state->lossBuffer->currentIndex = (state->lossBuffer->currentIndex + delta) % LOSS_BUFFER_SIZE;
+        
+        if(fountainAddSymbol(decoder, neighbours, degree, dataVector)){
+            do_debug("Received an innovative packet\n");
+            state->stats_nInnovative++;
+        } else if(blockIndex == 0){
+            state->stats_nAppendedNotInnovativeGaloisFirstBlock++;
+        } else {
+            state->stats_nAppendedNotInnovativeGaloisOtherBlock++;
+        }
+        state->nPacketsInBlock[blockIndex] = fountainDofs(*decoder);
+        
+        free(dataVector);
     } else {
-        state->lossBuffer->isReceived[(state->lossBuffer->currentIndex + delta + LOSS_BUFFER_SIZE) % LOSS_BUFFER_SIZE] = true;
+        do_debug("Packet received for an outdated block. Drop.\n");
+        state->stats_nOutdated++;
     }
-    state->lastSeqReceived = max(state->lastSeqReceived, packet->seqNo);
     
-    // ~~ Send an ACK back ~~
-    ackpacket ack;
-    ack.ack_dofs = malloc(DOFS_LENGTH * sizeof(uint8_t));
-    for(i = 0; i < DOFS_LENGTH; i++){
-        if(state->numBlock > i){ // If the i-th block is allocated
-            // Include the number of packets received
-            ack.ack_dofs[i] = state->nPacketsInBlock[i];
-        } else {
-            // Otherwise, let it just be zero
-            ack.ack_dofs[i] = 0;
+    if(state->numBlock > 0){
+        extractDataFountain(state);
+    }
+}
+
+void handleInSliding(decoderstate* state, datapacket* packet){
+    uint8_t* dataVector;
+    uint8_t* coeffVector;
+    int offset, nPackets = packet->packetNumber & BITMASK_NO, isOutdated = false;
+    
+    if(state->numBlock == 0){
+        allocateBlock(state);
+    }
+    
+    // ~~ The encoder only moves its window forward once we have delivered what it dropped ; do the same ~~
+    offset = (int16_t)(packet->blockNo - state->currBlock); // Position of the encoder's window in ours
+    if(offset > 0){
+        if(!slideDecoderWindow(state, offset)){
+            do_debug("Encoder window starts at %u, beyond what we delivered. Drop.\n", packet->blockNo);
+            state->stats_nOutdated++;
+            return;
         }
+        offset = 0;
     }
     
-    ack.ack_seqNo = packet->seqNo;
-    ack.ack_currBlock = state->currBlock;
+    dataVector = calloc(PACKETSIZE, sizeof(uint8_t));
+    coeffVector = calloc(MAX_COEFFS_BYTES, sizeof(uint8_t));
+    if(((packet->packetNumber) & BITMASK_FLAG) ==  FLAG_CLEAR){
+        if(offset + nPackets < 0){
+            isOutdated = true;
+        } else {
+            fieldSet(state->field, coeffVector, offset + nPackets, 1);
+        }
+    } else if(((packet->packetNumber) & BITMASK_FLAG) ==  FLAG_CODED){
+        // Packets before our window have been dropped : we cannot remove them from the combination anymore
+        if(offset < 0){
+            isOutdated = true;
+        } else {
+            getCodedCoefficients(*state, *packet, coeffVector, nPackets);
+            state->stats_nCoded++;
+        }
+    } else {
+        printf("handleInCoded : received a bogus data packet. DIE.");
+        exit(1);
+    }
     
-    countLoss(*state, &loss, &total);
-    ack.ack_loss = loss;
-    ack.ack_total = total;
+    if(isOutdated){
+        do_debug("Packet received for a part of the window that has been dropped. Drop.\n");
+        state->stats_nOutdated++;
+    } else {
+        memcpy(dataVector, packet->payloadAndSize, packet->size);
+        if(appendCodedPayload(state, coeffVector, dataVector, 0)){
+            do_debug("Received an innovative packet\n");
+            state->stats_nInnovative++;
+        } else {
+            do_debug("Received packet was not innovative. Drop.\n");
+            state->stats_nAppendedNotInnovativeGaloisFirstBlock++;
+        }
         
-    //printf("ACK to send :\n");
-    //ackPacketPrint(ack);
-    
-    ackPacketToBuffer(ack, ackBuffer, &bufLen);
-    free(ack.ack_dofs);
+        // ~~ Deliver as much of the window as possible ~~
+        extractDataSliding(state);
+    }
     
-    state->ackToSend = realloc(state->ackToSend, (state->nAckToSend + 1) * sizeof(uint8_t*));
-    state->ackToSendSize = realloc(state->ackToSendSize, (state->nAckToSend + 1) * sizeof(int));
+    // Note : delivered rows are kept until the encoder drops them too, since its coded packets still combine them
+    free(dataVector);
+    free(coeffVector);
+}
 
-    state->ackToSend[state->nAckToSend] = malloc(bufLen * sizeof(uint8_t));
-    memcpy(state->ackToSend[state->nAckToSend], ackBuffer, bufLen);
-    state->ackToSendSize[state->nAckToSend] = bufLen;
-    state->nAckToSend ++;
+/* Drop the first nPackets rows of the window, if they have all been delivered. Returns false otherwise. */
+int slideDecoderWindow(decoderstate* state, int nPackets){
+    int i, coeffBytes = fieldRowBytes(state->field, BLKSIZE);
+    uint8_t **droppedData, **droppedCoeffs;
     
-    free(packet->payloadAndSize);
-    free(packet);
+    if(nPackets > deliveredPrefix(*state)){
+        return false;
+    }
+    
+    // Rows are indexed by their pivot : rows left in the window are already zero on the dropped columns
+    droppedData = malloc(nPackets * sizeof(uint8_t*));
+    droppedCoeffs = malloc(nPackets * sizeof(uint8_t*));
+    memcpy(droppedData, state->blocks[0]->data, nPackets * sizeof(uint8_t*));
+    memcpy(droppedCoeffs, state->coefficients[0]->data, nPackets * sizeof(uint8_t*));
+    memmove(state->blocks[0]->data, state->blocks[0]->data + nPackets, (BLKSIZE - nPackets) * sizeof(uint8_t*));
+    memmove(state->coefficients[0]->data, state->coefficients[0]->data + nPackets, (BLKSIZE - nPackets) * sizeof(uint8_t*));
+    for(i = 0; i < nPackets; i++){
+        memset(droppedData[i], 0, PACKETSIZE);
+        memset(droppedCoeffs[i], 0, coeffBytes);
+        state->blocks[0]->data[BLKSIZE - nPackets + i] = droppedData[i];
+        state->coefficients[0]->data[BLKSIZE - nPackets + i] = droppedCoeffs[i];
+    }
+    free(droppedData);
+    free(droppedCoeffs);
+    
+    // Shift the columns of the rows left ; a row is empty if its pivot is, and a row only has symbols from its pivot on
+    for(i = 0; i < BLKSIZE - nPackets; i++){
+        if(fieldGet(state->field, state->coefficients[0]->data[i], i + nPackets) != 0x00){
+            fieldShiftRow(state->field, state->coefficients[0]->data[i], nPackets, i, coeffBytes);
+        }
+    }
+    
+    memmove(state->isSentPacketInBlock[0], state->isSentPacketInBlock[0] + nPackets, (BLKSIZE - nPackets) * sizeof(int));
+    for(i = BLKSIZE - nPackets; i < BLKSIZE; i++){
+        state->isSentPacketInBlock[0][i] = false;
+    }
+    
+    state->nPacketsInBlock[0] -= nPackets;
+    state->currBlock += nPackets;
+    return true;
+}
+
+// Number of rows at the start of the window that have been delivered to the application
+int deliveredPrefix(decoderstate state){
+    int i = 0;
+    while((i < BLKSIZE) && (state.isSentPacketInBlock[0][i])){
+        i++;
+    }
+    return i;
 }
 
 decoderstate* decoderStateInit(){
     int i;
     decoderstate* ret = malloc(sizeof(decoderstate));
+    galoisInit();
     
+    ret->codec = CODEC_BLOCK;
+    ret->coeffs = COEFFS_DENSE;
+    ret->sparseNonZeros = 0;
+    ret->field = FIELD_GF256;
+    decoderSelectKernels(ret);
     ret->blocks = 0;
     ret->coefficients = 0;
+    ret->fountainBlocks = 0;
+    ret->degrees = degreeDistributionInit();
     
     ret->currBlock = 0;
     ret->numBlock = 0;
     ret->nPacketsInBlock = 0;
+    ret->blockSize = 0;
     ret->isSentPacketInBlock = 0;
+    ret->decodedPrefix = 0;
+    ret->reductions = 0;
+    ret->codingPool = 0;
     
     ret->lossBuffer = malloc(sizeof(lossInformationBuffer));
-    for(i = 0; i < LOSS_BUFFER_SIZE; i++){// Initialize the counter
+    for(i = 0; i < HIGH_BDP_LOSS_BUFFER_SIZE; i++){// Initialize the counter
         ret->lossBuffer->isReceived[i] = -1;
     }
+    ret->lossBuffer->size = LOSS_BUFFER_SIZE;
     ret->lossBuffer->currentIndex = 0;
+    ret->lossBuffer->nLost = 0;
+    ret->lossBuffer->nTotal = 0;
+    ret->isHighBdp = false;
     
     ret->lastSeqReceived = 0;
     
@@ -197,6 +451,8 @@ decoderstate* decoderStateInit(){
     ret->stats_nAppendedNotInnovativeGaloisOtherBlock = 0;
     ret->stats_nInnovative = 0;
     ret->stats_nOutdated = 0;
+    ret->stats_nCoded = 0;
+    ret->stats_nParallelReductions = 0;
 
     return ret;
 }
@@ -205,16 +461,32 @@ void decoderStateFree(decoderstate* state){
     int i;
     
     for(i = 0; i < state->numBlock; i++){
-        mFree(state->blocks[i]);
-        mFree(state->coefficients[i]);
+        if(state->reductions[i] != 0){
+            codingPoolWait(&(state->reductions[i]->nRunning));
+            free(state->reductions[i]);
+        }
+        if(state->codec == CODEC_FOUNTAIN){
+            fountainDecoderFree(state->fountainBlocks[i]);
+        } else {
+            mFree(state->blocks[i]);
+            mFree(state->coefficients[i]);
+        }
         free(state->isSentPacketInBlock[i]);
     }
     if(state->numBlock > 0){
         free(state->nPacketsInBlock);
-        free(state->blocks);
-        free(state->coefficients);
+        free(state->blockSize);
+        free(state->decodedPrefix);
+        free(state->reductions);
         free(state->isSentPacketInBlock);
+        if(state->codec == CODEC_FOUNTAIN){
+            free(state->fountainBlocks);
+        } else {
+            free(state->blocks);
+            free(state->coefficients);
+        }
     }
+    degreeDistributionFree(state->degrees);
     
     if(state->nDataToSend > 0){
         free(state->dataToSend);
@@ -233,55 +505,52 @@ void decoderStateFree(decoderstate* state){
     free(state);
 }
 
+// Pick the row kernels for the payloads and the coefficient rows of the field ; again whenever the field changes
+void decoderSelectKernels(decoderstate* state){
+    state->payloadKernels = getRowKernels(PACKETSIZE);
+    state->coeffKernels = getRowKernels(fieldRowBytes(state->field, BLKSIZE));
+}
+
 int appendCodedPayload(decoderstate* state, uint8_t* coeffsVector, uint8_t* dataVector, int blockNo){
     do_debug("in appendCodedPayload\n");
-    int i, index, isEmpty = true;
-    uint8_t factor;
-    // Index = index of the first non-zero element
-    for(index=0; index <= BLKSIZE; index++){
-        if(index == BLKSIZE){
-            return false;
-        }
-        if(coeffsVector[index] != 0x00){
-            break;
+    int index, offset, field = state->field, coeffBytes = fieldRowBytes(state->field, BLKSIZE);
+    uint16_t factor;
+    uint8_t** coefficients = state->coefficients[blockNo]->data;
+    
+    // Eliminate column by column ; zero coefficients (most of them, with sparse coding) cost nothing
+    for(index = 0; index < BLKSIZE; index++){
+        factor = fieldGet(field, coeffsVector, index);
+        if(factor == 0x00){
+            continue;
         }
-    }
-    // is the row[index] empty ?
-    for(i=0; i < BLKSIZE; i++){
-        if(state->coefficients[blockNo]->data[index][i] != 0x00){
-            isEmpty = false;
-            break;
+        offset = index * fieldSymbolBits(field) / 8; // Byte holding symbol index ; symbols before it are zero
+        
+        // Rows are stored at the index of their pivot, which is reduced to 1 : a zero pivot means an empty row
+        if(fieldGet(field, coefficients[index], index) == 0x00){
+            // Append reduced
+            fieldRowReduce(field, coeffsVector + offset, factor, coeffBytes - offset);
+            fieldRowReduce(field, dataVector, factor, PACKETSIZE);
+            memcpy(state->blocks[blockNo]->data[index], dataVector, PACKETSIZE);
+            memcpy(coefficients[index], coeffsVector, coeffBytes);
+            state->nPacketsInBlock[blockNo] ++;
+            return true;
         }
-    }
-    
-    if(isEmpty){
-        // Append reduced
-        factor = coeffsVector[index];
-        rowReduce(coeffsVector, factor, BLKSIZE);
-        rowReduce(dataVector, factor, PACKETSIZE);
-        memcpy(state->blocks[blockNo]->data[index], dataVector, PACKETSIZE);
-        memcpy(state->coefficients[blockNo]->data[index], coeffsVector, BLKSIZE);
-        state->nPacketsInBlock[blockNo] ++;
-        return true;
-    } else {
-        // Try to eliminate
-        factor = coeffsVector[index];
-        rowMulSub(coeffsVector, state->coefficients[blockNo]->data[index], factor, BLKSIZE);
-        rowMulSub(dataVector, state->blocks[blockNo]->data[index], factor, PACKETSIZE);
         
-        // Recursive call
-        return appendCodedPayload(state, coeffsVector, dataVector, blockNo);
+        // Eliminate ; both rows are zero before index
+        fieldRowMulSub(field, coeffsVector + offset, coefficients[index] + offset, factor, coeffBytes - offset);
+        fieldRowMulSubKernels(field, state->payloadKernels, dataVector, state->blocks[blockNo]->data[index], factor, PACKETSIZE);
     }
     
+    return false;
 }
 
-int isZeroAndOneAt(uint8_t* vector, int index, int size){
+int isZeroAndOneAt(int field, uint8_t* vector, int index, int size){
     int i;
     for(i = 0; i < size; i++){
-        if((i == index) && (vector[i] != 0x01)){
+        if((i == index) && (fieldGet(field, vector, i) != 0x01)){
             return false;
         }
-        if((i != index) && (vector[i] != 0x00)){
+        if((i != index) && (fieldGet(field, vector, i) != 0x00)){
             return false;
         }
     }
@@ -289,18 +558,38 @@ int isZeroAndOneAt(uint8_t* vector, int index, int size){
     return true;
 }
 
+/* The coefficients the encoder used for a coded packet combining packets packet.firstPacket..nPackets-1 */
+void getCodedCoefficients(decoderstate state, datapacket packet, uint8_t* vector, int nPackets){
+    getRangeCoefficients(state.field, state.coeffs == COEFFS_MDS, vector, (packet.firstPacket < nPackets) ? packet.firstPacket : 0, nPackets, repairSeed(packet.blockNo, packet.repairNo), (state.coeffs == COEFFS_SPARSE) ? state.sparseNonZeros : 0, packet.repairNo);
+}
+
+/* Advance the decoded prefix of a block. Decoded rows are never modified again, so the prefix only grows. */
+int updateDecodedPrefix(decoderstate* state, int blockNo){
+    int* prefix = &(state->decodedPrefix[blockNo]);
+    uint8_t** coefficients = state->coefficients[blockNo]->data;
+    
+    while((*prefix < BLKSIZE) && (fieldGet(state->field, coefficients[*prefix], *prefix) != 0x00) && isZeroAndOneAt(state->field, coefficients[*prefix], *prefix, BLKSIZE)){
+        (*prefix)++;
+    }
+    return *prefix;
+}
+
 void extractData(decoderstate* state){
     do_debug("in extractData\n");
     // We only try to extract data on current block.
     
-    int nPackets = state->nPacketsInBlock[0], i, firstNonDecoded = -1;
-    uint8_t factor;
+    int nPackets = state->nPacketsInBlock[0], i, firstNonDecoded = -1, coeffBytes = fieldRowBytes(state->field, BLKSIZE);
+    uint16_t factor;
     uint16_t size;
     
+    if(state->reductions[0] != 0){ // Reduced, or being reduced by a coding thread
+        codingPoolWait(&(state->reductions[0]->nRunning));
+    }
+    
     // Find the first non-decoded line :
     for(i = 0; i<nPackets; i++){
         // Look for decoded packets to send
-        if((isZeroAndOneAt(state->coefficients[0]->data[i], i, BLKSIZE)) && !(state->isSentPacketInBlock[0][i])){
+        if((isZeroAndOneAt(state->field, state->coefficients[0]->data[i], i, BLKSIZE)) && !(state->isSentPacketInBlock[0][i])){
                 memcpy(&size, state->blocks[0]->data[i], 2);
                 size = ntohs(size);
                 do_debug("Got a new decoded packet of size %u to send to the application ! o/\n", size);
@@ -312,7 +601,7 @@ void extractData(decoderstate* state){
                 
                 state->isSentPacketInBlock[0][i] = true;
         }
-        if( ! isZeroAndOneAt(state->coefficients[0]->data[i], i, BLKSIZE)){
+        if( ! isZeroAndOneAt(state->field, state->coefficients[0]->data[i], i, BLKSIZE)){
             firstNonDecoded = i;
             break;
         }
@@ -321,28 +610,15 @@ void extractData(decoderstate* state){
     do_debug("FirstNonDecoded = %d\n", firstNonDecoded);
     
     if(firstNonDecoded == -1){
-        if((nPackets == BLKSIZE) && (state->isSentPacketInBlock[0][BLKSIZE - 1])){
+        if((state->blockSize[0] != 0) && (nPackets == state->blockSize[0]) && (state->isSentPacketInBlock[0][nPackets - 1])){
             // The entire block has been decoded AND sent 
             do_debug("An entire block has been decoded and sent, switch to next block.\n");
+            dropFirstBlock(state);
             
-            mFree(state->blocks[0]);
-            mFree(state->coefficients[0]);
-            free(state->isSentPacketInBlock[0]);
-            
-            for(i = 0; i < state->numBlock - 1; i++){
-                state->blocks[i] = state->blocks[i+1];
-                state->coefficients[i] = state->coefficients[i+1];
-                state->nPacketsInBlock[i] = state->nPacketsInBlock[i+1];
-                state->isSentPacketInBlock[i] = state->isSentPacketInBlock[i+1];
+            // Generations may be small : the next one might already be waiting
+            if((state->numBlock > 0) && (state->nPacketsInBlock[0] > 0)){
+                extractData(state);
             }
-            
-            state->numBlock--;
-            state->currBlock++;
-            
-            state->blocks = realloc(state->blocks, state->numBlock * sizeof(matrix*));
-            state->coefficients = realloc(state->coefficients, state->numBlock * sizeof(matrix*));
-            state->isSentPacketInBlock = realloc(state->isSentPacketInBlock, state->numBlock * sizeof(int*));
-            state->nPacketsInBlock = realloc(state->nPacketsInBlock, state->numBlock * sizeof(int));
         }
         
         return;
@@ -351,13 +627,13 @@ void extractData(decoderstate* state){
     // Try to decode it
     for(i = 0; i<nPackets; i++){
         if(i!=firstNonDecoded){
-            factor = state->coefficients[0]->data[firstNonDecoded][i];
-            rowMulSub(state->coefficients[0]->data[firstNonDecoded], state->coefficients[0]->data[i], factor, BLKSIZE);
-            rowMulSub(state->blocks[0]->data[firstNonDecoded], state->blocks[0]->data[i], factor, PACKETSIZE);
+            factor = fieldGet(state->field, state->coefficients[0]->data[firstNonDecoded], i);
+            fieldRowMulSubKernels(state->field, state->coeffKernels, state->coefficients[0]->data[firstNonDecoded], state->coefficients[0]->data[i], factor, coeffBytes);
+            fieldRowMulSubKernels(state->field, state->payloadKernels, state->blocks[0]->data[firstNonDecoded], state->blocks[0]->data[i], factor, PACKETSIZE);
         }
     }
     
-    if(isZeroAndOneAt(state->coefficients[0]->data[firstNonDecoded], firstNonDecoded, BLKSIZE)){
+    if(isZeroAndOneAt(state->field, state->coefficients[0]->data[firstNonDecoded], firstNonDecoded, BLKSIZE)){
         // We decoded something => call recursively, in case there's something else waiting, or we finished the block
         do_debug("Something got decoded\n");
         extractData(state);
@@ -365,9 +641,182 @@ void extractData(decoderstate* state){
 }
 
 
+/* Free block 0, the next block becomes the current one */
+void dropFirstBlock(decoderstate* state){
+    int i;
+    
+    if(state->codec == CODEC_FOUNTAIN){
+        fountainDecoderFree(state->fountainBlocks[0]);
+    } else {
+        mFree(state->blocks[0]);
+        mFree(state->coefficients[0]);
+    }
+    free(state->isSentPacketInBlock[0]);
+    free(state->reductions[0]);
+    
+    for(i = 0; i < state->numBlock - 1; i++){
+        if(state->codec == CODEC_FOUNTAIN){
+            state->fountainBlocks[i] = state->fountainBlocks[i+1];
+        } else {
+            state->blocks[i] = state->blocks[i+1];
+            state->coefficients[i] = state->coefficients[i+1];
+        }
+        state->nPacketsInBlock[i] = state->nPacketsInBlock[i+1];
+        state->blockSize[i] = state->blockSize[i+1];
+        state->decodedPrefix[i] = state->decodedPrefix[i+1];
+        state->reductions[i] = state->reductions[i+1];
+        state->isSentPacketInBlock[i] = state->isSentPacketInBlock[i+1];
+    }
+    
+    state->numBlock--;
+    state->currBlock++;
+    
+    if(state->codec == CODEC_FOUNTAIN){
+        state->fountainBlocks = realloc(state->fountainBlocks, state->numBlock * sizeof(fountaindecoder*));
+    } else {
+        state->blocks = realloc(state->blocks, state->numBlock * sizeof(matrix*));
+        state->coefficients = realloc(state->coefficients, state->numBlock * sizeof(matrix*));
+    }
+    state->isSentPacketInBlock = realloc(state->isSentPacketInBlock, state->numBlock * sizeof(int*));
+    state->nPacketsInBlock = realloc(state->nPacketsInBlock, state->numBlock * sizeof(int));
+    state->blockSize = realloc(state->blockSize, state->numBlock * sizeof(int));
+    state->decodedPrefix = realloc(state->decodedPrefix, state->numBlock * sizeof(int));
+    state->reductions = realloc(state->reductions, state->numBlock * sizeof(reductionjob*));
+}
+
+// ~~ Generations that are full rank are reduced independently : the later ones by the coding threads, while the current one waits ~~
+
+void reduceFullBlocks(decoderstate* state){
+    int i;
+    reductionjob* job;
+    
+    for(i = 0; i < state->numBlock; i++){
+        if((state->reductions[i] != 0) || (state->blockSize[i] == 0) || (state->nPacketsInBlock[i] < state->blockSize[i]) || (state->decodedPrefix[i] >= state->blockSize[i])){
+            continue;
+        }
+        job = malloc(sizeof(reductionjob));
+        job->field = state->field;
+        job->coeffKernels = state->coeffKernels;
+        job->coefficients = state->coefficients[i];
+        job->data = state->blocks[i];
+        job->nPackets = state->blockSize[i];
+        atomic_init(&(job->nRunning), 0);
+        state->reductions[i] = job;
+        
+        if((state->codingPool != 0) && (i > 0)){
+            codingPoolSubmit(state->codingPool, runReductionJob, job, &(job->nRunning));
+            state->stats_nParallelReductions++;
+        } else { // The application is waiting for the current generation : no point in handing it over
+            runReductionJob(job);
+        }
+    }
+}
+
+/* Back-substitution : rows are stored at their pivot, reduced to 1, so eliminating the columns
+ * from the last one up leaves the identity. Only the coefficients go through it, and record the
+ * inverse of the triangular system : the source packets are then a single product with the data rows */
+void runReductionJob(void* job){
+    reductionjob* j = (reductionjob*)job;
+    int pivot, row, coeffBytes = fieldRowBytes(j->field, BLKSIZE);
+    uint16_t factor;
+    uint8_t* tmp;
+    matrix* inverse = mCreate(j->nPackets, coeffBytes);
+    matrix* decoded = mCreate(j->nPackets, PACKETSIZE);
+    
+    for(row = 0; row < j->nPackets; row++){
+        fieldSet(j->field, inverse->data[row], row, 1);
+    }
+    for(pivot = j->nPackets - 1; pivot > 0; pivot--){
+        for(row = 0; row < pivot; row++){
+            factor = fieldGet(j->field, j->coefficients->data[row], pivot);
+            if(factor != 0x00){
+                fieldRowMulSubKernels(j->field, j->coeffKernels, j->coefficients->data[row], j->coefficients->data[pivot], factor, coeffBytes);
+                fieldRowMulSubKernels(j->field, j->coeffKernels, inverse->data[row], inverse->data[pivot], factor, coeffBytes);
+            }
+        }
+    }
+    
+    fieldMatMulSub(j->field, decoded->data, inverse->data, j->data->data, j->nPackets, 0, j->nPackets, PACKETSIZE);
+    for(row = 0; row < j->nPackets; row++){
+        tmp = j->data->data[row];
+        j->data->data[row] = decoded->data[row];
+        decoded->data[row] = tmp;
+    }
+    mFree(inverse);
+    mFree(decoded);
+}
+
+int isReducing(decoderstate state, int blockNo){
+    return (state.reductions[blockNo] != 0) && !codingPoolIsDone(&(state.reductions[blockNo]->nRunning));
+}
+
+/* Deliver the source packets of the current generation in order, as peeling decodes them */
+void extractDataFountain(decoderstate* state){
+    int i;
+    uint16_t size;
+    fountaindecoder* decoder;
+    
+    while(state->numBlock > 0){
+        decoder = state->fountainBlocks[0];
+        for(i = 0; (i < FOUNTAIN_BLKSIZE) && (decoder->data[i] != 0); i++){
+            if(!state->isSentPacketInBlock[0][i]){
+                memcpy(&size, decoder->data[i], 2);
+                size = ntohs(size);
+                state->dataToSend = realloc(state->dataToSend, (state->nDataToSend + size) * sizeof(uint8_t));
+                memcpy(state->dataToSend + state->nDataToSend, decoder->data[i] + 2, size);
+                state->nDataToSend += size;
+                state->isSentPacketInBlock[0][i] = true;
+            }
+        }
+        
+        if((state->blockSize[0] == 0) || (i < state->blockSize[0])){
+            return;
+        }
+        do_debug("An entire generation has been decoded and sent, switch to next block.\n");
+        dropFirstBlock(state);
+    }
+}
+
+/* Deliver the decoded rows that follow the delivered prefix of the window, reducing them on the fly */
+void extractDataSliding(decoderstate* state){
+    int i, j, coeffBytes = fieldRowBytes(state->field, BLKSIZE);
+    uint16_t factor;
+    uint16_t size;
+    
+    for(i = deliveredPrefix(*state); i < BLKSIZE; i++){
+        if(!isZeroAndOneAt(state->field, state->coefficients[0]->data[i], i, BLKSIZE)){
+            if(fieldGet(state->field, state->coefficients[0]->data[i], i) == 0x00){
+                return; // Nothing received for this row yet
+            }
+            // Rows are kept in echelon form : substract every later pivot
+            for(j = i + 1; j < BLKSIZE; j++){
+                factor = fieldGet(state->field, state->coefficients[0]->data[i], j);
+                if((factor != 0x00) && (fieldGet(state->field, state->coefficients[0]->data[j], j) != 0x00)){
+                    fieldRowMulSubKernels(state->field, state->coeffKernels, state->coefficients[0]->data[i], state->coefficients[0]->data[j], factor, coeffBytes);
+                    fieldRowMulSubKernels(state->field, state->payloadKernels, state->blocks[0]->data[i], state->blocks[0]->data[j], factor, PACKETSIZE);
+                }
+            }
+            if(!isZeroAndOneAt(state->field, state->coefficients[0]->data[i], i, BLKSIZE)){
+                return;
+            }
+        }
+        
+        memcpy(&size, state->blocks[0]->data[i], 2);
+        size = ntohs(size);
+        do_debug("Got a new decoded packet of size %u to send to the application ! o/\n", size);
+        state->dataToSend = realloc(state->dataToSend, (state->nDataToSend + size) * sizeof(uint8_t));
+        memcpy(state->dataToSend + state->nDataToSend, state->blocks[0]->data[i] + 2, size);
+        state->nDataToSend += size;
+        
+        state->isSentPacketInBlock[0][i] = true;
+    }
+}
+
 void decoderStatePrint(decoderstate state){
     uint16_t lost, total;
     printf("Decoder state : \n");
+    printf("\tCodec = %s\n", (state.codec == CODEC_SLIDING) ? "sliding window" : ((state.codec == CODEC_FOUNTAIN) ? "fountain" : "block"));
+    printf("\tField = GF(2^%d)\n", fieldSymbolBits(state.field));
     printf("\tCurrent block = %u\n", state.currBlock);
     printf("\tNumber of blocks = %d\n", state.numBlock);
     printf("\tBytes to send to the application = %d\n", state.nDataToSend);
@@ -377,24 +826,23 @@ void decoderStatePrint(decoderstate state){
     printf("\tLost packets = %u, Total = %u, loss rate = %f\n", lost, total, 1.0 * lost/total);
     
     printf("\tInnov = %lu ; notInnovCounter = %lu ; notInnovGaloisFirstBlock = %lu ;notInnovGaloisOtherBlock = %lu ; outdated = %lu\n", state.stats_nInnovative, state.stats_nAppendedNotInnovativeCounter, state.stats_nAppendedNotInnovativeGaloisFirstBlock, state.stats_nAppendedNotInnovativeGaloisOtherBlock, state.stats_nOutdated);
+    if(state.stats_nCoded > 0){
+        printf("\tCoded = %lu ; not innovative = %f %%%s\n", state.stats_nCoded, 100.0 * (state.stats_nAppendedNotInnovativeGaloisFirstBlock + state.stats_nAppendedNotInnovativeGaloisOtherBlock) / state.stats_nCoded, (state.coeffs == COEFFS_SPARSE) ? " (sparse)" : ((state.coeffs == COEFFS_MDS) ? " (MDS)" : ""));
+    }
 }
 
-void countLoss(decoderstate state, uint16_t* lost, uint16_t* total){
-    int i;
-    *lost = 0;
-    *total = 0;
-    
-    for(i = 0; i < LOSS_BUFFER_SIZE; i++){
-        switch(state.lossBuffer->isReceived[i]){
-            case true:
-                *total += 1;
-                break;
-            case false:
-                *total += 1;
-                *lost += 1;
-                break;
-            default:
-                break;
-        }
+// Set the entry of the loss buffer, keeping its counters up to date
+void setLossEntry(lossInformationBuffer* buffer, int index, int isReceived){
+    if(buffer->isReceived[index] != -1){
+        buffer->nTotal--;
+        buffer->nLost -= !buffer->isReceived[index];
     }
+    buffer->isReceived[index] = isReceived;
+    buffer->nTotal++;
+    buffer->nLost += !isReceived;
+}
+
+void countLoss(decoderstate state, uint16_t* lost, uint16_t* total){
+    *lost = state.lossBuffer->nLost;
+    *total = state.lossBuffer->nTotal;
 }
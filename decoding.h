@@ -21,25 +21,53 @@
 #include "utils.h"
 #include "packet.h"
 #include "matrix.h"
+#include "fountain.h"
+#include "codingpool.h"
 
 #define LOSS_BUFFER_SIZE 512
+#define HIGH_BDP_LOSS_BUFFER_SIZE 16384 // In high-BDP mode, the loss estimate spans that many packets ; fits in the uint16 of the ACK
 
 typedef struct lossInformationBuffer_t{
-    int isReceived[LOSS_BUFFER_SIZE];
+    int8_t isReceived[HIGH_BDP_LOSS_BUFFER_SIZE]; // -1 for unknown
+    int size; // Entries in use : LOSS_BUFFER_SIZE, or HIGH_BDP_LOSS_BUFFER_SIZE in high-BDP mode
     int currentIndex;
+    int nLost; // Counters over the entries, so that ACKs do not scan the buffer
+    int nTotal;
 } lossInformationBuffer;
 
 
+typedef struct reductionjob_t { // Back-substitution of a full-rank generation, to the identity
+    int field;
+    rowkernels* coeffKernels;
+    matrix* coefficients;
+    matrix* data;
+    int nPackets;
+    atomic_int nRunning; // 0 once the generation is reduced
+} reductionjob;
+
 typedef struct decoderstate_t {
+    int codec; // CODEC_BLOCK, CODEC_SLIDING or CODEC_FOUNTAIN. With CODEC_SLIDING, block 0 is the only block and slides with the encoder's window
+    int coeffs; // COEFFS_DENSE, COEFFS_SPARSE or COEFFS_MDS
+    int sparseNonZeros; // With COEFFS_SPARSE, number of non-zero coefficients in a coded packet
+    int field; // FIELD_GF256, FIELD_GF2, FIELD_GF16 or FIELD_GF65536. Coefficient rows hold BLKSIZE packed symbols
     matrix** blocks;
     matrix** coefficients;
+    fountaindecoder** fountainBlocks; // Replace blocks and coefficients with CODEC_FOUNTAIN
+    degreedistribution* degrees; // With CODEC_FOUNTAIN, degrees of the coded packets
     
     lossInformationBuffer* lossBuffer; // Store information about received packets, to estimate loss at the receiver side
     
-    uint16_t currBlock;
+    uint16_t currBlock; // With CODEC_SLIDING, index of the packet in row 0 of the window
+    int isHighBdp; // True to buffer up to HIGH_BDP_MEMORY of blocks instead of MAX_BLOCKS
     int numBlock; // Currently allocated blocks
     int* nPacketsInBlock; // Number of packet in each known block
+    int* blockSize; // Final number of packets in each known block, 0 while the encoder has not announced it
     int** isSentPacketInBlock; // True if a packet has already been sent to the application
+    int* decodedPrefix; // Leading rows of each block that are decoded (CODEC_BLOCK) ; acknowledged, so that coded packets skip them
+    reductionjob** reductions; // Reduction of each block once it is full rank (CODEC_BLOCK), 0 before ; the rows belong to it while it runs
+    codingpool* codingPool; // Threads reducing the later generations while the current one waits ; 0 to reduce them inline
+    rowkernels* payloadKernels; // Row kernels specialized for the data rows, 0 for the generic ones
+    rowkernels* coeffKernels; // Row kernels specialized for the coefficient rows of the field, 0 for the generic ones
     
     uint8_t* dataToSend; // Decoded data, to be send to the application via the TCP socket
     int nDataToSend; // Number of bytes in buffer
@@ -55,6 +83,9 @@ typedef struct decoderstate_t {
     long unsigned int stats_nOutdated;
     long unsigned int stats_nAppendedNotInnovativeCounter;
     long unsigned int stats_nInnovative;
+    long unsigned int stats_nCoded; // Coded packets that reached the elimination
+    long unsigned int stats_nParallelReductions; // Generations reduced by the coding threads
+
 } decoderstate;
 
 void handleInCoded(decoderstate* state, uint8_t* buffer, int size);
@@ -63,6 +94,8 @@ decoderstate* decoderStateInit();
 
 void decoderStateFree(decoderstate* state);
 
+void decoderSelectKernels(decoderstate* state);
+
 void decoderStatePrint(decoderstate state);
 
 #endif
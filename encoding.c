@@ -18,21 +18,37 @@
 
 #include "encoding.h"
 
-void onWindowUpdate(encoderstate* state);
-struct timeval sentAtTime(packetsentinfo* table, int nPacketSent, uint32_t seqNo);
-uint16_t sentBlock(packetsentinfo* table, int nPacketSent, uint32_t seqNo);
-void addToPacketSentInfos(packetsentinfo** table, int* nPacketSent, uint32_t seqNo, uint16_t blockNo, struct timeval sentAtTime);
-void removeFromPacketSentInfos(packetsentinfo** table, int* nPacketSent, uint32_t seqNo);
+packetsentinfo* findSentInfo(encoderstate* state, uint32_t seqNo);
+void addToPacketSentInfos(encoderstate* state, uint32_t seqNo, uint16_t blockNo, uint32_t congestionSeqNo, struct timeval sentAt);
+void forgetPacketSentInfos(encoderstate* state, uint32_t seqNo);
+void updateInFlight(encoderstate* state, struct timeval currentTime);
+void leaveFlight(encoderstate* state, uint32_t seqNo);
 
-block blockCreate();
+block blockCreate(int maxPackets);
 void blockFree(block b);
+void openBlock(encoderstate* state);
+void closeIdleGeneration(encoderstate* state, struct timeval currentTime);
+void slideWindow(encoderstate* state, int nPackets);
+
+void updateInputRate(encoderstate* state, int size, struct timeval currentTime);
+int chooseGenerationSize(encoderstate state);
 
 void sendFromBlock(encoderstate* state, int blockNo);
+void queueDataPacket(encoderstate* state, uint8_t* buffer, int bufLen, struct timeval currentTime);
+double pacingRate(encoderstate state);
 
-void generateEncodedPayload(matrix data, int nPackets, uint32_t seed, uint8_t* buffer, int* bufLen);
+void generateEncodedPayloads(int field, matrix data, int first, int nPackets, uint8_t** coeffs, int nRepairs, uint8_t** payloads);
+int isRepairCached(encoderstate state, int blockNo, int first);
+int repairsDue(encoderstate state, block b);
+void fillRepairCache(encoderstate* state, int blockNo, int first, int nWanted, int isPooled);
+void runEncodingJob(void* job);
+void waitEncodingJobs(encoderstate* state);
 
 int isMoreDataOk(encoderstate state){
-    return (state.numBlock < MAX_BLOCKS);
+    if(state.codec == CODEC_SLIDING){
+        return (state.numBlock == 0) || (state.blocks[0].nPackets + READ_ROOM <= BLKSIZE);
+    }
+    return (state.numBlock < maxBufferedBlocks(state.codec, state.isHighBdp));
 }
 
 void onWindowUpdate(encoderstate* state){
@@ -41,37 +57,18 @@ void onWindowUpdate(encoderstate* state){
         printf("No outstanding data. Return\n");
         return;
     }
+    if(state->isRateLimited){ // The looper calls again once the client's bucket has refilled
+        return;
+    }
     
-    int sentInThisRound = true, totalInFlight = 0, i;
-    int* nPacketsInFlight = calloc(state->numBlock, sizeof(int));
-    struct timeval timeOfArrival, currentTime;
-    uint16_t sentBlockNumber;
+    int sentInThisRound = true, totalInFlight, window, i;
+    struct timeval currentTime;
     
-    // ~~ Count packets in flight (total, and for each block) ~~
+    // ~~ Count packets in flight (total, and for each block) : only the packets that left the flight since last time are visited ~~
     gettimeofday(&currentTime, NULL);
-    //do_debug("Current Time : (%d,%d)\n", (int)currentTime.tv_sec, (int)currentTime.tv_usec);
-    for(i = state->seqNo_Una; i < state->seqNo_Next; i++){
-        timeOfArrival = sentAtTime(*(state->packetSentInfos), *(state->nPacketSent), i);
-        if(timeOfArrival.tv_sec == 0){
-            continue;
-        }
-        
-        if(state->shortTermRttAverage != 0){
-            addUSec(&timeOfArrival, (state->shortTermRttAverage * INFLIGHT_FACTOR) + COMPUTING_DELAY);
-        } else {
-            addUSec(&timeOfArrival, 10000000); // Add 10 seconds, if RTT = 0
-        }
-        
-        if(isSooner(currentTime, timeOfArrival)){ // All packets
-            //printf("Packet #%d might still be in flight\n", i);
-            sentBlockNumber = sentBlock(*(state->packetSentInfos), *(state->nPacketSent), i);
-            
-            if(sentBlockNumber - state->currBlock >= 0){
-                nPacketsInFlight[sentBlockNumber - state->currBlock] ++;
-            }
-            totalInFlight++;
-        }
-    }
+    updateInFlight(state, currentTime);
+    totalInFlight = state->nInFlight;
+    window = congestionAllowance(*(state->congestion), state->nInFlight); // The whole window, unless it is shared with other muxes
     
     do_debug("%d packets in flight, state->nDataToSend = %d\n", totalInFlight, state->nDataToSend);
     totalInFlight = max(totalInFlight, state->nDataToSend); // Ensure that you don't send more than congestionWindow on a single round, even with really low RTT.
@@ -79,16 +76,15 @@ void onWindowUpdate(encoderstate* state){
     
     // ~~ If we're allowed to send, find a block that would be worth it ~~
     //printf("\nBefore while statement, totalInFlight = %d, congWin = %f\n", totalInFlight, state->congestionWindow);
-    while((totalInFlight < ((int)state->congestionWindow)) && (sentInThisRound)){
+    while((totalInFlight < window) && (sentInThisRound)){
         sentInThisRound = false;
         for(i = 0; i < state->numBlock; i++){
-            //printf("Block %d should receive ~%f packets while %d are known and %u dofs have been ack-ed\n", i, (1 - state->p) * nPacketsInFlight[i], state->blocks[i].nPackets, state->blocks[i].dofs);
+            //printf("Block %d should receive ~%f packets while %d are known and %u dofs have been ack-ed\n", i, (1 - state->p) * state->blocks[i].nInFlight, state->blocks[i].nPackets, state->blocks[i].dofs);
             
-            if((ceilf(((1 - state->p) * nPacketsInFlight[i])) < (state->blocks[i].nPackets - state->blocks[i].dofs))){
+            if((ceilf(((1 - state->p) * state->blocks[i].nInFlight)) < (state->blocks[i].nPackets - state->blocks[i].dofs))){
                 //printf("Sending from block #%d\n", i);
-                sendFromBlock(state, i);
+                sendFromBlock(state, i); // Counts the packet in the block's nInFlight
                 totalInFlight ++;
-                nPacketsInFlight[i]++;
                 sentInThisRound = true;
                 break;
             }
@@ -99,20 +95,28 @@ void onWindowUpdate(encoderstate* state){
         }
     }
     
+    // The payloads handed to the coding threads must be ready before the packets leave or the blocks change
+    waitEncodingJobs(state);
     //printf("After : totalInFlight = %d\n", totalInFlight);
-    
-    free(nPacketsInFlight);
 }
 
-void handleInClear(encoderstate* state, uint8_t* buffer, int size){
+/* Returns the number of bytes taken : less than size only when the sliding window is full, the caller keeps the rest
+ * (isMoreDataOk() tells when to offer it again) */
+int handleInClear(encoderstate* state, uint8_t* buffer, int size){
     do_debug("in handleInClear\n");
     // We just have to put data in the next available packet
     int sizeAllocated = 0, i;
     uint16_t currentWriteSize, tmp16;
+    struct timeval currentTime;
+    
+    gettimeofday(&currentTime, NULL);
+    closeIdleGeneration(state, currentTime);
+    state->time_lastInput = currentTime;
+    updateInputRate(state, size, currentTime);
     
     while(sizeAllocated < size){
         for(i = 0; (i < state->numBlock) && (sizeAllocated < size); i++){ // Look in already allocated blocks
-            if(state->blocks[i].nPackets < BLKSIZE){
+            if(state->blocks[i].nPackets < state->blocks[i].maxPackets){
                 currentWriteSize = min(PACKETSIZE - 2, size - sizeAllocated);
                 tmp16 = htons(currentWriteSize); // Write the size on a uint16.
                 memcpy(state->blocks[i].dataMatrix->data[state->blocks[i].nPackets], &tmp16, 2);
@@ -126,9 +130,86 @@ void handleInClear(encoderstate* state, uint8_t* buffer, int size){
         }
         
         if(sizeAllocated < size){ // Not all data fit in the already allocated blocks => create one
-            state->blocks = realloc(state->blocks, (state->numBlock + 1) * sizeof(block));
-            state->blocks[state->numBlock] = blockCreate();
-            state->numBlock++;
+            if((state->codec == CODEC_SLIDING) && (state->numBlock > 0)){
+                do_debug("handleInClear : the sliding window is full, %d bytes of %d taken\n", sizeAllocated, size);
+                break;
+            }
+            openBlock(state);
+        }
+    }
+    
+    if(sizeAllocated > 0){
+        state->isOutstandingData = true;
+        onWindowUpdate(state);
+    }
+    return sizeAllocated;
+}
+
+// ~~ Zero-copy input : the application's data is read straight into the free rows of the generations ~~
+
+/* Fill rows with the payloads of the next free rows (after their 2 bytes of length), in the order handleInClear() fills them,
+ * opening a generation if none has room. At most maxRows, and one congestion window : the rest waits in the socket.
+ * Returns the number of rows ; handleInRows() must follow, with the number of bytes read into them. */
+int getInputRows(encoderstate* state, struct iovec* rows, int maxRows){
+    int i, j, nRows = 0, room;
+    struct timeval currentTime;
+    
+    gettimeofday(&currentTime, NULL);
+    closeIdleGeneration(state, currentTime);
+    
+    // No more than the window lets leave now (capped in PROBE_RTT, shared with -S), but room for a read at least
+    room = congestionAllowance(*(state->congestion), state->nInFlight) - state->nInFlight;
+    if(room < READ_ROOM){
+        room = READ_ROOM;
+    }
+    if(room < maxRows){
+        maxRows = room;
+    }
+    for(i = 0; (i <= state->numBlock) && (nRows < maxRows); i++){
+        if(i == state->numBlock){ // No free row in the open generations : open one, unless the sliding window is full
+            if((nRows > 0) || ((state->codec == CODEC_SLIDING) && (state->numBlock > 0))){
+                break;
+            }
+            openBlock(state);
+        }
+        for(j = state->blocks[i].nPackets; (j < state->blocks[i].maxPackets) && (nRows < maxRows); j++){
+            rows[nRows].iov_base = state->blocks[i].dataMatrix->data[j] + 2;
+            rows[nRows].iov_len = PACKETSIZE - 2;
+            nRows++;
+        }
+    }
+    
+    return nRows;
+}
+
+// size bytes were read into the rows from getInputRows() : they become packets, as with handleInClear()
+void handleInRows(encoderstate* state, int size){
+    do_debug("in handleInRows\n");
+    int i, currentWriteSize;
+    uint16_t tmp16;
+    struct timeval currentTime;
+    
+    // Nothing was read : a generation opened for the read is not needed
+    if(size <= 0){
+        while((state->numBlock > 0) && (state->blocks[state->numBlock - 1].nPackets == 0)){
+            blockFree(state->blocks[state->numBlock - 1]);
+            state->blocks = realloc(state->blocks, (state->numBlock - 1) * sizeof(block));
+            state->numBlock--;
+        }
+        return;
+    }
+    
+    gettimeofday(&currentTime, NULL);
+    state->time_lastInput = currentTime;
+    updateInputRate(state, size, currentTime);
+    
+    for(i = 0; (i < state->numBlock) && (size > 0); i++){
+        while((state->blocks[i].nPackets < state->blocks[i].maxPackets) && (size > 0)){
+            currentWriteSize = min(PACKETSIZE - 2, size);
+            tmp16 = htons(currentWriteSize);
+            memcpy(state->blocks[i].dataMatrix->data[state->blocks[i].nPackets], &tmp16, 2);
+            size -= currentWriteSize;
+            state->blocks[i].nPackets++;
         }
     }
     
@@ -137,16 +218,51 @@ void handleInClear(encoderstate* state, uint8_t* buffer, int size){
     onWindowUpdate(state);
 }
 
+/* If the application went idle, close the current generation so that new data starts a fresh one.
+ * An empty generation stays open : its size of 0 would read as unknown to the decoder. */
+void closeIdleGeneration(encoderstate* state, struct timeval currentTime){
+    long idleThreshold;
+    block* lastBlock;
+    
+    if((state->codec != CODEC_SLIDING) && (state->numBlock > 0) && (state->time_lastInput.tv_sec != 0)){
+        idleThreshold = (state->shortTermRttAverage > IDLE_CLOSE_DELAY) ? (long)state->shortTermRttAverage : IDLE_CLOSE_DELAY;
+        lastBlock = &(state->blocks[state->numBlock - 1]);
+        if((diffUSec(currentTime, state->time_lastInput) > idleThreshold) && (lastBlock->nPackets > 0) && (lastBlock->nPackets < lastBlock->maxPackets)){
+            do_debug("Application was idle, closing the generation with %d packets instead of %d\n", lastBlock->nPackets, lastBlock->maxPackets);
+            lastBlock->maxPackets = lastBlock->nPackets;
+        }
+    }
+}
+
+void openBlock(encoderstate* state){
+    state->blocks = realloc(state->blocks, (state->numBlock + 1) * sizeof(block));
+    state->blocks[state->numBlock] = blockCreate((state->codec == CODEC_SLIDING) ? BLKSIZE : chooseGenerationSize(*state));
+    do_debug("Opened block #%d for %d packets\n", state->numBlock, state->blocks[state->numBlock].maxPackets);
+    state->numBlock++;
+}
+
 void onTimeOut(encoderstate* state){
+    int i;
+    long timeout;
     printf("in onTimeOut\n");
-    state->slowStartMode = true;
-    state->congestionWindow = BASE_WINDOW;
+    
+    // ~~ Remember the window, in case the timeout turns out to be spurious ~~
+    if(!state->isTimeoutRecovery){
+        state->congestionBeforeTimeout = *(state->congestion);
+        state->seqNo_Timeout = state->seqNo_Next;
+        state->isTimeoutRecovery = true;
+    }
+    congestionOnTimeout(state->congestion);
     state->timeOutCounter++;
     
-    // ~~ Set time for the next timeOut event ~~
+    // ~~ Set time for the next timeOut event : exponential backoff ~~
     if(state->isOutstandingData){
+        timeout = retransmissionTimeout(*state);
+        for(i = 0; (i < state->timeOutCounter) && (timeout < RTO_MAX); i++){
+            timeout *= 2;
+        }
         gettimeofday(&(state->nextTimeout), NULL);
-        addUSec(&(state->nextTimeout), (state->timeOutCounter * (COMPUTING_DELAY + (TIMEOUT_FACTOR * state->longTermRttAverage))));
+        addUSec(&(state->nextTimeout), (timeout < RTO_MAX) ? timeout : RTO_MAX);
     } else { // No data left to send... let the TO be ~long !
         state->nextTimeout.tv_sec = 0;
         state->nextTimeout.tv_usec = 0;
@@ -157,44 +273,59 @@ void onTimeOut(encoderstate* state){
     onWindowUpdate(state);
 }
 
+// Smoothed RTT plus RTO_VARIANCE_FACTOR deviations, before backoff (uSeconds)
+long retransmissionTimeout(encoderstate state){
+    long timeout;
+    
+    if(state.shortTermRttAverage == 0){
+        return RTO_INITIAL;
+    }
+    timeout = COMPUTING_DELAY + (long)(state.shortTermRttAverage + (RTO_VARIANCE_FACTOR * state.rttVariation));
+    return (timeout < RTO_MIN) ? RTO_MIN : timeout;
+}
+
 void onAck(encoderstate* state, uint8_t* buffer, int size){
     do_debug("in onAck :\n");
     ackpacket* ack = bufferToAck(buffer, size);
     int i, currentRTT;
-    float delta;
     
     //printf("ACK received :\n");
     //ackPacketPrint(*ack);
     
     // Arbitrary idea : if ACK < seqNo_una (= sequence already ACKed somehow) => Do not consider it
-    if(ack->ack_seqNo < state->seqNo_Una){
+    if(diffSerial32(ack->ack_seqNo, state->seqNo_Una) < 0){
         do_debug("Outdated ACK (n = %d while una = %d), Drop !\n", ack->ack_seqNo, state->seqNo_Una);
         free(ack->ack_dofs);
+        free(ack->ack_decodedPrefix);
         free(ack);
         return;
     }
     
     // ~~ Estimate network parameters ~~
     gettimeofday(&(state->time_lastAck), NULL);
-    struct timeval sentAt = sentAtTime(*(state->packetSentInfos), *(state->nPacketSent), ack->ack_seqNo);
-    if(sentAt.tv_sec == 0){
+    packetsentinfo* sentInfo = findSentInfo(state, ack->ack_seqNo);
+    if(sentInfo == 0){
         // The specified sequence number is unknown... better ignore this ACK !
         do_debug("Unknown/outdated sequence number, do not refresh parameters !\n");
-        state->seqNo_Una = max(state->seqNo_Una, ack->ack_seqNo + 1);
+        state->seqNo_Una = ack->ack_seqNo + 1;
+        forgetPacketSentInfos(state, state->seqNo_Una);
         free(ack->ack_dofs);
+        free(ack->ack_decodedPrefix);
         free(ack);
         return;
     }
-    currentRTT = 1000000 * (state->time_lastAck.tv_sec - sentAt.tv_sec) + (state->time_lastAck.tv_usec - sentAt.tv_usec);
+    currentRTT = diffUSec(state->time_lastAck, sentInfo->sentAt);
     //printf("RTT for current ACK = %d\n", currentRTT);
     
-    // Actualize the RTT average
+    // Actualize the RTT average ; the variation first, as it uses the previous average
     if(state->longTermRttAverage != 0){
+        state->rttVariation = ((1 - SMOOTHING_FACTOR_RTTVAR) * state->rttVariation) + (SMOOTHING_FACTOR_RTTVAR * fabs(state->shortTermRttAverage - currentRTT));
         state->longTermRttAverage = ((1 - SMOOTHING_FACTOR_LONG) * state->longTermRttAverage) + (SMOOTHING_FACTOR_LONG * currentRTT);
         state->shortTermRttAverage = ((1 - SMOOTHING_FACTOR_SHORT) * state->shortTermRttAverage) + (SMOOTHING_FACTOR_SHORT * currentRTT);
     } else { // We are initializing it
         state->longTermRttAverage = currentRTT;
         state->shortTermRttAverage = currentRTT;
+        state->rttVariation = currentRTT / 2.0;
     }
     
     //printf("Short-term RTT : %f, long-term :%f\n", state->shortTermRttAverage, state->longTermRttAverage);
@@ -203,72 +334,66 @@ void onAck(encoderstate* state, uint8_t* buffer, int size){
     state->p = 1.0 * ack->ack_loss / ack->ack_total;
     
     // ~~ Adjust current block ~~
-    while(ack->ack_currBlock > state->currBlock){
-        // Free acknowldeged blocks (and forget about packets sent for them !)
+    if(state->codec == CODEC_SLIDING){
+        // Forget about the packets the receiver has delivered, and about the packets sent before this one
+        slideWindow(state, (uint16_t)(ack->ack_currBlock - state->currBlock));
+        if((state->numBlock > 0) && (ack->ack_nBlocks > 0)){
+            state->blocks[0].dofs = ack->ack_dofs[0];
+        }
+    }
+    while((state->codec != CODEC_SLIDING) && (diffSerial16(ack->ack_currBlock, state->currBlock) > 0) && (state->numBlock > 0)){
+        // Free acknowldeged blocks (and forget about packets sent for them : findSentInfo ignores blocks before currBlock)
+        state->nInFlight -= state->blocks[0].nInFlight;
+        state->congestion->nInFlight -= state->blocks[0].nInFlight;
         blockFree(state->blocks[0]);
         for(i = 0; i < state->numBlock - 1; i++){
             (state->blocks)[i] = (state->blocks)[i+1];
         }
         state->blocks = realloc(state->blocks, (state->numBlock - 1) * sizeof(block));
         state->numBlock --;
-        for(i = 0; i < *(state->nPacketSent); i++){
-            uint32_t seqNo = (*(state->packetSentInfos))[i].seqNo;
-            if(sentBlock(*(state->packetSentInfos), *(state->nPacketSent), seqNo) == state->currBlock){
-                removeFromPacketSentInfos(state->packetSentInfos, state->nPacketSent, seqNo);
-                i--;
-            }
-        }
         state->currBlock++;
     }
-    for(i = 0; i < DOFS_LENGTH; i++){
+    for(i = 0; (i < ack->ack_nBlocks) && (state->codec != CODEC_SLIDING); i++){
         if(state->numBlock > i){
             state->blocks[i].dofs = max(state->blocks[i].dofs, ack->ack_dofs[i]);
         }
     }
+    // The prefixes are relative to the receiver's current block : only trust them if it is ours
+    for(i = 0; (i < ack->ack_nBlocks) && (state->codec == CODEC_BLOCK) && (ack->ack_currBlock == state->currBlock); i++){
+        if(state->numBlock > i){
+            state->blocks[i].decodedPrefix = max(state->blocks[i].decodedPrefix, ack->ack_decodedPrefix[i]);
+        }
+    }
     
     
-    // ~~ Update Congestion window ~~
-    do_debug("Congestion Window before actualizing = %f\n", state->congestionWindow);
-    if(state->slowStartMode){
-        state->congestionWindow += 1;
-        if(state->congestionWindow > SS_THRESHOLD){
-            state->slowStartMode = false;
-        } 
-    } else {// Congestion avoidance mode
-        delta = 1 - (state->longTermRttAverage / state->shortTermRttAverage);
-        if(delta < ALPHA){
-            // Increase the window :
-            state->congestionWindow += (INCREMENT / state->congestionWindow);
-        } else if(delta > BETA) {
-            // Decrease the window
-            state->congestionWindow -= (INCREMENT / state->congestionWindow);
-        }
-        // If delta is in between, do not update the window
-        
-        // Avoid floating-point errors ; the window should never get lower than the BASE !
-        if(state->congestionWindow < BASE_WINDOW){
-            state->congestionWindow = BASE_WINDOW;
+    // ~~ The first ACK after a timeout tells if it was spurious : the packet was sent before it and only delayed ~~
+    if(state->isTimeoutRecovery){
+        if(diffSerial32(ack->ack_seqNo, state->seqNo_Timeout) < 0){
+            do_debug("Spurious timeout, restore the congestion window of %f\n", state->congestionBeforeTimeout.congestionWindow);
+            congestionRestore(state->congestion, state->congestionBeforeTimeout);
+            state->stats_nSpuriousTimeouts++;
         }
+        state->isTimeoutRecovery = false;
     }
-    do_debug("Congestion Window after actualizing = %f\n", state->congestionWindow);
     
-    state->seqNo_Una = max(state->seqNo_Una, ack->ack_seqNo + 1);
+    // ~~ Update Congestion window ~~
+    congestionOnAck(state->congestion, sentInfo->congestionSeqNo, currentRTT, state->shortTermRttAverage, state->longTermRttAverage, state->time_lastAck);
+    
+    // Forget about the packets sent before this one
+    state->seqNo_Una = ack->ack_seqNo + 1;
+    forgetPacketSentInfos(state, state->seqNo_Una);
     
     free(ack->ack_dofs);
+    free(ack->ack_decodedPrefix);
     free(ack);
     
-    if(state->congestionWindow > MAX_WINDOW){
-        printf("Window reached maximum... DIE !\n");
-        exit(1);
-    }
-    
     onWindowUpdate(state);
     
     // ~~ Set time for the next timeOut event ~~
     if(state->isOutstandingData){
         state->nextTimeout.tv_sec = state->time_lastAck.tv_sec;
         state->nextTimeout.tv_usec = state->time_lastAck.tv_usec;
-        addUSec(&(state->nextTimeout), TIMEOUT_FACTOR * state->shortTermRttAverage);
+        addUSec(&(state->nextTimeout), retransmissionTimeout(*state));
     } else { // No data left to send... let the TO be infinite !
         state->nextTimeout.tv_sec = 0;
         state->nextTimeout.tv_usec = 0;
@@ -278,30 +403,60 @@ void onAck(encoderstate* state, uint8_t* buffer, int size){
 
 encoderstate* encoderStateInit(){
     encoderstate* ret = malloc(sizeof(encoderstate));
+    galoisInit();
     
+    ret->codec = CODEC_BLOCK;
+    ret->coeffs = COEFFS_DENSE;
+    ret->sparseNonZeros = 0;
+    ret->field = FIELD_GF256;
+    ret->degrees = degreeDistributionInit();
     ret->blocks = 0;
     ret->numBlock = 0;
-    ret->packetSentInfos = malloc(sizeof(packetsentinfo*));
-    *(ret->packetSentInfos) = 0;
-    ret->nPacketSent = malloc(sizeof(int));
-    *(ret->nPacketSent) = 0;
+    ret->packetSentInfos = calloc(SENT_INFOS_INITIAL_SIZE, sizeof(packetsentinfo));
+    ret->sentInfosSize = SENT_INFOS_INITIAL_SIZE;
+    ret->seqNo_FirstSent = 0;
+    ret->seqNo_FirstInFlight = 0;
+    ret->nInFlight = 0;
+    ret->isHighBdp = false;
     ret->p = 0.0;
     ret->longTermRttAverage = 0;
     ret->shortTermRttAverage = 0;
     ret->seqNo_Next = 0;
     ret->seqNo_Una = 0;
-    ret->congestionWindow = BASE_WINDOW;
+    ret->congestion = congestionInit(CC_VEGAS);
     ret->currBlock = 0;
-    ret->slowStartMode = true;
     ret->dataToSend = 0;
     ret->dataToSendSize = 0;
+    ret->dataToSendTime = 0;
+    ret->dataToSendSeqNo = 0;
     ret->nDataToSend = 0;
+    ret->pacingTokens = PACING_MAX_BURST;
+    ret->time_lastPacing.tv_sec = 0;
+    ret->time_lastPacing.tv_usec = 0;
+    ret->pacingDelayAverage = 0;
+    ret->pacingDelayMax = 0;
+    ret->isRateLimited = false;
+    ret->stats_nCachedRepairs = 0;
     ret->time_lastAck.tv_sec = 0;
     ret->time_lastAck.tv_usec = 0;
     ret->nextTimeout.tv_sec = 0;
     ret->nextTimeout.tv_usec = 0;
     ret->isOutstandingData = false;
     ret->timeOutCounter = 0;
+    ret->rttVariation = 0;
+    ret->seqNo_Timeout = 0;
+    ret->isTimeoutRecovery = false;
+    ret->stats_nSpuriousTimeouts = 0;
+    ret->inputRate = 0;
+    ret->inputBytes = 0;
+    ret->time_lastRateSample.tv_sec = 0;
+    ret->time_lastRateSample.tv_usec = 0;
+    ret->time_lastInput.tv_sec = 0;
+    ret->time_lastInput.tv_usec = 0;
+    ret->codingPool = 0;
+    ret->pendingJobs = 0;
+    ret->nPendingJobs = 0;
+    atomic_init(&(ret->nRunningJobs), 0);
     
     return ret;
 }
@@ -310,17 +465,16 @@ void encoderStateFree(encoderstate* state){
     int i;
     
     for(i = 0; i < state->numBlock; i++){
-        mFree(state->blocks[i].dataMatrix);
+        blockFree(state->blocks[i]);
     }
     if(state->numBlock > 0){
         free(state->blocks);
     }
+    degreeDistributionFree(state->degrees);
+    state->congestion->nInFlight -= state->nInFlight; // Its packets do not count for the muxes it shares the window with anymore
+    congestionFree(state->congestion);
     
-    if(*(state->nPacketSent) > 0){
-        free(*(state->packetSentInfos));
-    }
     free(state->packetSentInfos);
-    free(state->nPacketSent);
     
     for(i = 0; i < state->nDataToSend; i++){
         free(state->dataToSend[i]);
@@ -329,83 +483,205 @@ void encoderStateFree(encoderstate* state){
         free(state->dataToSend);
         free(state->dataToSendSize);
     }
+    free(state->dataToSendTime);
+    free(state->dataToSendSeqNo);
+    free(state->pendingJobs);
     
     free(state);
 }
 
-struct timeval sentAtTime(packetsentinfo* table, int nPacketSent, uint32_t seqNo){
-    int i;
-    for(i = 0; i<nPacketSent; i++){
-        if(table[i].seqNo == seqNo){
-            return table[i].sentAt;
-        }
+// Information on the packet seqNo, or 0 if it has been forgotten or if its block has been freed
+packetsentinfo* findSentInfo(encoderstate* state, uint32_t seqNo){
+    packetsentinfo* info;
+    
+    if((diffSerial32(seqNo, state->seqNo_FirstSent) < 0) || (diffSerial32(seqNo, state->seqNo_Next) >= 0)){
+        return 0;
     }
-    do_debug("sentAtTime queried for unknown seqNo : %u. *should not happen*\n", seqNo);
-    struct timeval ret; // Note : this line will never be reached... Just for gcc not to complain
-    ret.tv_sec = 0;
-    ret.tv_usec = 0;
-    return ret;
+    info = &(state->packetSentInfos[seqNo & (state->sentInfosSize - 1)]);
+    if((info->seqNo != seqNo) || ((state->codec != CODEC_SLIDING) && (diffSerial16(info->blockNo, state->currBlock) < 0))){
+        return 0;
+    }
+    return info;
 }
 
-uint16_t sentBlock(packetsentinfo* table, int nPacketSent, uint32_t seqNo){
-    int i;
-    for(i = 0; i<nPacketSent; i++){
-        if(table[i].seqNo == seqNo){
-            return table[i].blockNo;
+// Remember packet seqNo, the next one to be sent, and count it in flight
+void addToPacketSentInfos(encoderstate* state, uint32_t seqNo, uint16_t blockNo, uint32_t congestionSeqNo, struct timeval sentAt){
+    int newSize = state->sentInfosSize;
+    packetsentinfo* ring;
+    uint32_t i;
+    
+    // ~~ Grow the ring if it is full ~~
+    while(diffSerial32(seqNo, state->seqNo_FirstSent) >= newSize){
+        newSize *= 2;
+    }
+    if(newSize != state->sentInfosSize){
+        ring = calloc(newSize, sizeof(packetsentinfo));
+        for(i = state->seqNo_FirstSent; i != seqNo; i++){
+            ring[i & (newSize - 1)] = state->packetSentInfos[i & (state->sentInfosSize - 1)];
         }
+        free(state->packetSentInfos);
+        state->packetSentInfos = ring;
+        state->sentInfosSize = newSize;
+        do_debug("Ring of sent packets grown to %d entries\n", newSize);
     }
-    do_debug("sentBlock queried for unexisting seqNo : %u. *should not happen*\n", seqNo);
-    return 0;
+    
+    state->packetSentInfos[seqNo & (state->sentInfosSize - 1)].seqNo = seqNo;
+    state->packetSentInfos[seqNo & (state->sentInfosSize - 1)].blockNo = blockNo;
+    state->packetSentInfos[seqNo & (state->sentInfosSize - 1)].congestionSeqNo = congestionSeqNo;
+    state->packetSentInfos[seqNo & (state->sentInfosSize - 1)].sentAt = sentAt;
+    
+    state->blocks[(state->codec == CODEC_SLIDING) ? 0 : diffSerial16(blockNo, state->currBlock)].nInFlight++;
+    state->nInFlight++;
+    state->congestion->nInFlight++;
 }
 
-void addToPacketSentInfos(packetsentinfo** table, int* nPacketSent, uint32_t seqNo, uint16_t blockNo, struct timeval sentAtTime){
-    *table = realloc(*table, (*nPacketSent + 1) * sizeof(packetsentinfo));
-    (*table)[*nPacketSent].seqNo = seqNo;
-    (*table)[*nPacketSent].blockNo = blockNo;
-    (*table)[*nPacketSent].sentAt.tv_sec = sentAtTime.tv_sec;
-    (*table)[*nPacketSent].sentAt.tv_usec = sentAtTime.tv_usec;
-    
-    //printf("Added packet #%u fro block %d to the sent table\n", seqNo, blockNo);
+// Packet seqNo is not in flight anymore
+void leaveFlight(encoderstate* state, uint32_t seqNo){
+    packetsentinfo* info = findSentInfo(state, seqNo);
     
-    (*nPacketSent) ++;
+    if(info != 0){ // Else, it has already been discounted with its block
+        state->blocks[(state->codec == CODEC_SLIDING) ? 0 : diffSerial16(info->blockNo, state->currBlock)].nInFlight--;
+        state->nInFlight--;
+        state->congestion->nInFlight--;
+    }
 }
 
-void removeFromPacketSentInfos(packetsentinfo** table, int* nPacketSent, uint32_t seqNo){
-    int indexOccurence, i;
-    for(i = 0; i < *nPacketSent; i++){
-        if((*table)[i].seqNo == seqNo){
-            for(indexOccurence=i; indexOccurence < (*nPacketSent - 1); indexOccurence++){
-                (*table)[indexOccurence].seqNo = (*table)[indexOccurence + 1].seqNo;
-                (*table)[indexOccurence].blockNo = (*table)[indexOccurence + 1].blockNo;
-                (*table)[indexOccurence].sentAt = (*table)[indexOccurence + 1].sentAt;
-            }
-            
-            *table = realloc(*table, (*nPacketSent -1) * sizeof(packetsentinfo));
-            (*nPacketSent) --;
-            return;
+// Discount the oldest packets in flight that have been acknowledged, or that should have arrived by now
+void updateInFlight(encoderstate* state, struct timeval currentTime){
+    long flightTime = (state->shortTermRttAverage != 0) ? (state->shortTermRttAverage * INFLIGHT_FACTOR) + COMPUTING_DELAY : 10000000; // 10 seconds, if RTT = 0
+    packetsentinfo* info;
+    
+    while(diffSerial32(state->seqNo_FirstInFlight, state->seqNo_Next) < 0){
+        info = findSentInfo(state, state->seqNo_FirstInFlight);
+        if((info != 0) && (diffSerial32(state->seqNo_FirstInFlight, state->seqNo_Una) >= 0) && (diffUSec(currentTime, info->sentAt) < flightTime)){
+            break; // Might still be in flight, and so might the packets sent after it
         }
+        leaveFlight(state, state->seqNo_FirstInFlight);
+        state->seqNo_FirstInFlight++;
+    }
+}
+
+// Forget about the packets sent before seqNo
+void forgetPacketSentInfos(encoderstate* state, uint32_t seqNo){
+    while(diffSerial32(state->seqNo_FirstInFlight, seqNo) < 0){
+        leaveFlight(state, state->seqNo_FirstInFlight);
+        state->seqNo_FirstInFlight++;
+    }
+    if(diffSerial32(seqNo, state->seqNo_FirstSent) > 0){
+        state->seqNo_FirstSent = seqNo;
     }
-    
-    do_debug("removeFromPacketSent queried for unexisting seqNo. DIE.");
-    exit(1);
 }
 
-block blockCreate(){
+block blockCreate(int maxPackets){
     block b;
     int i;
-    b.dataMatrix = mCreate(BLKSIZE, PACKETSIZE);
+    b.dataMatrix = mCreate(maxPackets, PACKETSIZE);
     b.nPackets = 0;
-    for(i = 0; i<BLKSIZE; i++){
+    b.maxPackets = maxPackets;
+    b.isSentPacket = malloc(maxPackets * sizeof(int));
+    for(i = 0; i<maxPackets; i++){
         b.isSentPacket[i] = false;
     }
     
     b.dofs = 0;
+    b.decodedPrefix = 0;
+    b.nRepairs = 0;
+    b.nInFlight = 0;
+    b.repairCache = 0;
+    b.nCachedRepairs = 0;
+    b.cachedBlockNo = 0;
+    b.cachedFirst = 0;
+    b.cachedPackets = 0;
     
     return b;
 }
 
 void blockFree(block b){
+    int i;
+    
     mFree(b.dataMatrix);
+    free(b.isSentPacket);
+    if(b.repairCache != 0){
+        for(i = 0; i < REPAIR_CACHE_SIZE; i++){
+            free(b.repairCache[i]);
+        }
+        free(b.repairCache);
+    }
+}
+
+/* Remove the first nPackets of the sliding window. Their rows get recycled at the end of the window. */
+void slideWindow(encoderstate* state, int nPackets){
+    int i;
+    uint8_t** dropped;
+    block* window;
+    
+    if((state->numBlock == 0) || (nPackets <= 0) || (nPackets > state->blocks[0].nPackets)){
+        return;
+    }
+    window = &(state->blocks[0]);
+    
+    dropped = malloc(nPackets * sizeof(uint8_t*));
+    memcpy(dropped, window->dataMatrix->data, nPackets * sizeof(uint8_t*));
+    memmove(window->dataMatrix->data, window->dataMatrix->data + nPackets, (BLKSIZE - nPackets) * sizeof(uint8_t*));
+    for(i = 0; i < nPackets; i++){
+        memset(dropped[i], 0, PACKETSIZE); // Coded packets span the whole row : it has to be clean
+        window->dataMatrix->data[BLKSIZE - nPackets + i] = dropped[i];
+    }
+    free(dropped);
+    
+    memmove(window->isSentPacket, window->isSentPacket + nPackets, (BLKSIZE - nPackets) * sizeof(int));
+    for(i = BLKSIZE - nPackets; i < BLKSIZE; i++){
+        window->isSentPacket[i] = false;
+    }
+    
+    window->nPackets -= nPackets;
+    window->dofs = 0;
+    state->currBlock += nPackets;
+    do_debug("Window slid by %d packets, now starts at %u with %d packets\n", nPackets, state->currBlock, window->nPackets);
+}
+
+void updateInputRate(encoderstate* state, int size, struct timeval currentTime){
+    long elapsed, sampleInterval;
+    double sample;
+    
+    state->inputBytes += size;
+    if(state->time_lastRateSample.tv_sec == 0){
+        state->time_lastRateSample = currentTime;
+        return;
+    }
+    
+    // Sample over at least one RTT, so that a single read does not look like a burst
+    sampleInterval = (state->shortTermRttAverage > RATE_SAMPLE_MIN) ? (long)state->shortTermRttAverage : RATE_SAMPLE_MIN;
+    elapsed = diffUSec(currentTime, state->time_lastRateSample);
+    if(elapsed >= sampleInterval){
+        sample = 1.0 * state->inputBytes / elapsed;
+        if(state->inputRate != 0){
+            state->inputRate = ((1 - SMOOTHING_FACTOR_RATE) * state->inputRate) + (SMOOTHING_FACTOR_RATE * sample);
+        } else {
+            state->inputRate = sample;
+        }
+        state->inputBytes = 0;
+        state->time_lastRateSample = currentTime;
+    }
+}
+
+/* Size of the next generation : what the application produces in one RTT, plus the repairs expected for it.
+ * Bulk flows get large generations that amortize the coding overhead, sparse flows get small ones that decode quickly. */
+int chooseGenerationSize(encoderstate state){
+    int size, maxSize = (state.codec == CODEC_FOUNTAIN) ? FOUNTAIN_BLKSIZE : BLKSIZE;
+    
+    if((state.inputRate == 0) || (state.shortTermRttAverage == 0)){
+        return MIN_BLKSIZE;
+    }
+    
+    size = (int)ceil((state.inputRate * state.shortTermRttAverage / (PACKETSIZE - 2)) * (1 + state.p));
+    if(size < MIN_BLKSIZE){
+        size = MIN_BLKSIZE;
+    } else if(size > maxSize){
+        size = maxSize;
+    }
+    
+    return size;
 }
 
 void sendFromBlock(encoderstate* state, int blockNo){
@@ -414,11 +690,16 @@ void sendFromBlock(encoderstate* state, int blockNo){
     datapacket packet;
     uint16_t tmp16;
     uint8_t buffer[PACKETSIZE + 100];
+    int neighbours[FOUNTAIN_BLKSIZE], degree, isPooled = false;
+    uint8_t* cached;
+    encodingjob* job;
+    block* b = &(state->blocks[blockNo]);
     struct timeval currentTime;
     gettimeofday(&currentTime, NULL);
     
-    // Actualize sent at & sent from block tables
-    addToPacketSentInfos(state->packetSentInfos, state->nPacketSent, state->seqNo_Next, blockNo + state->currBlock, currentTime);
+    // Actualize sent at & sent from block tables ; the congestion control numbers packets on its own, as it may be shared
+    addToPacketSentInfos(state, state->seqNo_Next, blockNo + state->currBlock, state->congestion->lastSentSeqNo + 1, currentTime);
+    congestionOnSend(state->congestion, state->congestion->lastSentSeqNo + 1);
     
     // First, look for an unsent packet
     for(i = 0; i < state->blocks[blockNo].nPackets; i++){
@@ -426,7 +707,10 @@ void sendFromBlock(encoderstate* state, int blockNo){
             // Generate the packet
             packet.blockNo = blockNo + state->currBlock;
             packet.packetNumber = (BITMASK_NO & i) | FLAG_CLEAR;
+            packet.prevBlockSize = (blockNo > 0) ? state->blocks[blockNo - 1].maxPackets : 0;
             packet.seqNo = state->seqNo_Next;
+            packet.repairNo = 0;
+            packet.firstPacket = 0;
             memcpy(&tmp16, state->blocks[blockNo].dataMatrix->data[i], 2);
             packet.size = ntohs(tmp16) + 2;
             packet.payloadAndSize = malloc(packet.size * sizeof(uint8_t));
@@ -439,13 +723,7 @@ void sendFromBlock(encoderstate* state, int blockNo){
             dataPacketToBuffer(packet, buffer, &bufLen);
             
             // Append it to the data to send buffer
-            state->dataToSend = realloc(state->dataToSend, (state->nDataToSend + 1) * sizeof(uint8_t*));
-            state->dataToSendSize = realloc(state->dataToSendSize, (state->nDataToSend + 1) * sizeof(int));
-            
-            state->dataToSend[state->nDataToSend] = malloc(bufLen * sizeof(uint8_t));
-            memcpy(state->dataToSend[state->nDataToSend], buffer, bufLen);
-            state->dataToSendSize[state->nDataToSend] = bufLen;
-            state->nDataToSend ++;
+            queueDataPacket(state, buffer, bufLen, currentTime);
             
             state->blocks[blockNo].isSentPacket[i] = true;
             state->seqNo_Next ++;
@@ -459,8 +737,40 @@ void sendFromBlock(encoderstate* state, int blockNo){
     // If not found, send an encoded packet, comprising every packet know in the block
     packet.blockNo = blockNo + state->currBlock;
     packet.packetNumber = (BITMASK_NO & (state->blocks[blockNo].nPackets)) | FLAG_CODED;
+    packet.prevBlockSize = (blockNo > 0) ? state->blocks[blockNo - 1].maxPackets : 0;
     packet.seqNo = state->seqNo_Next;
-    generateEncodedPayload(*(state->blocks[blockNo].dataMatrix), state->blocks[blockNo].nPackets, state->seqNo_Next, buffer, &bufLen);
+    packet.repairNo = state->blocks[blockNo].nRepairs;
+    // Only the undecoded suffix of the block needs to be covered (CODEC_BLOCK)
+    packet.firstPacket = (state->blocks[blockNo].decodedPrefix < state->blocks[blockNo].nPackets) ? state->blocks[blockNo].decodedPrefix : 0;
+    if(state->codec == CODEC_FOUNTAIN){
+        // LT symbol : the XOR of a few packets, drawn from the sequence number
+        degree = getFountainNeighbours(neighbours, state->blocks[blockNo].nPackets, packet.seqNo, state->degrees);
+        memset(buffer, 0, PACKETSIZE);
+        for(i = 0; i < degree; i++){
+            rowXor(buffer, state->blocks[blockNo].dataMatrix->data[neighbours[i]], PACKETSIZE);
+        }
+        bufLen = PACKETSIZE;
+    } else if(!isRepairCached(*state, blockNo, packet.firstPacket) && (state->codingPool != 0) && (b->nPackets - packet.firstPacket >= CODING_POOL_MIN_PACKETS)){
+        // Queued with an empty payload, that a coding thread fills before onWindowUpdate() returns
+        b->nCachedRepairs = 0; // Stale : the next repairs are numbered after this one
+        isPooled = true;
+        bufLen = b->dataMatrix->nColumns;
+        memset(buffer, 0, bufLen);
+    } else {
+        if(isRepairCached(*state, blockNo, packet.firstPacket)){
+            state->stats_nCachedRepairs++;
+        } else {
+            // The repairs due from this generation are computed in a single pass over it ; the next ones wait in its cache
+            fillRepairCache(state, blockNo, packet.firstPacket, repairsDue(*state, *b), false);
+        }
+        bufLen = b->dataMatrix->nColumns;
+        memcpy(buffer, b->repairCache[0], bufLen);
+        cached = b->repairCache[0];
+        memmove(b->repairCache, b->repairCache + 1, (REPAIR_CACHE_SIZE - 1) * sizeof(uint8_t*));
+        b->repairCache[REPAIR_CACHE_SIZE - 1] = cached;
+        b->nCachedRepairs--;
+    }
+    state->blocks[blockNo].nRepairs++;
     packet.size = bufLen;
     packet.payloadAndSize = malloc(bufLen);
     memcpy(packet.payloadAndSize, buffer, bufLen);
@@ -473,45 +783,276 @@ void sendFromBlock(encoderstate* state, int blockNo){
     dataPacketToBuffer(packet, buffer, &bufLen);
 
     // Append it to the data to send buffer
+    queueDataPacket(state, buffer, bufLen, currentTime);
+    
+    if(isPooled){
+        job = malloc(sizeof(encodingjob));
+        job->field = state->field;
+        job->data = b->dataMatrix;
+        job->first = packet.firstPacket;
+        job->nPackets = b->nPackets;
+        job->nRepairs = 1;
+        getRangeCoefficients(state->field, state->coeffs == COEFFS_MDS, job->coeffs[0], packet.firstPacket, b->nPackets, repairSeed(packet.blockNo, packet.repairNo), (state->coeffs == COEFFS_SPARSE) ? state->sparseNonZeros : 0, packet.repairNo);
+        job->payloads[0] = state->dataToSend[state->nDataToSend - 1] + DATA_HEADER_LENGTH;
+        state->pendingJobs = realloc(state->pendingJobs, (state->nPendingJobs + 1) * sizeof(encodingjob*));
+        state->pendingJobs[state->nPendingJobs] = job;
+        state->nPendingJobs++;
+        codingPoolSubmit(state->codingPool, runEncodingJob, job, &(state->nRunningJobs));
+    }
+
+    state->seqNo_Next ++;
+    free(packet.payloadAndSize);
+}
+
+/* Fill the repair caches of the closed generations whose next packet is a repair, as many as the loss rate
+ * calls for. The loop calls it when it is idle, so that sendFromBlock() only copies a payload. */
+void encoderPrecompute(encoderstate* state){
+    int i, first;
+    block* b;
+    
+    if((state->codec != CODEC_BLOCK) || (state->p <= 0) || state->isRateLimited){
+        return;
+    }
+    
+    for(i = 0; i < state->numBlock; i++){
+        b = &(state->blocks[i]);
+        if((b->nPackets == 0) || (b->nPackets < b->maxPackets) || !b->isSentPacket[b->nPackets - 1] || (b->dofs >= b->nPackets)){
+            continue; // Still growing, clear packets left to send, or nothing left to repair
+        }
+        
+        first = (b->decodedPrefix < b->nPackets) ? b->decodedPrefix : 0;
+        fillRepairCache(state, i, first, (int)ceil(state->p * (b->nPackets - b->dofs)), state->codingPool != 0);
+    }
+    
+    waitEncodingJobs(state);
+}
+
+// True if the next repair of the block is cached, and combines packets first..nPackets-1 of the current generation
+int isRepairCached(encoderstate state, int blockNo, int first){
+    block b = state.blocks[blockNo];
+    return (b.nCachedRepairs > 0) && (b.cachedBlockNo == (uint16_t)(state.currBlock + blockNo)) && (b.cachedFirst == first) && (b.cachedPackets == b.nPackets);
+}
+
+// Repairs the generation still needs for the receiver to decode it, at the current loss rate : the one being sent at least
+int repairsDue(encoderstate state, block b){
+    int due = (state.p < 0.99) ? (int)ceil((b.nPackets - b.dofs) / (1 - state.p)) - b.nInFlight + 1 : REPAIR_CACHE_SIZE;
+    
+    if(due < 1){
+        return 1;
+    }
+    return (due > REPAIR_CACHE_SIZE) ? REPAIR_CACHE_SIZE : due;
+}
+
+/* Extend the repair cache of the block to nWanted repairs (at most REPAIR_CACHE_SIZE) of packets first..nPackets-1,
+ * in a single pass over the block. On the coding threads if isPooled : the caller waits for them. */
+void fillRepairCache(encoderstate* state, int blockNo, int first, int nWanted, int isPooled){
+    int i;
+    uint16_t repairNo;
+    encodingjob* job;
+    block* b = &(state->blocks[blockNo]);
+    
+    if((b->cachedBlockNo != (uint16_t)(state->currBlock + blockNo)) || (first != b->cachedFirst) || (b->nPackets != b->cachedPackets)){
+        b->nCachedRepairs = 0;
+        b->cachedBlockNo = state->currBlock + blockNo;
+        b->cachedFirst = first;
+        b->cachedPackets = b->nPackets;
+    }
+    nWanted = min(nWanted, REPAIR_CACHE_SIZE);
+    if(b->nCachedRepairs >= nWanted){
+        return;
+    }
+    if(b->repairCache == 0){
+        b->repairCache = malloc(REPAIR_CACHE_SIZE * sizeof(uint8_t*));
+        for(i = 0; i < REPAIR_CACHE_SIZE; i++){
+            b->repairCache[i] = malloc(b->dataMatrix->nColumns);
+        }
+    }
+    
+    job = malloc(sizeof(encodingjob));
+    job->field = state->field;
+    job->data = b->dataMatrix;
+    job->first = first;
+    job->nPackets = b->nPackets;
+    job->nRepairs = nWanted - b->nCachedRepairs;
+    for(i = 0; i < job->nRepairs; i++){
+        repairNo = b->nRepairs + b->nCachedRepairs + i;
+        getRangeCoefficients(state->field, state->coeffs == COEFFS_MDS, job->coeffs[i], first, b->nPackets, repairSeed(b->cachedBlockNo, repairNo), (state->coeffs == COEFFS_SPARSE) ? state->sparseNonZeros : 0, repairNo);
+        job->payloads[i] = b->repairCache[b->nCachedRepairs + i];
+    }
+    b->nCachedRepairs = nWanted;
+    
+    if(isPooled){
+        state->pendingJobs = realloc(state->pendingJobs, (state->nPendingJobs + 1) * sizeof(encodingjob*));
+        state->pendingJobs[state->nPendingJobs] = job;
+        state->nPendingJobs++;
+        codingPoolSubmit(state->codingPool, runEncodingJob, job, &(state->nRunningJobs));
+    } else {
+        runEncodingJob(job);
+        free(job);
+    }
+}
+
+// ~~ Coding threads : the coded payloads of a window update are generated in parallel ~~
+
+void runEncodingJob(void* job){
+    encodingjob* j = (encodingjob*)job;
+    uint8_t* coeffs[REPAIR_CACHE_SIZE];
+    int i;
+    
+    for(i = 0; i < j->nRepairs; i++){
+        coeffs[i] = j->coeffs[i];
+    }
+    generateEncodedPayloads(j->field, *(j->data), j->first, j->nPackets, coeffs, j->nRepairs, j->payloads);
+}
+
+void waitEncodingJobs(encoderstate* state){
+    int i;
+    
+    if(state->nPendingJobs == 0){
+        return;
+    }
+    codingPoolWait(&(state->nRunningJobs));
+    for(i = 0; i < state->nPendingJobs; i++){
+        free(state->pendingJobs[i]);
+    }
+    state->nPendingJobs = 0;
+}
+
+// Append a marshalled packet to the data to send buffer ; the pacer releases it
+void queueDataPacket(encoderstate* state, uint8_t* buffer, int bufLen, struct timeval currentTime){
     state->dataToSend = realloc(state->dataToSend, (state->nDataToSend + 1) * sizeof(uint8_t*));
     state->dataToSendSize = realloc(state->dataToSendSize, (state->nDataToSend + 1) * sizeof(int));
-
+    state->dataToSendTime = realloc(state->dataToSendTime, (state->nDataToSend + 1) * sizeof(struct timeval));
+    state->dataToSendSeqNo = realloc(state->dataToSendSeqNo, (state->nDataToSend + 1) * sizeof(uint32_t));
+    
     state->dataToSend[state->nDataToSend] = malloc(bufLen * sizeof(uint8_t));
     memcpy(state->dataToSend[state->nDataToSend], buffer, bufLen);
     state->dataToSendSize[state->nDataToSend] = bufLen;
+    state->dataToSendTime[state->nDataToSend] = currentTime;
+    state->dataToSendSeqNo[state->nDataToSend] = state->seqNo_Next;
     state->nDataToSend ++;
+}
 
-    state->seqNo_Next ++;
-    free(packet.payloadAndSize);
+// ~~ Pacer : spread the packets of a window over the RTT instead of sending them in a burst ~~
+
+// Packets per uSecond : the rate of the congestion control, or a window per smoothed RTT. 0 if the packets should not be paced
+double pacingRate(encoderstate state){
+    double rate = congestionPacingRate(*(state.congestion));
+    
+    if((rate == 0) && (state.shortTermRttAverage != 0)){
+        rate = PACING_GAIN * congestionWindow(*(state.congestion)) / state.shortTermRttAverage;
+    }
+    if((state.congestion->nUsers > 1) && (congestionWindow(*(state.congestion)) > 0)){ // Pace at this encoder's part of the shared budget
+        rate = rate * congestionAllowance(*(state.congestion), state.nInFlight) / congestionWindow(*(state.congestion));
+    }
+    return rate;
+}
+
+/* Number of packets at the head of dataToSend that may leave now. The caller sends some of them (the first ones), then
+ * calls pacerDequeue() : the packets it did not send stay releasable. Tokens accumulate at the pacing rate, at most PACING_MAX_BURST. */
+int pacerReleasable(encoderstate* state, struct timeval currentTime){
+    double rate = pacingRate(*state);
+    
+    if(rate != 0){
+        if(state->time_lastPacing.tv_sec != 0){
+            state->pacingTokens += rate * diffUSec(currentTime, state->time_lastPacing);
+        }
+        if(state->pacingTokens > PACING_MAX_BURST){
+            state->pacingTokens = PACING_MAX_BURST;
+        }
+    }
+    state->time_lastPacing = currentTime;
+    
+    if((rate == 0) || (state->pacingTokens >= state->nDataToSend)){
+        return state->nDataToSend;
+    }
+    return (int)state->pacingTokens;
 }
 
-/* Using nPackets from data, generate the coefficients and write the encoded information in buffer */
-void generateEncodedPayload(matrix data, int nPackets, uint32_t seed, uint8_t* buffer, int* bufLen){
-    srandom(seed); // Initialize the PRNG with seed value
-    matrix* coeffs = getRandomMatrix(1, nPackets); // Generate the coefficients
-    int origDataNRows = data.nRows; // Save the original state from data
-    data.nRows = nPackets; // Alter it artificially for the multiplication to be ok
+// Forget about the first n packets of dataToSend, sent since the last call to pacerReleasable()
+void pacerDequeue(encoderstate* state, int n){
+    int i;
+    long delay;
+    packetsentinfo* info;
     
-    matrix* result = mMul(*coeffs, data); // Perform the multiplication
+    if(n <= 0){
+        return;
+    }
+    if(pacingRate(*state) != 0){
+        state->pacingTokens -= n;
+    }
+    for(i = 0; i < n; i++){
+        // RTT samples start when the packet actually leaves
+        if((info = findSentInfo(state, state->dataToSendSeqNo[i])) != 0){
+            info->sentAt = state->time_lastPacing;
+        }
+        
+        delay = diffUSec(state->time_lastPacing, state->dataToSendTime[i]);
+        state->pacingDelayAverage = ((1 - SMOOTHING_FACTOR_PACING) * state->pacingDelayAverage) + (SMOOTHING_FACTOR_PACING * delay);
+        if(delay > state->pacingDelayMax){
+            state->pacingDelayMax = delay;
+        }
+        
+        free(state->dataToSend[i]);
+    }
+    state->nDataToSend -= n;
+    memmove(state->dataToSend, state->dataToSend + n, state->nDataToSend * sizeof(uint8_t*));
+    memmove(state->dataToSendSize, state->dataToSendSize + n, state->nDataToSend * sizeof(int));
+    memmove(state->dataToSendTime, state->dataToSendTime + n, state->nDataToSend * sizeof(struct timeval));
+    memmove(state->dataToSendSeqNo, state->dataToSendSeqNo + n, state->nDataToSend * sizeof(uint32_t));
     
-    // Copy the result to the buffer
-    memcpy(buffer, result->data[0], result->nColumns);
-    *bufLen = result->nColumns;
+    if(state->nDataToSend == 0){
+        free(state->dataToSend);
+        state->dataToSend = 0;
+        free(state->dataToSendSize);
+        state->dataToSendSize = 0;
+    }
+}
+
+// When the next queued packet may leave ; 0 (infinity) if nothing is waiting for the pacer
+struct timeval pacerNextRelease(encoderstate state){
+    struct timeval ret = {0, 0};
+    double rate = pacingRate(state);
     
-    data.nRows = origDataNRows; // Restore data state
+    if((state.nDataToSend > 0) && (rate != 0) && (state.time_lastPacing.tv_sec != 0)){
+        ret = state.time_lastPacing;
+        addUSec(&ret, (state.pacingTokens >= 1) ? 0 : (long)ceil((1 - state.pacingTokens) / rate));
+    }
+    return ret;
+}
+
+/* Combine packets first..nPackets-1 from data with each of the nRepairs coefficient rows, into payloads :
+ * a product of matrices, streaming the block once for all of them */
+void generateEncodedPayloads(int field, matrix data, int first, int nPackets, uint8_t** coeffs, int nRepairs, uint8_t** payloads){
+    int r;
     
-    // Free the newly allocated matrices
-    mFree(coeffs);
-    mFree(result);
+    for(r = 0; r < nRepairs; r++){
+        memset(payloads[r], 0, data.nColumns);
+    }
+    fieldMatMulSub(field, payloads, coeffs, data.data, nRepairs, first, nPackets, data.nColumns);
 }
 
 void encoderStatePrint(encoderstate state){
     printf("Encoder state : \n");
+    printf("\tCodec = %s\n", (state.codec == CODEC_SLIDING) ? "sliding window" : ((state.codec == CODEC_FOUNTAIN) ? "fountain" : "block"));
+    if(state.coeffs == COEFFS_SPARSE){
+        printf("\tSparse coefficients, %d non-zero\n", state.sparseNonZeros);
+    } else if(state.coeffs == COEFFS_MDS){
+        printf("\tCauchy (MDS) coefficients\n");
+    }
+    printf("\tField = GF(2^%d)\n", fieldSymbolBits(state.field));
     printf("\tCurrent block = %u\n", state.currBlock);
     printf("\tNumber of blocks = %d\n", state.numBlock);
+    if(state.numBlock > 0){
+        printf("\tCurrent generation size = %d (%d allocated)\n", state.blocks[state.numBlock - 1].maxPackets, state.blocks[state.numBlock - 1].nPackets);
+    }
+    printf("\tInput rate = %f bytes/us\n", state.inputRate);
     printf("\tEncoded data to send = %d\n", state.nDataToSend);
-    printf("\tCongestion window = %f\n", state.congestionWindow);
+    printf("\tPacing rate = %f packets/us ; delay in the pacing queue = %f us on average, %ld us at most\n", pacingRate(state), state.pacingDelayAverage, state.pacingDelayMax);
+    printf("\tRepairs sent from the caches = %lu\n", state.stats_nCachedRepairs);
+    congestionPrint(*(state.congestion));
     printf("\tlong-term RTT = %f\n", state.longTermRttAverage);
     printf("\tshort-term RTT = %f\n", state.shortTermRttAverage);
+    printf("\tRTT variation = %f, timeout = %ld us, spurious timeouts = %lu\n", state.rttVariation, retransmissionTimeout(state), state.stats_nSpuriousTimeouts);
     printf("\tLoss estimation = %f\n", state.p);
 }
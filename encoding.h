@@ -21,25 +21,38 @@
 #include "utils.h"
 #include "packet.h"
 #include "matrix.h"
+#include "fountain.h"
+#include "congestion.h"
+#include "codingpool.h"
 
-#define BASE_WINDOW 8.0 // Number of tokens to start with
-#define SS_THRESHOLD 16.0 // Slow start threshold
-#define MAX_WINDOW 5000 // Should not be needed...
 #define SMOOTHING_FACTOR_LONG 0.0001 // Smoothing factor for the long term average
 #define SMOOTHING_FACTOR_SHORT 0.1 // Smoothing factor for the short term average
-#define TIMEOUT_FACTOR 5 // Timeout = factor * rtt
+#define SMOOTHING_FACTOR_RTTVAR 0.25 // Smoothing factor for the RTT variation
+#define RTO_VARIANCE_FACTOR 4 // Timeout = short term RTT + factor * RTT variation (+ COMPUTING_DELAY)
+#define RTO_MIN 20000 // Bounds of the timeout, before backoff (uSeconds)
+#define RTO_MAX 60000000 // Bound of the timeout, with backoff (uSeconds)
+#define RTO_INITIAL 1000000 // Timeout while there is no RTT sample (uSeconds)
 #define INFLIGHT_FACTOR 1.5 // Gamma from the papers
 #define COMPUTING_DELAY  1000 // Time taken by the coding operations, estimation in uSeconds. Becomes important if the link RTT is very low (LAN or VMs for example)
-#define ALPHA 0.05
-#define BETA 0.2  // Alpha and Beta are Thresholds for the congestion-control algorithm
-#define INCREMENT 3.0 // The increment factor for modifying the CWN
 
 #define TIMEOUT_INCREMENT 500000
-#define MAX_BLOCKS 15 // Maximum number of blocks to store in memory
+#define SENT_INFOS_INITIAL_SIZE 64 // Initial size of the ring of sent packets : a power of two, doubled when the window outgrows it
+
+#define MIN_BLKSIZE 8 // Smallest generation the encoder opens ; BLKSIZE is the largest
+#define IDLE_CLOSE_DELAY 10000 // Close the current generation after max(RTT, IDLE_CLOSE_DELAY) of application idle time (uSeconds)
+#define RATE_SAMPLE_MIN 10000 // Minimum interval between two input rate samples (uSeconds)
+#define SMOOTHING_FACTOR_RATE 0.25 // Smoothing factor for the input rate average
+#define PACING_GAIN 1.25 // Without a pacing rate from the congestion control, pace at that many windows per RTT
+#define PACING_MAX_BURST 4.0 // Packets the pacer may release back-to-back, to make up for the timer granularity
+#define SMOOTHING_FACTOR_PACING 0.01 // Smoothing factor for the average pacing delay
+#define READ_ROOM 4 // Packets that a single read from the application may fill, at least ; the sliding window keeps that much room
+#define READ_MAX_ROWS 64 // Packets that a single read from the application may fill, at most
+#define REPAIR_CACHE_SIZE 4 // Coded payloads computed ahead for the next repairs of a generation, and repairs computed in one pass
 
 typedef struct packetsentinfo_t{
     uint32_t seqNo;
     uint16_t blockNo;
+    uint32_t congestionSeqNo; // Number of the packet for the congestion control, which may be shared with other encoders
     struct timeval sentAt;
 } packetsentinfo;
 
@@ -47,48 +60,117 @@ typedef struct block_t{
     matrix* dataMatrix;
     
     int nPackets; // Number of packets allocated
-    int isSentPacket[BLKSIZE]; // True if a packet has already been sent uncoded
+    int maxPackets; // Generation size chosen at creation ; lowered to nPackets when the block is closed early
+    int* isSentPacket; // True if a packet has already been sent uncoded
+    int nRepairs; // Number of coded packets sent from this block
     
-    uint8_t dofs; // Already received degrees of freedom for the block
+    uint16_t dofs; // Already received degrees of freedom for the block
+    uint16_t decodedPrefix; // Packets at the start of the block that the receiver has decoded : coded packets skip them
+    int nInFlight; // Packets sent from this block that might still be in flight
+    
+    uint8_t** repairCache; // Payloads of the next repairs, computed ahead (CODEC_BLOCK) ; REPAIR_CACHE_SIZE rows, 0 until needed
+    int nCachedRepairs; // Valid rows, for repairs nRepairs, nRepairs + 1... They combine packets cachedFirst..cachedPackets-1 of generation cachedBlockNo
+    uint16_t cachedBlockNo;
+    int cachedFirst;
+    int cachedPackets;
 } block;
 
+typedef struct encodingjob_t { // Coded payloads of a block, generated in one pass, possibly by a coding thread
+    int field;
+    matrix* data;
+    int first;
+    int nPackets;
+    int nRepairs;
+    uint8_t coeffs[REPAIR_CACHE_SIZE][MAX_COEFFS_BYTES];
+    uint8_t* payloads[REPAIR_CACHE_SIZE]; // Inside the queued packets, or the repair cache
+} encodingjob;
+
 typedef struct encoderstate_t {
+    int codec; // CODEC_BLOCK, CODEC_SLIDING or CODEC_FOUNTAIN. With CODEC_SLIDING, block 0 is the only block and slides as the receiver decodes
+    int coeffs; // COEFFS_DENSE, COEFFS_SPARSE or COEFFS_MDS
+    int sparseNonZeros; // With COEFFS_SPARSE, number of non-zero coefficients in a coded packet
+    int field; // FIELD_GF256, FIELD_GF2, FIELD_GF16 or FIELD_GF65536 : the field of the coefficients and of the payload symbols
+    degreedistribution* degrees; // With CODEC_FOUNTAIN, degrees of the coded packets
     block* blocks;
     int numBlock; // Number of blocks allocated
     struct timeval nextTimeout;
-    packetsentinfo** packetSentInfos;
-    int* nPacketSent;
+    packetsentinfo* packetSentInfos; // Ring of the packets sent : packet seqNo is at index seqNo % sentInfosSize
+    int sentInfosSize; // Power of two
+    uint32_t seqNo_FirstSent; // Oldest packet kept in packetSentInfos
+    uint32_t seqNo_FirstInFlight; // Packets before it have been acknowledged or are considered lost : they do not count in nInFlight
+    int nInFlight; // Packets that might still be in flight, for all blocks
+    int isHighBdp; // True to allow large windows : the number of blocks is bounded by HIGH_BDP_MEMORY instead of MAX_BLOCKS
     float p; // Average packet loss from last ack
     double shortTermRttAverage ; // Floating Average RTT (microseconds), short term
     double longTermRttAverage ; // Floating Average RTT (microseconds), long term
+    double rttVariation; // Floating average of the deviation of the RTT samples from shortTermRttAverage (microseconds)
     uint32_t seqNo_Next; // Sequence number of the next packet to be transmitted
     uint32_t seqNo_Una;  // Sequence number of the last unacknowledged packet
     struct timeval time_lastAck;
-    float congestionWindow; // Maximum number of packets in flight
-    uint16_t currBlock; // Current block (not yet acked) => Block 0 in the matrix table
-    int slowStartMode;
-    int timeOutCounter;
+    congestionstate* congestion; // Congestion control : gives the maximum number of packets in flight
+    uint16_t currBlock; // Current block (not yet acked) => Block 0 in the matrix table. With CODEC_SLIDING, index of the first packet of the window
+    int timeOutCounter; // Consecutive timeouts : the timeout doubles with each
+    
+    congestionstate congestionBeforeTimeout; // Congestion control state before the first of the consecutive timeouts
+    uint32_t seqNo_Timeout; // seqNo_Next at that timeout : an ACK for an earlier packet proves the timeout spurious
+    int isTimeoutRecovery; // True until the first ACK after a timeout
+    long unsigned int stats_nSpuriousTimeouts;
     
     int isOutstandingData; // True if there is still data from the TCP socket that has not been transfered yet
     
+    double inputRate; // Floating average of the rate at which the application gives us data (bytes per uSecond)
+    int inputBytes; // Bytes received from the application since time_lastRateSample
+    struct timeval time_lastRateSample;
+    struct timeval time_lastInput; // Last time the application gave us data
+    
     uint8_t** dataToSend;  // Encoded data packets to send via UDP
     int* dataToSendSize;   // Size of the n-th packet
+    struct timeval* dataToSendTime; // When the n-th packet has been queued
+    uint32_t* dataToSendSeqNo; // Sequence number of the n-th packet
     int nDataToSend;       // Number of packets
+    
+    double pacingTokens; // Packets the pacer may release now, at most PACING_MAX_BURST
+    struct timeval time_lastPacing;
+    double pacingDelayAverage; // Time packets wait in the pacing queue (uSeconds), floating average
+    long pacingDelayMax;
+    int isRateLimited; // True while the proxy's rate limiter holds the client back : no packet is coded for it, not even ahead
+    long unsigned int stats_nCachedRepairs; // Repairs sent from a cache
+    
+    codingpool* codingPool; // Threads generating the coded payloads during a window update ; 0 to generate them inline
+    encodingjob** pendingJobs; // Handed to codingPool during the current window update
+    int nPendingJobs;
+    atomic_int nRunningJobs; // Those not done yet
 } encoderstate;
 
 
-void handleInClear(encoderstate* state, uint8_t* buffer, int size);
+int handleInClear(encoderstate* state, uint8_t* buffer, int size);
+
+int getInputRows(encoderstate* state, struct iovec* rows, int maxRows);
+
+void handleInRows(encoderstate* state, int size);
 
 void onTimeOut(encoderstate* state);
 
 void onAck(encoderstate* state, uint8_t* buffer, int size);
 
+void onWindowUpdate(encoderstate* state);
+
 encoderstate* encoderStateInit();
 
 void encoderStateFree(encoderstate* state);
 
 void encoderStatePrint(encoderstate state);
 
+void encoderPrecompute(encoderstate* state);
+
 int isMoreDataOk(encoderstate state);
 
+long retransmissionTimeout(encoderstate state);
+
+int pacerReleasable(encoderstate* state, struct timeval currentTime);
+
+void pacerDequeue(encoderstate* state, int n);
+
+struct timeval pacerNextRelease(encoderstate state);
+
 #endif
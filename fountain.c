@@ -0,0 +1,374 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "fountain.h"
+
+void computeDistribution(degreedistribution* dist, int k);
+void decodeSources(fountaindecoder* decoder, int source, uint8_t* payload);
+void solveInactive(fountaindecoder* decoder);
+int eliminateGF2(uint8_t** bits, uint8_t** payloads, int nRows, int nColumns);
+
+degreedistribution* degreeDistributionInit(){
+    degreedistribution* ret = malloc(sizeof(degreedistribution));
+    ret->k = 0;
+    ret->cdf = 0;
+    return ret;
+}
+
+void degreeDistributionFree(degreedistribution* dist){
+    if(dist->k > 0){
+        free(dist->cdf);
+    }
+    free(dist);
+}
+
+/* Robust soliton distribution over [1, k] : the ideal soliton, plus a few low degrees and a spike at k/R
+ * so that peeling seldom runs out of degree-one symbols */
+void computeDistribution(degreedistribution* dist, int k){
+    int d, spike;
+    double R, p, sum = 0;
+    
+    dist->cdf = realloc(dist->cdf, k * sizeof(double));
+    R = FOUNTAIN_C * log(k / FOUNTAIN_DELTA) * sqrt(k);
+    spike = (int)floor(k / R);
+    if(spike < 1){
+        spike = 1;
+    } else if(spike > k){
+        spike = k;
+    }
+    
+    for(d = 1; d <= k; d++){
+        p = (d == 1) ? (1.0 / k) : (1.0 / (d * (d - 1.0)));
+        if(d < spike){
+            p += R / (d * k);
+        } else if((d == spike) && (R > FOUNTAIN_DELTA)){
+            p += R * log(R / FOUNTAIN_DELTA) / k;
+        }
+        sum += p;
+        dist->cdf[d - 1] = sum;
+    }
+    for(d = 0; d < k; d++){
+        dist->cdf[d] /= sum;
+    }
+    dist->cdf[k - 1] = 1.0;
+    dist->k = k;
+}
+
+/* Draw the degree and the source packets of the coded symbol seed, among k packets. Returns the degree. */
+int getFountainNeighbours(int* neighbours, int k, uint32_t seed, degreedistribution* dist){
+    int indexes[FOUNTAIN_BLKSIZE];
+    int degree, minDegree, low = 0, high = k - 1, middle, i, j, tmp;
+    double u;
+    
+    if(dist->k != k){
+        computeDistribution(dist, k);
+    }
+    
+    u = (counterRandom(seed, 0) >> 11) * (1.0 / (1ULL << 53));
+    while(low < high){
+        middle = (low + high) / 2;
+        if(dist->cdf[middle] > u){
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    degree = low + 1;
+    
+    // Coded packets are repairs sent after the clear packets : low degrees would mostly hit packets the receiver has
+    minDegree = (FOUNTAIN_MIN_DEGREE < (k + 1) / 2) ? FOUNTAIN_MIN_DEGREE : (k + 1) / 2;
+    if(degree < minDegree){
+        degree = minDegree;
+    }
+    
+    // Distinct source packets : partial Fisher-Yates shuffle
+    for(i = 0; i < k; i++){
+        indexes[i] = i;
+    }
+    for(i = 0; i < degree; i++){
+        j = i + (((counterRandom(seed, i + 1) & 0xFFFFFFFF) * (k - i)) >> 32);
+        tmp = indexes[i];
+        indexes[i] = indexes[j];
+        indexes[j] = tmp;
+        neighbours[i] = indexes[i];
+    }
+    
+    return degree;
+}
+
+fountaindecoder* fountainDecoderInit(){
+    int i;
+    fountaindecoder* ret = malloc(sizeof(fountaindecoder));
+    
+    for(i = 0; i < FOUNTAIN_BLKSIZE; i++){
+        ret->data[i] = 0;
+        ret->sourceToPending[i] = 0;
+        ret->nSourceToPending[i] = 0;
+    }
+    ret->nDecoded = 0;
+    ret->coverage = 0;
+    ret->pendingData = 0;
+    ret->pendingNeighbours = 0;
+    ret->pendingDegree = 0;
+    ret->nPending = 0;
+    ret->nAlive = 0;
+    
+    return ret;
+}
+
+void fountainDecoderFree(fountaindecoder* decoder){
+    int i;
+    
+    for(i = 0; i < FOUNTAIN_BLKSIZE; i++){
+        if(decoder->data[i] != 0){
+            free(decoder->data[i]);
+        }
+        if(decoder->nSourceToPending[i] > 0){
+            free(decoder->sourceToPending[i]);
+        }
+    }
+    for(i = 0; i < decoder->nPending; i++){
+        if(decoder->pendingDegree[i] > 0){
+            free(decoder->pendingData[i]);
+        }
+        free(decoder->pendingNeighbours[i]);
+    }
+    if(decoder->nPending > 0){
+        free(decoder->pendingData);
+        free(decoder->pendingNeighbours);
+        free(decoder->pendingDegree);
+    }
+    
+    free(decoder);
+}
+
+/* Receive the XOR of the given source packets. Returns true if the symbol is innovative. */
+int fountainAddSymbol(fountaindecoder* decoder, int* neighbours, int degree, uint8_t* payload){
+    int i, remaining = 0, index;
+    int* undecoded = malloc(degree * sizeof(int));
+    uint8_t* symbol = malloc(PACKETSIZE);
+    
+    memcpy(symbol, payload, PACKETSIZE);
+    
+    // ~~ Substract the source packets we already know ~~
+    for(i = 0; i < degree; i++){
+        if(neighbours[i] >= decoder->coverage){
+            decoder->coverage = neighbours[i] + 1;
+        }
+        if(decoder->data[neighbours[i]] != 0){
+            rowXor(symbol, decoder->data[neighbours[i]], PACKETSIZE);
+        } else {
+            undecoded[remaining++] = neighbours[i];
+        }
+    }
+    
+    if(remaining == 0){
+        free(undecoded);
+        free(symbol);
+        return false;
+    }
+    
+    if(remaining == 1){
+        decodeSources(decoder, undecoded[0], symbol);
+        free(undecoded);
+    } else {
+        // ~~ Keep it until peeling reaches it ~~
+        index = decoder->nPending;
+        decoder->pendingData = realloc(decoder->pendingData, (index + 1) * sizeof(uint8_t*));
+        decoder->pendingNeighbours = realloc(decoder->pendingNeighbours, (index + 1) * sizeof(int*));
+        decoder->pendingDegree = realloc(decoder->pendingDegree, (index + 1) * sizeof(int));
+        decoder->pendingData[index] = symbol;
+        decoder->pendingNeighbours[index] = undecoded;
+        decoder->pendingDegree[index] = remaining;
+        decoder->nPending++;
+        decoder->nAlive++;
+        
+        for(i = 0; i < remaining; i++){
+            decoder->sourceToPending[undecoded[i]] = realloc(decoder->sourceToPending[undecoded[i]], (decoder->nSourceToPending[undecoded[i]] + 1) * sizeof(int));
+            decoder->sourceToPending[undecoded[i]][decoder->nSourceToPending[undecoded[i]]] = index;
+            decoder->nSourceToPending[undecoded[i]]++;
+        }
+    }
+    
+    // ~~ Peeling is stuck but we have enough symbols : solve what remains ~~
+    if((decoder->nDecoded < decoder->coverage) && (decoder->nAlive >= decoder->coverage - decoder->nDecoded)){
+        solveInactive(decoder);
+    }
+    
+    return true;
+}
+
+/* Degrees of freedom to acknowledge. Symbols that peeling could not use yet do not count for the last one,
+ * so that the encoder keeps sending until the generation is actually decoded. */
+int fountainDofs(fountaindecoder decoder){
+    int received = decoder.nDecoded + decoder.nAlive;
+    
+    if((received >= decoder.coverage) && (decoder.nDecoded < decoder.coverage)){
+        return decoder.coverage - 1;
+    }
+    return received;
+}
+
+/* Store source as decoded, and peel every pending symbol that contains it */
+void decodeSources(fountaindecoder* decoder, int source, uint8_t* payload){
+    int* stackSources = malloc(sizeof(int));
+    uint8_t** stackPayloads = malloc(sizeof(uint8_t*));
+    int nStack = 1, i, j, pending;
+    
+    stackSources[0] = source;
+    stackPayloads[0] = payload;
+    
+    while(nStack > 0){
+        nStack--;
+        source = stackSources[nStack];
+        payload = stackPayloads[nStack];
+        
+        if(decoder->data[source] != 0){ // Reached by two symbols
+            free(payload);
+            continue;
+        }
+        decoder->data[source] = payload;
+        decoder->nDecoded++;
+        
+        for(i = 0; i < decoder->nSourceToPending[source]; i++){
+            pending = decoder->sourceToPending[source][i];
+            if(decoder->pendingDegree[pending] == 0){
+                continue;
+            }
+            
+            rowXor(decoder->pendingData[pending], payload, PACKETSIZE);
+            for(j = 0; decoder->pendingNeighbours[pending][j] != source; j++);
+            decoder->pendingNeighbours[pending][j] = decoder->pendingNeighbours[pending][decoder->pendingDegree[pending] - 1];
+            decoder->pendingDegree[pending]--;
+            
+            if(decoder->pendingDegree[pending] == 1){ // Released : it decodes its last source packet
+                stackSources = realloc(stackSources, (nStack + 1) * sizeof(int));
+                stackPayloads = realloc(stackPayloads, (nStack + 1) * sizeof(uint8_t*));
+                stackSources[nStack] = decoder->pendingNeighbours[pending][0];
+                stackPayloads[nStack] = decoder->pendingData[pending];
+                nStack++;
+                
+                decoder->pendingData[pending] = 0;
+                decoder->pendingDegree[pending] = 0;
+                decoder->nAlive--;
+            }
+        }
+        if(decoder->nSourceToPending[source] > 0){
+            free(decoder->sourceToPending[source]);
+            decoder->sourceToPending[source] = 0;
+            decoder->nSourceToPending[source] = 0;
+        }
+    }
+    
+    free(stackSources);
+    free(stackPayloads);
+}
+
+/* Inactivation : Gaussian elimination over GF(2) on the few source packets that peeling could not reach.
+ * Only done when the pending symbols have full rank, checked on the coefficients alone first. */
+void solveInactive(fountaindecoder* decoder){
+    int nColumns = decoder->coverage - decoder->nDecoded, nRows = decoder->nAlive;
+    int i, j, row = 0, column = 0, isSolvable;
+    int* columnOf = malloc(decoder->coverage * sizeof(int));
+    int* sourceOf = malloc(nColumns * sizeof(int));
+    uint8_t** bits = malloc(nRows * sizeof(uint8_t*));
+    uint8_t** bitsCopy = malloc(nRows * sizeof(uint8_t*));
+    uint8_t** payloads;
+    
+    for(i = 0; i < decoder->coverage; i++){
+        if(decoder->data[i] == 0){
+            columnOf[i] = column;
+            sourceOf[column] = i;
+            column++;
+        }
+    }
+    for(i = 0; i < decoder->nPending; i++){
+        if(decoder->pendingDegree[i] > 0){
+            bits[row] = calloc(nColumns, sizeof(uint8_t));
+            for(j = 0; j < decoder->pendingDegree[i]; j++){
+                bits[row][columnOf[decoder->pendingNeighbours[i][j]]] = 1;
+            }
+            bitsCopy[row] = malloc(nColumns);
+            memcpy(bitsCopy[row], bits[row], nColumns);
+            row++;
+        }
+    }
+    
+    isSolvable = eliminateGF2(bitsCopy, 0, nRows, nColumns);
+    
+    if(isSolvable){
+        do_debug("Inactivation decoding of %d source packets\n", nColumns);
+        payloads = malloc(nRows * sizeof(uint8_t*));
+        row = 0;
+        for(i = 0; i < decoder->nPending; i++){
+            if(decoder->pendingDegree[i] > 0){
+                payloads[row] = malloc(PACKETSIZE);
+                memcpy(payloads[row], decoder->pendingData[i], PACKETSIZE);
+                row++;
+            }
+        }
+        eliminateGF2(bits, payloads, nRows, nColumns);
+        
+        // Row i now holds source sourceOf[i] alone
+        for(i = 0; i < nColumns; i++){
+            decodeSources(decoder, sourceOf[i], payloads[i]);
+        }
+        for(i = nColumns; i < nRows; i++){
+            free(payloads[i]);
+        }
+        free(payloads);
+    }
+    
+    for(i = 0; i < nRows; i++){
+        free(bits[i]);
+        free(bitsCopy[i]);
+    }
+    free(bits);
+    free(bitsCopy);
+    free(columnOf);
+    free(sourceOf);
+}
+
+/* Gauss-Jordan elimination, applying the same operations to payloads if given. Returns true if the rank is nColumns. */
+int eliminateGF2(uint8_t** bits, uint8_t** payloads, int nRows, int nColumns){
+    int column, pivot, i;
+    uint8_t* tmp;
+    
+    for(column = 0; column < nColumns; column++){
+        for(pivot = column; (pivot < nRows) && (bits[pivot][column] == 0); pivot++);
+        if(pivot == nRows){
+            return false;
+        }
+        
+        tmp = bits[column]; bits[column] = bits[pivot]; bits[pivot] = tmp;
+        if(payloads != 0){
+            tmp = payloads[column]; payloads[column] = payloads[pivot]; payloads[pivot] = tmp;
+        }
+        
+        for(i = 0; i < nRows; i++){
+            if((i != column) && (bits[i][column] != 0)){
+                rowXor(bits[i], bits[column], nColumns);
+                if(payloads != 0){
+                    rowXor(payloads[i], payloads[column], PACKETSIZE);
+                }
+            }
+        }
+    }
+    
+    return true;
+}
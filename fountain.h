@@ -0,0 +1,65 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _FOUNTAIN_
+#define _FOUNTAIN_
+
+#include "utils.h"
+#include "matrix.h"
+
+#define FOUNTAIN_BLKSIZE 2048 // Largest generation of the fountain codec (in number of packets)
+#define FOUNTAIN_MAX_BLOCKS 4 // Maximum number of fountain generations to store in memory
+#define FOUNTAIN_C 0.1 // Robust soliton parameters : the decoder expects a ripple of FOUNTAIN_C * ln(k / FOUNTAIN_DELTA) * sqrt(k) packets
+#define FOUNTAIN_DELTA 0.5
+#define FOUNTAIN_MIN_DEGREE 64 // Repairs combine at least that many packets (at most half the generation), so that few of them miss every lost packet
+
+typedef struct degreedistribution_t {
+    int k; // Number of source packets the distribution has been computed for, 0 if none
+    double* cdf; // Robust soliton distribution : cdf[d - 1] = P(degree <= d)
+} degreedistribution;
+
+typedef struct fountaindecoder_t {
+    uint8_t* data[FOUNTAIN_BLKSIZE]; // Decoded source packets, 0 while unknown
+    int nDecoded;
+    int coverage; // Number of source packets covered by the symbols received so far
+    
+    uint8_t** pendingData; // Coded symbols that still contain several undecoded source packets
+    int** pendingNeighbours; // Undecoded source packets of each pending symbol
+    int* pendingDegree; // 0 once the symbol has been peeled
+    int nPending;
+    int nAlive; // Pending symbols not peeled yet
+    
+    int* sourceToPending[FOUNTAIN_BLKSIZE]; // For each source packet, the pending symbols that contain it
+    int nSourceToPending[FOUNTAIN_BLKSIZE];
+} fountaindecoder;
+
+degreedistribution* degreeDistributionInit();
+
+void degreeDistributionFree(degreedistribution* dist);
+
+int getFountainNeighbours(int* neighbours, int k, uint32_t seed, degreedistribution* dist);
+
+fountaindecoder* fountainDecoderInit();
+
+void fountainDecoderFree(fountaindecoder* decoder);
+
+int fountainAddSymbol(fountaindecoder* decoder, int* neighbours, int degree, uint8_t* payload);
+
+int fountainDofs(fountaindecoder decoder);
+
+#endif
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "galois_field.h"
 
@@ -200,3 +201,220 @@ uint8_t getRandom(){
     }
     return (uint8_t)n; 
 }
+
+// ~~ Other fields : tables are computed by galoisInit() ~~
+uint8_t gf16Mul[16][16];
+uint8_t gf16ByteTable[16][256]; // gf16ByteTable[c][b] multiplies both nibbles of b by c
+uint16_t gf65536Log[65536];
+uint16_t gf65536Exp[2 * 65535]; // Twice the period, so that log(a) + log(b) needs no modulo
+uint8_t gf256NibbleLow[256][16]; // gf256NibbleLow[c][x] = c * x : a product is the XOR of the products of both nibbles
+uint8_t gf256NibbleHigh[256][16]; // gf256NibbleHigh[c][x] = c * (x << 4)
+int hasSsse3 = 0; // True if the row kernels may use SSSE3 byte shuffles
+int isGaloisInitialized = 0;
+
+void galoisInit(){
+    int a, b, product, i;
+    uint32_t x = 1;
+    
+    if(isGaloisInitialized){
+        return;
+    }
+    
+    for(a = 0; a < 16; a++){
+        for(b = 0; b < 16; b++){
+            product = 0;
+            for(i = 0; i < 4; i++){ // Carry-less multiplication, reduced on the fly
+                if(b & (1 << i)){
+                    product ^= a << i;
+                }
+            }
+            for(i = 7; i >= 4; i--){
+                if(product & (1 << i)){
+                    product ^= GF16_POLYNOMIAL << (i - 4);
+                }
+            }
+            gf16Mul[a][b] = product;
+        }
+        for(b = 0; b < 256; b++){
+            gf16ByteTable[a][b] = (gf16Mul[a][b >> 4] << 4) | gf16Mul[a][b & 0x0F];
+        }
+    }
+    
+    for(i = 0; i < 65535; i++){ // 2 generates GF(2^16)*
+        gf65536Exp[i] = x;
+        gf65536Exp[i + 65535] = x;
+        gf65536Log[x] = i;
+        x <<= 1;
+        if(x & 0x10000){
+            x ^= GF65536_POLYNOMIAL;
+        }
+    }
+    gf65536Log[0] = 0;
+    
+    for(a = 0; a < 256; a++){
+        for(b = 0; b < 16; b++){
+            gf256NibbleLow[a][b] = gmul(a, b);
+            gf256NibbleHigh[a][b] = gmul(a, b << 4);
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    hasSsse3 = __builtin_cpu_supports("ssse3");
+#endif
+    
+    isGaloisInitialized = 1;
+}
+
+uint16_t fieldMul(int field, uint16_t a, uint16_t b){
+    if((a == 0) || (b == 0)){
+        return 0;
+    }
+    switch(field){
+        case FIELD_GF2:
+            return 1;
+        case FIELD_GF16:
+            return gf16Mul[a][b];
+        case FIELD_GF65536:
+            return gf65536Exp[gf65536Log[a] + gf65536Log[b]];
+        default:
+            return gmul(a, b);
+    }
+}
+
+uint16_t fieldDiv(int field, uint16_t a, uint16_t b){
+    int i;
+    if(b == 0){
+        printf("Code tried to divide %x by %x !\n", a, b);
+        exit(1);
+    }
+    if(a == 0){
+        return 0;
+    }
+    switch(field){
+        case FIELD_GF2:
+            return a;
+        case FIELD_GF16:
+            for(i = 1; gf16Mul[i][b] != a; i++); // 15 candidates at most
+            return i;
+        case FIELD_GF65536:
+            return gf65536Exp[65535 + gf65536Log[a] - gf65536Log[b]];
+        default:
+            return gdiv(a, b);
+    }
+}
+
+/* Map fieldRandomBits(field) random bits to a coefficient : non-zero, except in GF(2) where it would always be 1.
+ * Multiply and shift instead of rejecting zeros, so that a whole row is drawn in a single pass. */
+uint16_t fieldCoefficient(int field, uint64_t bits){
+    switch(field){
+        case FIELD_GF2:
+            return bits & 0x01;
+        case FIELD_GF16:
+            return 1 + (((bits & 0xFF) * 15) >> 8);
+        case FIELD_GF65536:
+            return 1 + (((bits & 0xFFFFFFFF) * 65535) >> 32);
+        default:
+            return 1 + (((bits & 0xFFFF) * 255) >> 16);
+    }
+}
+
+// Random bits consumed by fieldCoefficient()
+int fieldRandomBits(int field){
+    switch(field){
+        case FIELD_GF2:
+            return 1;
+        case FIELD_GF16:
+            return 8;
+        case FIELD_GF65536:
+            return 32;
+        default:
+            return 16;
+    }
+}
+
+// ~~ Counter-based generator : SplitMix64 keyed by (seed, index). Stateless, hence reentrant. ~~
+uint64_t splitMix(uint64_t z){
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t counterRandom(uint64_t seed, uint64_t index){
+    return splitMix(splitMix(seed) + (index + 1) * 0x9E3779B97F4A7C15ULL);
+}
+
+// words[i] = counterRandom(seed, firstIndex + i) ; the loop has no dependency between words
+void counterRandomFill(uint64_t* words, int nWords, uint64_t seed, uint64_t firstIndex){
+    int i;
+    uint64_t key = splitMix(seed);
+    for(i = 0; i < nWords; i++){
+        words[i] = splitMix(key + (firstIndex + i + 1) * 0x9E3779B97F4A7C15ULL);
+    }
+}
+
+int fieldSymbolBits(int field){
+    switch(field){
+        case FIELD_GF2:
+            return 1;
+        case FIELD_GF16:
+            return 4;
+        case FIELD_GF65536:
+            return 16;
+        default:
+            return 8;
+    }
+}
+
+// Bytes needed to store nSymbols symbols
+int fieldRowBytes(int field, int nSymbols){
+    return (nSymbols * fieldSymbolBits(field) + 7) / 8;
+}
+
+uint16_t fieldGet(int field, uint8_t* row, int index){
+    switch(field){
+        case FIELD_GF2:
+            return (row[index / 8] >> (index % 8)) & 0x01;
+        case FIELD_GF16:
+            return (index % 2) ? (row[index / 2] & 0x0F) : (row[index / 2] >> 4);
+        case FIELD_GF65536:
+            return (row[2 * index] << 8) | row[2 * index + 1];
+        default:
+            return row[index];
+    }
+}
+
+/* Move the symbols of row nSymbols positions towards its start, zero-filling its end ; symbols before first + nSymbols are zero.
+ * Whole bytes are moved at once when the shift is a number of bytes. */
+void fieldShiftRow(int field, uint8_t* row, int nSymbols, int first, int size){
+    int i, nBits = nSymbols * fieldSymbolBits(field), nSize = size * 8 / fieldSymbolBits(field);
+    int from = first * fieldSymbolBits(field) / 8;
+    
+    if(nBits % 8 == 0){
+        memmove(row + from, row + from + nBits / 8, size - from - nBits / 8);
+        memset(row + size - nBits / 8, 0, nBits / 8);
+        return;
+    }
+    for(i = first; i < nSize; i++){
+        fieldSet(field, row, i, (i + nSymbols < nSize) ? fieldGet(field, row, i + nSymbols) : 0);
+    }
+}
+
+void fieldSet(int field, uint8_t* row, int index, uint16_t value){
+    switch(field){
+        case FIELD_GF2:
+            row[index / 8] = (row[index / 8] & ~(1 << (index % 8))) | ((value & 0x01) << (index % 8));
+            break;
+        case FIELD_GF16:
+            if(index % 2){
+                row[index / 2] = (row[index / 2] & 0xF0) | (value & 0x0F);
+            } else {
+                row[index / 2] = (row[index / 2] & 0x0F) | ((value & 0x0F) << 4);
+            }
+            break;
+        case FIELD_GF65536:
+            row[2 * index] = value >> 8;
+            row[2 * index + 1] = value & 0xFF;
+            break;
+        default:
+            row[index] = value;
+    }
+}
@@ -19,6 +19,14 @@
 #ifndef _GALOIS_
 #define _GALOIS_
 
+#define FIELD_GF256 0 // GF(2^8), one symbol per byte
+#define FIELD_GF2 1 // GF(2), eight symbols per byte : coding is XOR only
+#define FIELD_GF16 2 // GF(2^4), two symbols per byte
+#define FIELD_GF65536 3 // GF(2^16), one symbol per two bytes
+
+#define GF16_POLYNOMIAL 0x13 // x^4 + x + 1
+#define GF65536_POLYNOMIAL 0x1100B // x^16 + x^12 + x^3 + x + 1
+
 uint8_t gadd(uint8_t a, uint8_t b);
 
 uint8_t gsub(uint8_t a, uint8_t b);
@@ -28,4 +36,35 @@ uint8_t gmul(uint8_t a, uint8_t b);
 uint8_t gdiv(uint8_t a, uint8_t b);
 
 uint8_t getRandom();
+
+void galoisInit();
+
+uint16_t fieldMul(int field, uint16_t a, uint16_t b);
+
+uint16_t fieldDiv(int field, uint16_t a, uint16_t b);
+
+uint16_t fieldCoefficient(int field, uint64_t bits);
+
+int fieldRandomBits(int field);
+
+uint64_t counterRandom(uint64_t seed, uint64_t index);
+
+void counterRandomFill(uint64_t* words, int nWords, uint64_t seed, uint64_t firstIndex);
+
+int fieldSymbolBits(int field);
+
+int fieldRowBytes(int field, int nSymbols);
+
+uint16_t fieldGet(int field, uint8_t* row, int index);
+
+void fieldSet(int field, uint8_t* row, int index, uint16_t value);
+
+void fieldShiftRow(int field, uint8_t* row, int nSymbols, int first, int size);
+
+extern uint8_t gf16ByteTable[16][256];
+extern uint16_t gf65536Log[65536];
+extern uint16_t gf65536Exp[2 * 65535];
+extern uint8_t gf256NibbleLow[256][16];
+extern uint8_t gf256NibbleHigh[256][16];
+extern int hasSsse3;
 #endif
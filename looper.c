@@ -18,10 +18,18 @@
 
 #include "looper.h"
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+volatile sig_atomic_t reloadGeneration = 0; // Incremented by SIGHUP, each worker reloads once
 
 void handleIncomingTcpConnected(int sock_fd, muxstate* mux);
-void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLength, struct sockaddr_in remote);
+void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLength, struct sockaddr_in remote, uint16_t options, pathcache* pathCache, codingpool* codingPool);
 void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, int cliproxy, globalstate* state);
+int sendScheduledData(globalstate* state, muxstate* muxTable, int muxTableLength, int* isSendable, struct timeval currentTime);
+int muxWeight(globalstate* state, muxstate mux);
+void onSighup(int signum);
+void* workerLoop(void* state);
 
 void initializeNetwork(globalstate* state){
     struct sockaddr_in local;
@@ -79,6 +87,11 @@ void initializeNetwork(globalstate* state){
             perror("setsockopt()");
             exit(1);
         }
+        /* Workers share the port : the kernel hashes the client endpoint to a socket, so all the muxes of a client stay on one worker */
+        if((state->nWorkers > 1) && (setsockopt(state->udpSock_fd, SOL_SOCKET, SO_REUSEPORT, (char *)&optval, sizeof(optval)) < 0)) {
+            perror("setsockopt()");
+            exit(1);
+        }
         
         memset(&local, 0, sizeof(local));
         local.sin_family = AF_INET;
@@ -101,14 +114,28 @@ void sendControlPacket(muxstate mux, uint8_t type, int udpSock){
 
 void infiniteWaitLoop(globalstate* state){
     uint8_t buffer[BUFSIZE];
-    int selectReturnValue, maxfd, dstLen, i, j, nwrite;
+    int selectReturnValue, maxfd, dstLen, i, j, nwrite, isBacklogged = false, isLimited;
+    int* isSendable = 0;
+    long delay;
     fd_set rd_set;
     struct timeval currentTime, timeOut;
     muxstate** muxTable = malloc(sizeof(muxstate*));
     *muxTable = NULL;
     int muxTableLength = 0;
     
+    if(state->rateLimitPath != 0){
+        signal(SIGHUP, onSighup);
+    }
+    if((state->nCodingThreads > 0) && (state->codingPool == 0)){
+        state->codingPool = codingPoolInit(state->nCodingThreads);
+    }
+    
     while(1) {
+        if(state->reloadGeneration != reloadGeneration){
+            state->reloadGeneration = reloadGeneration;
+            rateLimiterLoad(state->rateLimiter, state->rateLimitPath);
+        }
+        
         /* Preparing select() arguments */
         maxfd = 0; // Init the fd set
         FD_ZERO(&rd_set);
@@ -127,9 +154,25 @@ void infiniteWaitLoop(globalstate* state){
         timeOut.tv_usec = 0;
         for(i = 0; i < muxTableLength; i++){
             if((*muxTable)[i].localSocketReadState == SOCKET_OPENED){ // Local sockets ok to read from
-                FD_SET((*muxTable)[i].sock_fd, &rd_set);
-                maxfd = max(maxfd, (*muxTable)[i].sock_fd);
+                // ... unless the client is over its rate : the data waits in the socket, without being coded
+                if(rateLimiterAllows(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE, currentTime)){
+                    FD_SET((*muxTable)[i].sock_fd, &rd_set);
+                    maxfd = max(maxfd, (*muxTable)[i].sock_fd);
+                } else if(isSooner(rateLimiterNextAllowed(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE), timeOut)){
+                    timeOut = rateLimiterNextAllowed(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE);
+                }
+            }
+            // ... or the client's bucket, for the packets to code and send : nothing is coded for it until then
+            isLimited = !rateLimiterAllows(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE + MUX_HEADER_LENGTH + DATA_HEADER_LENGTH, currentTime);
+            if(isLimited){
+                if(isSooner(rateLimiterNextAllowed(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE + MUX_HEADER_LENGTH + DATA_HEADER_LENGTH), timeOut)){
+                    timeOut = rateLimiterNextAllowed(state->rateLimiter, (*muxTable)[i].udpRemote, PACKETSIZE + MUX_HEADER_LENGTH + DATA_HEADER_LENGTH);
+                }
+            } else if((*muxTable)[i].encoderState->isRateLimited && (*muxTable)[i].encoderState->isOutstandingData){
+                (*muxTable)[i].encoderState->isRateLimited = false;
+                onWindowUpdate((*muxTable)[i].encoderState); // The window updates skipped meanwhile
             }
+            (*muxTable)[i].encoderState->isRateLimited = isLimited;
             
             // Get the first to timeout, in order to set select()'s arguments
             if(isSooner((*muxTable)[i].encoderState->nextTimeout, timeOut)){
@@ -137,19 +180,19 @@ void infiniteWaitLoop(globalstate* state){
                 timeOut.tv_sec = (*muxTable)[i].encoderState->nextTimeout.tv_sec;
                 timeOut.tv_usec = (*muxTable)[i].encoderState->nextTimeout.tv_usec;
             }
+            // ... or the first paced packet to release, if the limiter lets it go
+            if(!isLimited && isSooner(pacerNextRelease(*((*muxTable)[i].encoderState)), timeOut)){
+                timeOut = pacerNextRelease(*((*muxTable)[i].encoderState));
+            }
         }
 
-        // Process the relative delay instead of absolute times
-        if(timeOut.tv_sec - currentTime.tv_sec > 0){
-            timeOut.tv_sec = timeOut.tv_sec - currentTime.tv_sec;
-            if(timeOut.tv_usec - currentTime.tv_usec > 0){
-                timeOut.tv_usec = timeOut.tv_usec - currentTime.tv_usec;
-            } else {
-                timeOut.tv_usec = 0;
-            }
-        } else {
-            timeOut.tv_sec = 0;
+        // Process the relative delay instead of absolute times ; pacing needs it exact below one second
+        delay = diffUSec(timeOut, currentTime);
+        if((delay < 0) || isBacklogged){ // The scheduler has run out of budget : the rest leaves on the next iteration
+            delay = 0;
         }
+        timeOut.tv_sec = delay / 1000000;
+        timeOut.tv_usec = delay % 1000000;
         
         /* Select */
         do_debug("\n\n~~~~~~~~~~\nEntering select with TO = %u,%u\n", timeOut.tv_sec, timeOut.tv_usec);
@@ -178,7 +221,7 @@ void infiniteWaitLoop(globalstate* state){
         
         if((state->cliproxy == CLIENT) && (FD_ISSET(state->tcpListenerSock_fd, &rd_set))){
             do_debug("Incoming TCP on the listener socket\n");
-            handleIncomingTcpListener(state->tcpListenerSock_fd, muxTable, &muxTableLength, state->remote);
+            handleIncomingTcpListener(state->tcpListenerSock_fd, muxTable, &muxTableLength, state->remote, state->muxOptions, state->pathCache, state->codingPool);
         }
         
         for(i = 0; i<muxTableLength;i++){
@@ -189,6 +232,8 @@ void infiniteWaitLoop(globalstate* state){
         }
         
         /* Process DATA, ACKs, data to the application, and state variations */
+        isSendable = realloc(isSendable, (muxTableLength + 1) * sizeof(int));
+        memset(isSendable, 0, (muxTableLength + 1) * sizeof(int)); // The loop may break before reaching the last muxes
         for(i = 0; i<muxTableLength;i++){
             //DEBUG :
             if(regulator()){
@@ -249,22 +294,7 @@ void infiniteWaitLoop(globalstate* state){
             ) &&
             ((*muxTable)[i].remoteSocketWriteState = SOCKET_OPENED) // No point in sending if the receiver will not accept !
             ){
-                for(j = 0; j < (*muxTable)[i].encoderState->nDataToSend; j++){
-                    bufferToMuxed((*muxTable)[i].encoderState->dataToSend[j], buffer, (*muxTable)[i].encoderState->dataToSendSize[j], &dstLen, (*muxTable)[i], TYPE_DATA);
-                    nwrite = udpSend(state->udpSock_fd, buffer, dstLen, (struct sockaddr*)&((*muxTable)[i].udpRemote));
-                    do_debug("Sent a %d bytes DATA packet\n", nwrite);
-                }
-                // Free
-                for(j = 0; j< (*muxTable)[i].encoderState->nDataToSend;j++){
-                    free((*muxTable)[i].encoderState->dataToSend[j]);
-                }
-                if((*muxTable)[i].encoderState->nDataToSend > 0){
-                    free((*muxTable)[i].encoderState->dataToSend);
-                    (*muxTable)[i].encoderState->dataToSend = 0;
-                    free((*muxTable)[i].encoderState->dataToSendSize);
-                    (*muxTable)[i].encoderState->dataToSendSize = 0;
-                    (*muxTable)[i].encoderState->nDataToSend = 0;
-                }
+                isSendable[i] = true; // The scheduler sends the data packets, once the states of all the muxes are up to date
             }
             
             // Inform the remote endpoint of any changes that he would need to know
@@ -320,15 +350,139 @@ void infiniteWaitLoop(globalstate* state){
                 // Send a CLOSE
                 sendControlPacket((*muxTable)[i], TYPE_CLOSE, state->udpSock_fd);
                 // Remove the mux
-                removeMux(i, muxTable, &muxTableLength);
+                removeMux(i, muxTable, &muxTableLength, state->pathCache);
+                memmove(isSendable + i, isSendable + i + 1, (muxTableLength - i) * sizeof(int));
                 i--; // Compensate for the remove sliding
             }
             
             
         }
+        
+        // Send coded data packets, interleaving the muxes by weight
+        isBacklogged = sendScheduledData(state, *muxTable, muxTableLength, isSendable, currentTime);
+        
+        // Idle until the next event : compute the next repairs ahead
+        for(i = 0; (i < muxTableLength) && !isBacklogged; i++){
+            encoderPrecompute((*muxTable)[i].encoderState);
+        }
     }
 }
 
+/* Send the data packets that the pacers release, in the order of the scheduler and within its budget.
+ * Returns true if some of them have to wait for the next iteration. */
+int sendScheduledData(globalstate* state, muxstate* muxTable, int muxTableLength, int* isSendable, struct timeval currentTime){
+    uint8_t buffer[BUFSIZE];
+    int i, j, dstLen, nwrite, nOrdered, nReleasableTotal = 0, isBacklogged = false, size;
+    int* nReleasable = calloc(muxTableLength + 1, sizeof(int));
+    int* weights = calloc(muxTableLength + 1, sizeof(int));
+    int* nSent = calloc(muxTableLength + 1, sizeof(int));
+    int* order;
+    
+    for(i = 0; i < muxTableLength; i++){
+        if(isSendable[i]){
+            // Only what the pacer releases ; select() wakes us up for the rest
+            nReleasable[i] = pacerReleasable(muxTable[i].encoderState, currentTime);
+            // ... and what the client's bucket allows : the packets over its rate wait without taking the budget of the other muxes
+            for(j = 0, size = 0; j < nReleasable[i]; j++){
+                size += muxTable[i].encoderState->dataToSendSize[j] + MUX_HEADER_LENGTH;
+                if(!rateLimiterAllows(state->rateLimiter, muxTable[i].udpRemote, size, currentTime)){
+                    break;
+                }
+            }
+            nReleasable[i] = j;
+            nReleasableTotal += nReleasable[i];
+        }
+        weights[i] = muxWeight(state, muxTable[i]);
+    }
+    
+    order = malloc((nReleasableTotal + 1) * sizeof(int));
+    nOrdered = scheduleMuxes(muxTable, muxTableLength, nReleasable, weights, SCHEDULER_BUDGET, &(state->schedulerNext), order);
+    for(j = 0; j < nOrdered; j++){
+        i = order[j];
+        size = muxTable[i].encoderState->dataToSendSize[nSent[i]] + MUX_HEADER_LENGTH;
+        rateLimiterConsume(state->rateLimiter, muxTable[i].udpRemote, size);
+        bufferToMuxed(muxTable[i].encoderState->dataToSend[nSent[i]], buffer, muxTable[i].encoderState->dataToSendSize[nSent[i]], &dstLen, muxTable[i], TYPE_DATA);
+        nwrite = udpSend(state->udpSock_fd, buffer, dstLen, (struct sockaddr*)&(muxTable[i].udpRemote));
+        do_debug("Sent a %d bytes DATA packet for mux #%d\n", nwrite, i);
+        nSent[i]++;
+    }
+    
+    for(i = 0; i < muxTableLength; i++){
+        // Free
+        pacerDequeue(muxTable[i].encoderState, nSent[i]);
+        isBacklogged = isBacklogged || (nSent[i] < nReleasable[i]);
+    }
+    
+    free(nReleasable);
+    free(weights);
+    free(nSent);
+    free(order);
+    return isBacklogged;
+}
+
+void onSighup(int signum){
+    reloadGeneration++;
+}
+
+/* State of another proxy worker : shares the options, has its own socket, path cache and client buckets.
+ * Nothing is shared on the data path, so the workers run without locks. */
+globalstate* workerStateInit(globalstate* state){
+    globalstate* ret = malloc(sizeof(globalstate));
+    
+    memcpy(ret, state, sizeof(globalstate));
+    ret->remote_ip = calloc(16, sizeof(char));
+    strncpy(ret->remote_ip, state->remote_ip, 15);
+    ret->pathCache = pathCacheInit();
+    ret->weightedPorts = malloc((state->nWeightedPorts + 1) * sizeof(uint16_t));
+    memcpy(ret->weightedPorts, state->weightedPorts, state->nWeightedPorts * sizeof(uint16_t));
+    ret->portWeights = malloc((state->nWeightedPorts + 1) * sizeof(int));
+    memcpy(ret->portWeights, state->portWeights, state->nWeightedPorts * sizeof(int));
+    ret->schedulerNext = 0;
+    ret->codingPool = 0; // Each worker starts its own
+    ret->rateLimiter = rateLimiterInit();
+    if(state->rateLimitPath != 0){
+        rateLimiterLoad(ret->rateLimiter, state->rateLimitPath);
+    }
+    
+    initializeNetwork(ret);
+    return ret;
+}
+
+void* workerLoop(void* state){
+    infiniteWaitLoop((globalstate*)state);
+    return 0;
+}
+
+// Start the workers other than the calling thread, once all their sockets are bound
+void startWorkers(globalstate* state){
+    int i;
+    pthread_t thread;
+    globalstate* workers[MAX_WORKERS];
+    
+    galoisInit(); // The tables are shared, fill them before the threads use them
+    for(i = 1; i < state->nWorkers; i++){
+        workers[i] = workerStateInit(state);
+    }
+    for(i = 1; i < state->nWorkers; i++){
+        if(pthread_create(&thread, NULL, workerLoop, workers[i]) != 0){
+            perror("pthread_create()");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+}
+
+// Scheduler weight of the mux, from the port of its server
+int muxWeight(globalstate* state, muxstate mux){
+    int i;
+    for(i = 0; i < state->nWeightedPorts; i++){
+        if(state->weightedPorts[i] == mux.dport){
+            return state->portWeights[i];
+        }
+    }
+    return SCHEDULER_DEFAULT_WEIGHT;
+}
+
 void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, int cliproxy, globalstate* state){
     struct sockaddr_in localConnect, remoteConnect, udpRemote;
     int destinationLen, nread, nMux, newSock;
@@ -344,7 +498,9 @@ void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, in
     
     do_debug("Received %d bytes from UDP socket from %s:%d\n", nread, inet_ntoa(udpRemote.sin_addr), ntohs(udpRemote.sin_port));
     if(muxedToBuffer(buffer, tmp, nread, &destinationLen, &currentMux, &type)){
-        nMux = assignMux(currentMux.sport, currentMux.dport, currentMux.remote_ip, currentMux.randomId, -1, muxTable, muxTableLength, udpRemote);
+        nMux = assignMux(currentMux.sport, currentMux.dport, currentMux.remote_ip, currentMux.randomId, -1, muxTable, muxTableLength, udpRemote, currentMux.options, state->pathCache);
+        (*muxTable)[nMux].encoderState->codingPool = state->codingPool;
+        (*muxTable)[nMux].decoderState->codingPool = state->codingPool;
         do_debug("Assigned to mux #%d\n", nMux);
         
         // First DATA/EMPTY
@@ -373,7 +529,7 @@ void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, in
                 
                 printf("Error on connect => we send back a close()\n");
                 sendControlPacket((*muxTable)[nMux], TYPE_CLOSE, sock_fd);
-                removeMux(nMux, muxTable, muxTableLength);
+                removeMux(nMux, muxTable, muxTableLength, state->pathCache);
             } else {
                 (*muxTable)[nMux].sock_fd = newSock;
                 
@@ -421,7 +577,7 @@ void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, in
         // CLOSE
         } else if(type == TYPE_CLOSE){
             printf("TYPE_CLOSE ; closing mux #%d.\n", nMux);
-            removeMux(nMux, muxTable, muxTableLength);
+            removeMux(nMux, muxTable, muxTableLength, state->pathCache);
             
         // Non-first EMPTY
         } else if(type == TYPE_EMPTY && (*muxTable)[nMux].state != STATE_INIT){
@@ -453,14 +609,14 @@ void handleIncomingUdp(int sock_fd, muxstate** muxTable, int* muxTableLength, in
         } else {
             printf("Received packet (%u) did not make sense for mux #%d => Send back a TYPE_CLOSE\n", type, nMux);
             sendControlPacket((*muxTable)[nMux], TYPE_CLOSE, sock_fd);
-            removeMux(nMux, muxTable, muxTableLength);
+            removeMux(nMux, muxTable, muxTableLength, state->pathCache);
         }
     } else {
         do_debug("Received a bogus UDP packet.\n");
     }
 }
 
-void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLength, struct sockaddr_in remote){
+void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLength, struct sockaddr_in remote, uint16_t options, pathcache* pathCache, codingpool* codingPool){
     struct sockaddr_in sourceAccept, destinationAccept;
     uint16_t sport; uint16_t dport; uint32_t dip;
     int newSock, nMux;
@@ -487,7 +643,9 @@ void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLe
     dip = ntohl(destinationAccept.sin_addr.s_addr);
     
     srand(time(NULL)); // Initialize the PRNG to a random value
-    nMux = assignMux(sport, dport, dip, (uint16_t)random(), newSock, muxTable, muxTableLength, remote);
+    nMux = assignMux(sport, dport, dip, (uint16_t)random(), newSock, muxTable, muxTableLength, remote, options, pathCache);
+    (*muxTable)[nMux].encoderState->codingPool = codingPool;
+    (*muxTable)[nMux].decoderState->codingPool = codingPool;
     do_debug("Assigned to mux #%d\n", nMux);
     (*muxTable)[nMux].state = STATE_OPENED_SIMPLEX; // The local mux is in simplex state
     (*muxTable)[nMux].localSocketReadState = SOCKET_OPENED; // The local tcp socket is R/W ok
@@ -500,18 +658,19 @@ void handleIncomingTcpListener(int sock_fd, muxstate** muxTable, int* muxTableLe
 }
 
 void handleIncomingTcpConnected(int sock_fd, muxstate* mux){
-    uint8_t buffer[BUFSIZE];
-    int nread;
+    struct iovec rows[READ_MAX_ROWS];
+    int nread, nRows;
     
     if(isMoreDataOk(*(mux->encoderState))){
-        if((nread = cread(mux->sock_fd, buffer, BUFSIZE)) == 0){
+        // Read straight into the generations
+        nRows = getInputRows(mux->encoderState, rows, READ_MAX_ROWS);
+        if((nread = creadv(mux->sock_fd, rows, nRows)) == 0){
             printf("In handleIncomingTcpConnected : read has returned %d\n", nread);
             mux->localSocketReadState = SOCKET_CLOSED_ACKNOWLDGED;
         } else {
             do_debug("Mux has received %d bytes from the TCP socket\n", nread);
-            // Pass it to the encoder
-            handleInClear(mux->encoderState, buffer, nread);
         }
+        handleInRows(mux->encoderState, nread);
     }
 }
 
@@ -519,11 +678,45 @@ void globalStateInit(globalstate* state){
     state->tcpListenerPort = 0;
     state->udpPort = 0;
     state->cliproxy = -1;
+    state->muxOptions = CODEC_BLOCK;
     state->remote_ip = calloc(16, sizeof(char)); // 16 chars = notation for quad-dot IPv4
     state->tcpListenerSock_fd = 0;
     state->udpSock_fd = 0;
+    state->pathCache = pathCacheInit();
+    state->weightedPorts = 0;
+    state->portWeights = 0;
+    state->nWeightedPorts = 0;
+    state->schedulerNext = 0;
+    state->rateLimiter = rateLimiterInit();
+    state->rateLimitPath = 0;
+    state->reloadGeneration = 0;
+    state->nWorkers = 1;
+    state->nCodingThreads = 0;
+    state->codingPool = 0;
+}
+
+// Parse a <port>:<weight> scheduler weight
+void addPortWeight(globalstate* state, char* spec){
+    int port, weight;
+    
+    if((sscanf(spec, "%d:%d", &port, &weight) != 2) || (port <= 0) || (port > 65535) || (weight < 1)){
+        my_err("Bad scheduler weight %s, expected <port>:<weight> with a weight of at least 1\n", spec);
+        exit(1);
+    }
+    state->weightedPorts = realloc(state->weightedPorts, (state->nWeightedPorts + 1) * sizeof(uint16_t));
+    state->portWeights = realloc(state->portWeights, (state->nWeightedPorts + 1) * sizeof(int));
+    state->weightedPorts[state->nWeightedPorts] = port;
+    state->portWeights[state->nWeightedPorts] = weight;
+    state->nWeightedPorts++;
 }
 
 void globalStateFree(globalstate* state){
     free(state->remote_ip);
+    pathCacheFree(state->pathCache);
+    free(state->weightedPorts);
+    free(state->portWeights);
+    rateLimiterFree(state->rateLimiter);
+    if(state->codingPool != 0){
+        codingPoolFree(state->codingPool);
+    }
 }
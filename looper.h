@@ -21,6 +21,7 @@
 
 #include "utils.h"
 #include "protocol.h"
+#include "ratelimit.h"
 
 #define SO_ORIGINAL_DST 80
 
@@ -29,6 +30,8 @@
 #define CLIENT 0
 #define PROXY 1
 
+#define MAX_WORKERS 64 // Proxy threads
+
 typedef struct globalstate_t{ // Contains information that needs to be passed from main to init_network to loop
     int tcpListenerPort;
     int udpPort;
@@ -37,15 +40,36 @@ typedef struct globalstate_t{ // Contains information that needs to be passed fr
     
     int cliproxy;
     
+    uint16_t muxOptions; // Coding and congestion control options for the muxes we open (client only)
+    
     char *remote_ip;
     
     struct sockaddr_in remote; // The proxy UDP endpoint, if we are client. NULL otherwise.
+    
+    pathcache* pathCache; // Metrics of the paths used by the previous muxes
+    
+    uint16_t* weightedPorts; // Muxes to these server ports get the matching weight in the scheduler, others SCHEDULER_DEFAULT_WEIGHT
+    int* portWeights;
+    int nWeightedPorts;
+    int schedulerNext; // Mux the scheduler serves first on the next iteration
+    
+    ratelimiter* rateLimiter; // Token buckets of the clients, shared by their muxes
+    char* rateLimitPath; // File of the limits, read again on SIGHUP ; 0 if the clients are not limited
+    int reloadGeneration; // Last SIGHUP this loop has handled
+    
+    int nWorkers; // Proxy threads, each with its own UDP socket on the shared port (SO_REUSEPORT) and its own muxes
+    
+    int nCodingThreads; // Threads of each loop that generate the coded payloads of its muxes ; 0 to code in the loop thread
+    codingpool* codingPool; // Started by the loop
 } globalstate;
 
 void initializeNetwork(globalstate* state);
 void infiniteWaitLoop(globalstate* state);
+globalstate* workerStateInit(globalstate* state);
+void startWorkers(globalstate* state);
 
 void globalStateInit(globalstate* state);
 void globalStateFree(globalstate* state);
+void addPortWeight(globalstate* state, char* spec);
 
 #endif
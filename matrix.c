@@ -24,6 +24,16 @@
 #include "galois_field.h"
 #include "matrix.h"
 #include "utils.h"
+#ifdef GF_SSSE3
+#include <tmmintrin.h>
+
+int rowMulSubSsse3(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size);
+int rowMulSubSsse3Body(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size);
+#endif
+void rowMulSubScalarBody(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int i, int size);
+void rowXorBody(uint8_t* a, uint8_t* b, int size);
+
+void runMatMulJob(void* job);
 
 
 matrix* mCreate(int rows, int columns){
@@ -32,6 +42,7 @@ matrix* mCreate(int rows, int columns){
     resultMatrix = malloc(sizeof(matrix));
     resultMatrix->nRows = rows;
     resultMatrix->nColumns = columns;
+    resultMatrix->data = 0;
     // In case of a 0 matrix, do not allocate
     if(rows != 0){
         resultMatrix->data = malloc(rows * sizeof(uint8_t**));
@@ -70,6 +81,65 @@ matrix* getRandomMatrix(int rows, int columns){
     return resultMatrix;
 }
 
+/* Write the coefficients of a coded packet combining size packets in vector (packed symbols of field), using seed.
+ * If 0 < nNonZeros < size, only nNonZeros positions (drawn from seed too) get a coefficient, the others are zero. */
+void getCoefficients(int field, uint8_t* vector, int size, uint32_t seed, int nNonZeros){
+    int i, laneBits = fieldRandomBits(field), lanes = 64 / laneBits;
+    uint64_t words[BLKSIZE], r;
+    memset(vector, 0, fieldRowBytes(field, size));
+    
+    if((nNonZeros <= 0) || (nNonZeros >= size)){
+        // Each random word holds the bits of several coefficients
+        counterRandomFill(words, (size + lanes - 1) / lanes, seed, 0);
+        for(i = 0; i < size; i++){
+            fieldSet(field, vector, i, fieldCoefficient(field, words[i / lanes] >> ((i % lanes) * laneBits)));
+        }
+    } else {
+        for(i = 0; i < nNonZeros; i++){
+            // Positions may collide : at most nNonZeros coefficients
+            r = counterRandom(seed, SPARSE_COUNTER_BASE + i);
+            fieldSet(field, vector, ((r & 0xFFFFFFFF) * size) >> 32, (field == FIELD_GF2) ? 1 : fieldCoefficient(field, r >> 32));
+        }
+    }
+}
+
+/* Write row repairNo of a Cauchy matrix, C[j][i] = 1 / (x_j + y_i) with x_j = BLKSIZE + j and y_i = i.
+ * Every square submatrix of a Cauchy matrix is invertible : k repairs of a k packets block always decode it,
+ * and so does any mix of clear packets and repairs. Rows repeat after CAUCHY_ROWS repairs : getRangeCoefficients() does not go that far.
+ * Needs at least 256 elements : GF(2^8) or GF(2^16). */
+void getCauchyCoefficients(int field, uint8_t* vector, int size, int repairNo){
+    int i;
+    uint16_t x = BLKSIZE + (repairNo % CAUCHY_ROWS);
+    
+    for(i = 0; i < size; i++){
+        fieldSet(field, vector, i, fieldDiv(field, 1, x ^ i));
+    }
+}
+
+/* Coefficients of a coded packet combining packets first..size-1 only : those before have been decoded by the receiver.
+ * Random coefficients are drawn for the size - first covered packets ; Cauchy columns keep their index,
+ * so that repairs over different ranges still are rows of the same Cauchy matrix. The repairs past the CAUCHY_ROWS
+ * distinct rows are random : a repeated row would bring the receiver nothing. */
+void getRangeCoefficients(int field, int isCauchy, uint8_t* vector, int first, int size, uint32_t seed, int nNonZeros, int repairNo){
+    int i;
+    uint8_t drawn[MAX_COEFFS_BYTES];
+    
+    if(isCauchy && (repairNo < CAUCHY_ROWS)){
+        getCauchyCoefficients(field, vector, size, repairNo);
+        for(i = 0; i < first; i++){
+            fieldSet(field, vector, i, 0);
+        }
+    } else if(first == 0){
+        getCoefficients(field, vector, size, seed, nNonZeros);
+    } else {
+        getCoefficients(field, drawn, size - first, seed, nNonZeros);
+        memset(vector, 0, fieldRowBytes(field, size));
+        for(i = first; i < size; i++){
+            fieldSet(field, vector, i, fieldGet(field, drawn, i - first));
+        }
+    }
+}
+
 void mPrint(matrix m){
     int i, j;
     printf("rows = %d, columns = %d\n", m.nRows, m.nColumns);
@@ -98,12 +168,13 @@ void mFree(matrix* m){
     free(m);
 }
 
-// mMul memory-wise
 matrix* mMul(matrix a, matrix b){
-    int i, j, k;
+    return mMulParallel(a, b, 0);
+}
+
+// Product in GF(2^8), the row bands of the result split over the coding threads of pool (inline if 0)
+matrix* mMulParallel(matrix a, matrix b, codingpool* pool){
     matrix* resultMatrix;
-    uint8_t factor;
-    uint8_t *aVector, *bVector, *resVector;
 
     // Check dimension correctness
     if(a.nColumns != b.nRows){
@@ -112,21 +183,68 @@ matrix* mMul(matrix a, matrix b){
     }
 
     resultMatrix = mCreate(a.nRows, b.nColumns);
+    fieldMatMulSubParallel(pool, FIELD_GF256, resultMatrix->data, a.data, b.data, a.nRows, 0, a.nColumns, b.nColumns);
+    return resultMatrix;
+}
 
-    for(i = 0; i < resultMatrix->nRows; i++){
-        aVector = a.data[i];
-        resVector = resultMatrix->data[i];
-        for(j = 0; j < a.nColumns; j++){
-            factor = aVector[j];
-            if(factor != 0x00){
-                bVector = b.data[j];
-                for(k = 0; k < b.nColumns; k++){
-                    resVector[k] = gadd(resVector[k], gmul(factor, bVector[k]));
-                } 
+/* c[row] = c[row] - sum(a[row][i] * b[i]) for i in first..nInner-1, where a holds rows of symbols of field.
+ * Cache-blocked : MUL_TILE_ROWS rows of b, MUL_TILE_COLUMNS columns wide, are applied to every row of c
+ * while they stay in L2, and each tile of c stays in L1 across them */
+void fieldMatMulSub(int field, uint8_t** c, uint8_t** a, uint8_t** b, int nRows, int first, int nInner, int nColumns){
+    int tile, tileSize, band, bandEnd, row, i;
+    rowkernels* kernels;
+    
+    for(tile = 0; tile < nColumns; tile += MUL_TILE_COLUMNS){
+        tileSize = min(MUL_TILE_COLUMNS, nColumns - tile);
+        kernels = getRowKernels(tileSize);
+        for(band = first; band < nInner; band += MUL_TILE_ROWS){
+            bandEnd = min(band + MUL_TILE_ROWS, nInner);
+            for(row = 0; row < nRows; row++){
+                for(i = band; i < bandEnd; i++){
+                    fieldRowMulSubKernels(field, kernels, c[row] + tile, b[i] + tile, fieldGet(field, a[row], i), tileSize);
+                }
             }
         }
     }
-    return resultMatrix;
+}
+
+void runMatMulJob(void* job){
+    matmuljob* j = (matmuljob*)job;
+    
+    fieldMatMulSub(j->field, j->c, j->a, j->b, j->nRows, j->first, j->nInner, j->nColumns);
+}
+
+// fieldMatMulSub(), one band of rows of c per coding thread of pool ; inline if pool is 0 or c is too small to share
+void fieldMatMulSubParallel(codingpool* pool, int field, uint8_t** c, uint8_t** a, uint8_t** b, int nRows, int first, int nInner, int nColumns){
+    int i, nBands, bandRows;
+    matmuljob* jobs;
+    atomic_int nRunning;
+    
+    if((pool == 0) || (nRows < 2 * MUL_MIN_BAND_ROWS)){
+        fieldMatMulSub(field, c, a, b, nRows, first, nInner, nColumns);
+        return;
+    }
+    
+    bandRows = (nRows + pool->nThreads - 1) / pool->nThreads;
+    if(bandRows < MUL_MIN_BAND_ROWS){
+        bandRows = MUL_MIN_BAND_ROWS;
+    }
+    nBands = (nRows + bandRows - 1) / bandRows;
+    jobs = malloc(nBands * sizeof(matmuljob));
+    atomic_init(&nRunning, 0);
+    for(i = 0; i < nBands; i++){
+        jobs[i].field = field;
+        jobs[i].c = c + i * bandRows;
+        jobs[i].a = a + i * bandRows;
+        jobs[i].b = b;
+        jobs[i].nRows = min(bandRows, nRows - i * bandRows);
+        jobs[i].first = first;
+        jobs[i].nInner = nInner;
+        jobs[i].nColumns = nColumns;
+        codingPoolSubmit(pool, runMatMulJob, &(jobs[i]), &nRunning);
+    }
+    codingPoolWait(&nRunning);
+    free(jobs);
 }
 
 
@@ -172,11 +290,214 @@ void rowReduce(uint8_t* row, uint8_t factor, int size){
 }
 
 void rowMulSub(uint8_t* a, uint8_t* b, uint8_t coeff, int size){
-    if(coeff != 0x00){
+    if(coeff == 0x01){
+        rowXor(a, b, size);
+    } else if(coeff != 0x00){
         // a = a - b*c
-        int i;
-        for(i = 0; i < size ; i++){
-            a[i] = gsub(a[i], gmul(coeff, b[i]));
+        rowMulSubNibbles(a, b, gf256NibbleLow[coeff], gf256NibbleHigh[coeff], size);
+    }
+}
+
+/* a = a ^ (low[b & 0x0F] ^ high[b >> 4]) : a multiply-accumulate by a constant, for any field
+ * whose products split over the nibbles of a byte. 16 bytes per shuffle with SSSE3. */
+void rowMulSubNibbles(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size){
+    int i = 0;
+    
+#ifdef GF_SSSE3
+    if(hasSsse3){
+        i = rowMulSubSsse3(a, b, low, high, size);
+    }
+#endif
+    rowMulSubScalarBody(a, b, low, high, i, size);
+}
+
+__attribute__((always_inline)) inline void rowMulSubScalarBody(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int i, int size){
+    for(; i < size; i++){
+        a[i] ^= low[b[i] & 0x0F] ^ high[b[i] >> 4];
+    }
+}
+
+#ifdef GF_SSSE3
+// Process the leading multiple of 16 bytes ; returns the number of bytes processed
+__attribute__((target("ssse3")))
+int rowMulSubSsse3(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size){
+    return rowMulSubSsse3Body(a, b, low, high, size);
+}
+
+__attribute__((target("ssse3"), always_inline)) inline int rowMulSubSsse3Body(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size){
+    int i;
+    __m128i lowTable = _mm_loadu_si128((__m128i*)low);
+    __m128i highTable = _mm_loadu_si128((__m128i*)high);
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i vb, product;
+    
+    for(i = 0; i + 16 <= size; i += 16){
+        vb = _mm_loadu_si128((__m128i*)(b + i));
+        product = _mm_xor_si128(_mm_shuffle_epi8(lowTable, _mm_and_si128(vb, mask)), _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi64(vb, 4), mask)));
+        _mm_storeu_si128((__m128i*)(a + i), _mm_xor_si128(_mm_loadu_si128((__m128i*)(a + i)), product));
+    }
+    return i;
+}
+#endif
+
+/* a = a + b. Addition in GF(2^8) is a XOR : process 8 bytes at a time */
+void rowXor(uint8_t* a, uint8_t* b, int size){
+    rowXorBody(a, b, size);
+}
+
+__attribute__((always_inline)) inline void rowXorBody(uint8_t* a, uint8_t* b, int size){
+    int i;
+    uint64_t wordA, wordB;
+    
+    for(i = 0; i + 8 <= size; i += 8){
+        memcpy(&wordA, a + i, 8);
+        memcpy(&wordB, b + i, 8);
+        wordA ^= wordB;
+        memcpy(a + i, &wordA, 8);
+    }
+    for(; i < size; i++){
+        a[i] ^= b[i];
+    }
+}
+
+// ~~ Row kernels for fixed sizes : the bodies above, inlined with a constant size, so that their loops are fully unrolled ~~
+
+#ifdef GF_SSSE3
+#define ROW_MUL_SUB_FIXED(N) \
+__attribute__((target("ssse3"))) void rowMulSubSsse3_##N(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high){ \
+    rowMulSubScalarBody(a, b, low, high, rowMulSubSsse3Body(a, b, low, high, N), N); \
+}
+#define ROW_KERNELS_SSSE3(N) {N, rowMulSubSsse3_##N, rowXor_##N},
+#else
+#define ROW_MUL_SUB_FIXED(N)
+#define ROW_KERNELS_SSSE3(N)
+#endif
+
+#define ROW_KERNELS_FIXED(N) \
+void rowMulSubScalar_##N(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high){ \
+    rowMulSubScalarBody(a, b, low, high, 0, N); \
+} \
+void rowXor_##N(uint8_t* a, uint8_t* b){ \
+    rowXorBody(a, b, N); \
+} \
+ROW_MUL_SUB_FIXED(N)
+
+ROW_KERNEL_SIZES(ROW_KERNELS_FIXED)
+
+#define ROW_KERNELS_SCALAR(N) {N, rowMulSubScalar_##N, rowXor_##N},
+
+rowkernels rowKernelsScalar[] = {ROW_KERNEL_SIZES(ROW_KERNELS_SCALAR) {0, 0, 0}};
+#ifdef GF_SSSE3
+rowkernels rowKernelsSsse3[] = {ROW_KERNEL_SIZES(ROW_KERNELS_SSSE3) {0, 0, 0}};
+#endif
+
+// Kernels specialized for rows of size bytes, for the CPU we run on ; 0 if there are none
+rowkernels* getRowKernels(int size){
+    int i;
+    rowkernels* kernels = rowKernelsScalar;
+    
+#ifdef GF_SSSE3
+    if(hasSsse3){
+        kernels = rowKernelsSsse3;
+    }
+#endif
+    for(i = 0; kernels[i].size != 0; i++){
+        if(kernels[i].size == size){
+            return &(kernels[i]);
         }
     }
+    return 0;
+}
+
+/* a = a - b*coeff, where a and b are rows of symbols of field */
+void fieldRowMulSub(int field, uint8_t* a, uint8_t* b, uint16_t coeff, int size){
+    fieldRowMulSubKernels(field, 0, a, b, coeff, size);
+}
+
+// fieldRowMulSub() with kernels from getRowKernels(), used if they are for rows of size bytes
+void fieldRowMulSubKernels(int field, rowkernels* kernels, uint8_t* a, uint8_t* b, uint16_t coeff, int size){
+    int i;
+    uint8_t* table;
+    uint8_t low[16], high[16];
+    uint16_t symbol, logCoeff;
+    
+    if(coeff == 0x00){
+        return;
+    }
+    if((kernels != 0) && (kernels->size != size)){
+        kernels = 0;
+    }
+    if((coeff == 0x01) || (field == FIELD_GF2)){
+        if(kernels != 0){
+            kernels->add(a, b);
+        } else {
+            rowXor(a, b, size);
+        }
+        return;
+    }
+    
+    switch(field){
+        case FIELD_GF16: // Both nibbles of a byte at once
+            table = gf16ByteTable[coeff];
+            for(i = 0; i < 16; i++){
+                low[i] = table[i];
+                high[i] = table[i << 4];
+            }
+            if(kernels != 0){
+                kernels->mulSub(a, b, low, high);
+            } else {
+                rowMulSubNibbles(a, b, low, high, size);
+            }
+            break;
+        case FIELD_GF65536:
+            logCoeff = gf65536Log[coeff];
+            for(i = 0; i + 1 < size; i += 2){
+                symbol = (b[i] << 8) | b[i + 1];
+                if(symbol != 0){
+                    symbol = gf65536Exp[gf65536Log[symbol] + logCoeff];
+                    a[i] ^= symbol >> 8;
+                    a[i + 1] ^= symbol & 0xFF;
+                }
+            }
+            break;
+        default:
+            if(kernels != 0){
+                kernels->mulSub(a, b, gf256NibbleLow[coeff], gf256NibbleHigh[coeff]);
+            } else {
+                rowMulSub(a, b, coeff, size);
+            }
+    }
+}
+
+/* row = row / factor, where row is a row of symbols of field */
+void fieldRowReduce(int field, uint8_t* row, uint16_t factor, int size){
+    int i;
+    uint8_t* table;
+    uint16_t symbol, logInverse;
+    
+    if((factor == 0x01) || (field == FIELD_GF2)){
+        return;
+    }
+    
+    switch(field){
+        case FIELD_GF16:
+            table = gf16ByteTable[fieldDiv(field, 1, factor)];
+            for(i = 0; i < size; i++){
+                row[i] = table[row[i]];
+            }
+            break;
+        case FIELD_GF65536:
+            logInverse = gf65536Log[fieldDiv(field, 1, factor)];
+            for(i = 0; i + 1 < size; i += 2){
+                symbol = (row[i] << 8) | row[i + 1];
+                if(symbol != 0){
+                    symbol = gf65536Exp[gf65536Log[symbol] + logInverse];
+                    row[i] = symbol >> 8;
+                    row[i + 1] = symbol & 0xFF;
+                }
+            }
+            break;
+        default:
+            rowReduce(row, factor, size);
+    }
 }
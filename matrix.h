@@ -20,9 +20,25 @@
 #define _MATRIX_
 
 #define MAX_PRINT 20 // Do not print matrices if horiz dimension exceeds it
+#define CAUCHY_ROWS (256 - BLKSIZE) // Distinct Cauchy rows : x_j = BLKSIZE + j must not collide with any y_i = i
+#define SPARSE_COUNTER_BASE (1ULL << 32) // Counters of the sparse positions, apart from those of dense rows
+#define MAX_COEFFS_BYTES (2 * BLKSIZE) // Size of a coefficient vector in the largest field, GF(2^16)
+#define MUL_TILE_COLUMNS 2048 // Matrix products : a tile of a result row and of a source row fit in a 32 KB L1 ; even, for GF(2^16)
+#define MUL_TILE_ROWS 64 // Matrix products : source rows applied together, 128 KB of tiles that stay in a 256 KB L2
+#define MUL_MIN_BAND_ROWS 16 // Matrix products : result rows given to a coding thread, at least
+
+/* Row sizes with specialized kernels : coefficient rows, always BLKSIZE symbols whatever the generation size (16 bytes in GF(2),
+ * 64 in GF(2^4), 127 in GF(2^8) ; GF(2^16) rows have no kernels), usual payload sizes (Ethernet with IPv4 or IPv6 tunnel
+ * headers, jumbo frames), and full tiles of products (MUL_TILE_COLUMNS) */
+#define ROW_KERNEL_SIZES(X) X(16) X(64) X(127) X(1380) X(1452) X(8960) X(2048)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GF_SSSE3 // The row kernels have an SSSE3 variant, used if the CPU supports it (see galoisInit())
+#endif
 
 #include "utils.h"
 #include "galois_field.h"
+#include "codingpool.h"
 
 typedef struct matrix_t {
     uint8_t** data;
@@ -30,6 +46,23 @@ typedef struct matrix_t {
     int nColumns;
 } matrix;
 
+typedef struct rowkernels_t { // Row operations on rows of a fixed number of bytes
+    int size;
+    void (*mulSub)(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high); // rowMulSubNibbles()
+    void (*add)(uint8_t* a, uint8_t* b); // rowXor()
+} rowkernels;
+
+typedef struct matmuljob_t { // Band of rows of a product, computed by a coding thread
+    int field;
+    uint8_t** c;
+    uint8_t** a;
+    uint8_t** b;
+    int nRows;
+    int first;
+    int nInner;
+    int nColumns;
+} matmuljob;
+
 
 matrix* mCreate(int rows, int columns);
 
@@ -37,12 +70,24 @@ matrix* getIdentityMatrix(int rows);
 
 matrix* getRandomMatrix(int rows, int columns);
 
+void getCoefficients(int field, uint8_t* vector, int size, uint32_t seed, int nNonZeros);
+
+void getCauchyCoefficients(int field, uint8_t* vector, int size, int repairNo);
+
+void getRangeCoefficients(int field, int isCauchy, uint8_t* vector, int first, int size, uint32_t seed, int nNonZeros, int repairNo);
+
 void mPrint(matrix m);
 
 void mFree(matrix* m);
 
 matrix* mMul(matrix a, matrix b);
 
+matrix* mMulParallel(matrix a, matrix b, codingpool* pool);
+
+void fieldMatMulSub(int field, uint8_t** c, uint8_t** a, uint8_t** b, int nRows, int first, int nInner, int nColumns);
+
+void fieldMatMulSubParallel(codingpool* pool, int field, uint8_t** c, uint8_t** a, uint8_t** b, int nRows, int first, int nInner, int nColumns);
+
 matrix* mCopy(matrix orig);
 
 int mEqual(matrix a, matrix b);
@@ -52,4 +97,16 @@ void mAppendVector(matrix* m, uint8_t* v);
 void rowReduce(uint8_t* row, uint8_t factor, int size);
 
 void rowMulSub(uint8_t* a, uint8_t* b, uint8_t coeff, int size);
+
+void rowXor(uint8_t* a, uint8_t* b, int size);
+
+void rowMulSubNibbles(uint8_t* a, uint8_t* b, uint8_t* low, uint8_t* high, int size);
+
+void fieldRowMulSub(int field, uint8_t* a, uint8_t* b, uint16_t coeff, int size);
+
+rowkernels* getRowKernels(int size);
+
+void fieldRowMulSubKernels(int field, rowkernels* kernels, uint8_t* a, uint8_t* b, uint16_t coeff, int size);
+
+void fieldRowReduce(int field, uint8_t* row, uint16_t factor, int size);
 #endif
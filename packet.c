@@ -19,45 +19,54 @@
 #include "packet.h"
 
 void dataPacketToBuffer(datapacket p, uint8_t* buffer, int* size){
-    uint8_t tmp8;
     uint16_t tmp16;
     uint32_t tmp32;
     
     tmp16 = htons(p.blockNo);
     memcpy(buffer, &tmp16, 2);
-    tmp8 = p.packetNumber;
-    memcpy(buffer + 2, &tmp8, 1);
+    tmp16 = htons(p.packetNumber);
+    memcpy(buffer + 2, &tmp16, 2);
+    tmp16 = htons(p.prevBlockSize);
+    memcpy(buffer + 4, &tmp16, 2);
     tmp32 = htonl(p.seqNo);
-    memcpy(buffer + 3, &tmp32, 4);
+    memcpy(buffer + 6, &tmp32, 4);
+    tmp16 = htons(p.repairNo);
+    memcpy(buffer + 10, &tmp16, 2);
+    tmp16 = htons(p.firstPacket);
+    memcpy(buffer + 12, &tmp16, 2);
     
-    memcpy(buffer + 7, p.payloadAndSize, p.size);
+    memcpy(buffer + DATA_HEADER_LENGTH, p.payloadAndSize, p.size);
     
-    (*size) = 7 + p.size;
+    (*size) = DATA_HEADER_LENGTH + p.size;
 }
 
 datapacket* bufferToData(uint8_t* buffer, int size){
-    uint8_t tmp8;
     uint16_t tmp16;
     uint32_t tmp32;
     datapacket* p = malloc(sizeof(datapacket));
     
     memcpy(&tmp16, buffer, 2);
     p->blockNo = htons(tmp16);
-    memcpy(&tmp8, buffer + 2, 1);
-    p->packetNumber = tmp8;
-    memcpy(&tmp32, buffer + 3, 4);
+    memcpy(&tmp16, buffer + 2, 2);
+    p->packetNumber = ntohs(tmp16);
+    memcpy(&tmp16, buffer + 4, 2);
+    p->prevBlockSize = ntohs(tmp16);
+    memcpy(&tmp32, buffer + 6, 4);
     p->seqNo = ntohl(tmp32);
+    memcpy(&tmp16, buffer + 10, 2);
+    p->repairNo = ntohs(tmp16);
+    memcpy(&tmp16, buffer + 12, 2);
+    p->firstPacket = ntohs(tmp16);
     
-    p->payloadAndSize = malloc((size - 7) * sizeof(uint8_t));
-    memcpy(p->payloadAndSize, buffer + 7, size - 7);
-    p->size = size - 7;
+    p->payloadAndSize = malloc((size - DATA_HEADER_LENGTH) * sizeof(uint8_t));
+    memcpy(p->payloadAndSize, buffer + DATA_HEADER_LENGTH, size - DATA_HEADER_LENGTH);
+    p->size = size - DATA_HEADER_LENGTH;
     
     return p;
 }
 
 void ackPacketToBuffer(ackpacket p, uint8_t* buffer, int* size){
     int i;
-    uint8_t tmp8;
     uint16_t tmp16;
     uint32_t tmp32;
     
@@ -69,26 +78,29 @@ void ackPacketToBuffer(ackpacket p, uint8_t* buffer, int* size){
     memcpy(buffer + 6, &tmp16, 2);
     tmp16 = htons(p.ack_total);
     memcpy(buffer + 8, &tmp16, 2);
-    for(i = 0; i < DOFS_LENGTH; i++){
-        tmp8 = p.ack_dofs[i];
-        memcpy(buffer + 10 + i, &tmp8, 1);
+    memcpy(buffer + 10, &(p.ack_nBlocks), 1);
+    for(i = 0; i < p.ack_nBlocks; i++){
+        tmp16 = htons(p.ack_dofs[i]);
+        memcpy(buffer + ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * i, &tmp16, 2);
+        tmp16 = htons(p.ack_decodedPrefix[i]);
+        memcpy(buffer + ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * i + 2, &tmp16, 2);
     }
     
-    
-    (*size) = 10 + DOFS_LENGTH;
+    (*size) = ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * p.ack_nBlocks;
 }
 
 ackpacket* bufferToAck(uint8_t* buffer, int size){
     int i;
-    if(size != 10 + DOFS_LENGTH){
+    if((size < ACK_HEADER_LENGTH) || (size != ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * buffer[10]) || (buffer[10] > MAX_ACK_BLOCKS)){
         printf("Buffer to ack => size is not what was expected. DIE.\n");
         exit(1);
     }
-    uint8_t tmp8;
     uint16_t tmp16;
     uint32_t tmp32;
     ackpacket* p = malloc(sizeof(ackpacket));
-    p->ack_dofs = malloc(DOFS_LENGTH * sizeof(uint8_t));
+    p->ack_nBlocks = buffer[10];
+    p->ack_dofs = malloc(p->ack_nBlocks * sizeof(uint16_t));
+    p->ack_decodedPrefix = malloc(p->ack_nBlocks * sizeof(uint16_t));
     
     memcpy(&tmp16, buffer, 2);
     p->ack_currBlock = ntohs(tmp16);
@@ -99,9 +111,11 @@ ackpacket* bufferToAck(uint8_t* buffer, int size){
     memcpy(&tmp16, buffer + 8, 2);
     p->ack_total = ntohs(tmp16);
     
-    for(i = 0; i < DOFS_LENGTH; i++){
-        memcpy(&tmp8, buffer + 10 + i, 1);
-        p->ack_dofs[i] = tmp8;
+    for(i = 0; i < p->ack_nBlocks; i++){
+        memcpy(&tmp16, buffer + ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * i, 2);
+        p->ack_dofs[i] = ntohs(tmp16);
+        memcpy(&tmp16, buffer + ACK_HEADER_LENGTH + ACK_BLOCK_LENGTH * i + 2, 2);
+        p->ack_decodedPrefix[i] = ntohs(tmp16);
     }
     
     return p;
@@ -118,8 +132,11 @@ void dataPacketPrint(datapacket p){
         printf("\tIs neither clear or coded... ?!?\n");
     }
     printf("\tPacket No = %u\n", (p.packetNumber & BITMASK_NO));
+    printf("\tPrevious block size = %u\n", p.prevBlockSize);
     
     printf("\tSeq No = %u\n", p.seqNo);
+    printf("\tRepair No = %u\n", p.repairNo);
+    printf("\tFirst packet = %u\n", p.firstPacket);
     printf("\tSize = %d\n", p.size);
     
     printf("\tPayload start : ");
@@ -135,9 +152,24 @@ void ackPacketPrint(ackpacket p){
     printf("AckPacket :\n");
     printf("\tcurrBlock = %u\n", p.ack_currBlock);
     printf("\tAck Seq No = %u\n", p.ack_seqNo);
-    for(i = 0; i < DOFS_LENGTH; i++){
-        printf("\tdofs for block %i = %u\n", i, p.ack_dofs[i]);
+    for(i = 0; i < p.ack_nBlocks; i++){
+        printf("\tdofs for block %i = %u, decoded prefix = %u\n", i, p.ack_dofs[i], p.ack_decodedPrefix[i]);
     }
     printf("\tloss = %u\n", p.ack_loss);
     printf("\ttotal = %u\n", p.ack_total);
 }
+
+// Seed of the coefficients of a coded packet, independent of its seqNo so that the payload may be computed before sending
+uint32_t repairSeed(uint16_t blockNo, uint16_t repairNo){
+    return ((uint32_t)blockNo << 16) | repairNo;
+}
+
+// Number of blocks the encoder may open, and the decoder may keep, ahead of the current block
+int maxBufferedBlocks(int codec, int isHighBdp){
+    int blockBytes = ((codec == CODEC_FOUNTAIN) ? FOUNTAIN_BLKSIZE : BLKSIZE) * PACKETSIZE;
+    
+    if(isHighBdp){
+        return HIGH_BDP_MEMORY / blockBytes;
+    }
+    return (codec == CODEC_FOUNTAIN) ? FOUNTAIN_MAX_BLOCKS : MAX_BLOCKS;
+}
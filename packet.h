@@ -20,26 +20,47 @@
 #define _PACKET_
 
 #include "utils.h"
+#include "fountain.h"
 
-#define FLAG_CLEAR 0b00000000
-#define FLAG_CODED 0b10000000
-#define BITMASK_NO    0b01111111
-#define BITMASK_FLAG  0b10000000
+#define FLAG_CLEAR 0x0000
+#define FLAG_CODED 0x8000
+#define BITMASK_NO    0x7FFF
+#define BITMASK_FLAG  0x8000
 
-#define DOFS_LENGTH 3 // The number of blocks for which we send the number of dofs
+#define CODEC_BLOCK 0x00 // Coded packets combine the packets of one block (generation)
+#define CODEC_SLIDING 0x01 // Coded packets combine every packet not yet delivered to the remote application
+#define CODEC_FOUNTAIN 0x02 // Large generations, coded packets are the XOR of a few packets (LT code)
+
+#define COEFFS_DENSE 0x00 // Every packet of the block/window gets a random coefficient
+#define COEFFS_SPARSE 0x01 // Only a bounded number of packets get a random coefficient
+#define COEFFS_MDS 0x02 // Repair j uses row j of a Cauchy matrix : any set of repairs is innovative
+
+#define MAX_BLOCKS 15 // Maximum number of blocks to store in memory
+#define HIGH_BDP_MEMORY (256 * 1024 * 1024) // In high-BDP mode, blocks are limited by the memory they take instead (bytes, per encoder or decoder)
+#define MAX_ACK_BLOCKS 32 // Largest number of blocks an ACK reports on : covers MAX_BLOCKS in flight. In high-BDP mode, later blocks are not reported
+
+#define DATA_HEADER_LENGTH 14 // blockNo | packetNumber | prevBlockSize | seqNo | repairNo | firstPacket
+#define ACK_HEADER_LENGTH 11 // currBlock | seqNo | loss | total | nBlocks, followed by nBlocks times dofs | decodedPrefix
+#define ACK_BLOCK_LENGTH 4
+#define ACK_MAX_LENGTH (ACK_HEADER_LENGTH + MAX_ACK_BLOCKS * ACK_BLOCK_LENGTH)
 
 typedef struct datapacket_t {
-    uint16_t blockNo; // Block number of the packet
-    uint8_t packetNumber; // Flag (1bit) | Packet index in block (if uncoded), number of packets used for coding (if coded)
+    uint16_t blockNo; // Block number of the packet (CODEC_BLOCK), or index of the first packet in the window (CODEC_SLIDING)
+    uint16_t packetNumber; // Flag (1bit) | Packet index in block (if uncoded), number of packets used for coding (if coded)
+    uint16_t prevBlockSize; // Final number of packets in block blockNo - 1, or 0 if the receiver does not need it anymore
     uint32_t seqNo; // Sequence number (always increment)
+    uint16_t repairNo; // Index of the coded packet in its block : seeds its coefficients with blockNo, or picks its Cauchy row (COEFFS_MDS). 0 for clear packets
+    uint16_t firstPacket; // Coded packets combine packets firstPacket..packetNumber-1 of the block, 0 for clear packets
     uint8_t* payloadAndSize; // uint16 | real payload. Note : the uint16 gets encoded when the rest of the payload is.
     
     int size; // Size of the array payloadAndSize. NOT TRANSMISSIBLE !
 } datapacket;
 
 typedef struct ackpacket_t {
-    uint16_t ack_currBlock; // Smallest undecoded block
-    uint8_t* ack_dofs; // Degrees of freedom recovered for the blocks
+    uint16_t ack_currBlock; // Smallest undecoded block (CODEC_BLOCK), or index of the first packet not delivered yet (CODEC_SLIDING)
+    uint8_t ack_nBlocks; // Number of blocks reported, from ack_currBlock on : the blocks the receiver knows about
+    uint16_t* ack_dofs; // Degrees of freedom recovered for the blocks
+    uint16_t* ack_decodedPrefix; // Packets at the start of the blocks that have been decoded (CODEC_BLOCK)
     uint32_t ack_seqNo; // Sequence Number for the currently acknowledged packet
     uint16_t ack_loss;  // Number of lost packets in the seen set
     uint16_t ack_total; // Total number of packets in the seen set
@@ -53,4 +74,7 @@ void ackPacketPrint(ackpacket p);
 void ackPacketToBuffer(ackpacket p, uint8_t* buffer, int* size);
 ackpacket* bufferToAck(uint8_t* buffer, int size);
 
+int maxBufferedBlocks(int codec, int isHighBdp);
+uint32_t repairSeed(uint16_t blockNo, uint16_t repairNo);
+
 #endif
@@ -0,0 +1,113 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "pathcache.h"
+
+int pathCacheFind(pathcache* cache, struct sockaddr_in remote, struct timeval now);
+
+pathcache* pathCacheInit(){
+    pathcache* ret = malloc(sizeof(pathcache));
+    
+    ret->entries = 0;
+    ret->nEntries = 0;
+    
+    return ret;
+}
+
+void pathCacheFree(pathcache* cache){
+    free(cache->entries);
+    free(cache);
+}
+
+// Index of the metrics of the path to remote, or -1. Expired entries met on the way are removed
+int pathCacheFind(pathcache* cache, struct sockaddr_in remote, struct timeval now){
+    int i;
+    
+    for(i = 0; i < cache->nEntries; i++){
+        if(diffUSec(now, cache->entries[i].updated) > PATH_CACHE_MAX_AGE){
+            do_debug("Path metrics for %s:%d have expired\n", inet_ntoa(*(struct in_addr*)&(cache->entries[i].addr)), ntohs(cache->entries[i].port));
+            cache->entries[i] = cache->entries[cache->nEntries - 1];
+            cache->nEntries--;
+            i--;
+        } else if((cache->entries[i].addr == remote.sin_addr.s_addr) && (cache->entries[i].port == remote.sin_port)){
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Remember what the encoder has learnt about its path, typically when its mux closes
+void pathCacheStore(pathcache* cache, struct sockaddr_in remote, encoderstate state, struct timeval now){
+    int i, index = pathCacheFind(cache, remote, now);
+    
+    if(state.shortTermRttAverage == 0){ // Nothing measured
+        return;
+    }
+    
+    if(index == -1){
+        if(cache->nEntries < PATH_CACHE_SIZE){
+            cache->entries = realloc(cache->entries, (cache->nEntries + 1) * sizeof(pathmetrics));
+            index = cache->nEntries;
+            cache->nEntries++;
+        } else { // Replace the least recently updated path
+            index = 0;
+            for(i = 1; i < cache->nEntries; i++){
+                if(isSooner(cache->entries[i].updated, cache->entries[index].updated)){
+                    index = i;
+                }
+            }
+        }
+        cache->entries[index].addr = remote.sin_addr.s_addr;
+        cache->entries[index].port = remote.sin_port;
+    }
+    
+    cache->entries[index].shortTermRttAverage = state.shortTermRttAverage;
+    cache->entries[index].longTermRttAverage = state.longTermRttAverage;
+    cache->entries[index].rttVariation = state.rttVariation;
+    cache->entries[index].p = state.p;
+    cache->entries[index].congestionWindow = state.congestion->congestionWindow;
+    cache->entries[index].updated = now;
+}
+
+// Start a new encoder from the metrics of its path, if they are known. Returns true if it has been seeded
+int pathCacheSeed(pathcache* cache, struct sockaddr_in remote, encoderstate* state, struct timeval now){
+    int index = pathCacheFind(cache, remote, now);
+    pathmetrics metrics;
+    
+    if(index == -1){
+        return false;
+    }
+    metrics = cache->entries[index];
+    
+    state->shortTermRttAverage = metrics.shortTermRttAverage;
+    state->longTermRttAverage = metrics.longTermRttAverage;
+    state->rttVariation = metrics.rttVariation;
+    state->p = metrics.p;
+    congestionSeed(state->congestion, PATH_CACHE_WINDOW_GAIN * metrics.congestionWindow);
+    do_debug("Encoder seeded from the path metrics : RTT = %f, window = %d\n", state->shortTermRttAverage, congestionWindow(*(state->congestion)));
+    
+    return true;
+}
+
+void pathCachePrint(pathcache cache){
+    int i;
+    printf("Path cache : %d paths\n", cache.nEntries);
+    for(i = 0; i < cache.nEntries; i++){
+        printf("\t%s:%d : RTT = %f, RTT variation = %f, loss = %f, window = %f\n", inet_ntoa(*(struct in_addr*)&(cache.entries[i].addr)), ntohs(cache.entries[i].port), cache.entries[i].shortTermRttAverage, cache.entries[i].rttVariation, cache.entries[i].p, cache.entries[i].congestionWindow);
+    }
+}
@@ -0,0 +1,56 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _PATHCACHE_
+#define _PATHCACHE_
+
+#include "utils.h"
+#include "encoding.h"
+
+#define PATH_CACHE_SIZE 256 // Largest number of paths remembered : the least recently updated one is replaced
+#define PATH_CACHE_MAX_AGE 600000000 // Metrics older than that are forgotten (uSeconds)
+#define PATH_CACHE_WINDOW_GAIN 0.5 // New muxes start at that fraction of the cached window : the path may have changed since
+
+typedef struct pathmetrics_t {
+    uint32_t addr; // UDP endpoint of the path (network order)
+    uint16_t port;
+    
+    double shortTermRttAverage; // Encoder averages when the metrics were stored (uSeconds)
+    double longTermRttAverage;
+    double rttVariation;
+    float p;
+    float congestionWindow;
+    struct timeval updated;
+} pathmetrics;
+
+typedef struct pathcache_t {
+    pathmetrics* entries;
+    int nEntries;
+} pathcache;
+
+pathcache* pathCacheInit();
+
+void pathCacheFree(pathcache* cache);
+
+void pathCacheStore(pathcache* cache, struct sockaddr_in remote, encoderstate state, struct timeval now);
+
+int pathCacheSeed(pathcache* cache, struct sockaddr_in remote, encoderstate* state, struct timeval now);
+
+void pathCachePrint(pathcache cache);
+
+#endif
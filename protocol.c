@@ -26,6 +26,7 @@ void printMux(muxstate mux){
     printf("\tremote_ip = %u\n", mux.remote_ip);
     printf("\tremote udp = %u\n", (unsigned int)mux.udpRemote.sin_addr.s_addr);
     printf("\tRandom ID = %u\n", mux.randomId);
+    printf("\tOptions = %4x\n", mux.options);
     
     switch(mux.state){
         case STATE_INIT:
@@ -45,9 +46,13 @@ void printMux(muxstate mux){
     decoderStatePrint(*(mux.decoderState));
 }
 
-int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t randomId, int sock_fd, muxstate** statesTable, int* tableLength, struct sockaddr_in udpRemoteAddr){
+void applyOptions(muxstate* mux);
+int coupleMux(int index, muxstate* statesTable, int tableLength);
+
+int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t randomId, int sock_fd, muxstate** statesTable, int* tableLength, struct sockaddr_in udpRemoteAddr, uint16_t options, pathcache* pathCache){
     // If the mux is already known, return its index, otherwise create it
     int i;
+    struct timeval currentTime;
     
     for(i=0; i<(*tableLength); i++){
         if(
@@ -72,8 +77,10 @@ int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t rando
     (*statesTable)[(*tableLength) - 1].remote_ip = remote_ip;
     (*statesTable)[(*tableLength) - 1].sock_fd = sock_fd;
     (*statesTable)[(*tableLength) - 1].randomId = randomId;
+    (*statesTable)[(*tableLength) - 1].options = options;
     (*statesTable)[(*tableLength) - 1].encoderState = encoderStateInit();
     (*statesTable)[(*tableLength) - 1].decoderState = decoderStateInit();
+    applyOptions(&((*statesTable)[(*tableLength) - 1]));
     (*statesTable)[(*tableLength) - 1].state = STATE_INIT;
     (*statesTable)[(*tableLength) - 1].localSocketReadState = SOCKET_INIT;
     (*statesTable)[(*tableLength) - 1].localSocketWriteState = SOCKET_INIT;
@@ -85,23 +92,143 @@ int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t rando
     (*statesTable)[(*tableLength) - 1].lastWriteSent.tv_usec = 0;
     (*statesTable)[(*tableLength) - 1].lastOutstandingSent.tv_sec = 1;
     (*statesTable)[(*tableLength) - 1].lastOutstandingSent.tv_usec = 0;
+    (*statesTable)[(*tableLength) - 1].deficit = 0;
     
     memset(&((*statesTable)[(*tableLength) - 1].udpRemote), 0, sizeof((*statesTable)[(*tableLength) - 1].udpRemote));
     (*statesTable)[(*tableLength) - 1].udpRemote.sin_family = AF_INET;
     (*statesTable)[(*tableLength) - 1].udpRemote.sin_addr.s_addr = udpRemoteAddr.sin_addr.s_addr;
     (*statesTable)[(*tableLength) - 1].udpRemote.sin_port = udpRemoteAddr.sin_port;
     
+    // Join the congestion control of the other muxes to the peer, or start from what previous muxes have learnt about the path
+    gettimeofday(&currentTime, NULL);
+    if(coupleMux((*tableLength) - 1, *statesTable, *tableLength)){
+        printf("Encoder coupled with the other muxes to the peer\n");
+    } else if(pathCacheSeed(pathCache, udpRemoteAddr, (*statesTable)[(*tableLength) - 1].encoderState, currentTime)){
+        printf("Encoder seeded from the path metrics\n");
+    }
+    
     //printMux((*statesTable)[(*tableLength) - 1]);
     
     return (*tableLength) - 1;
 }
 
-void removeMux(int index, muxstate** statesTable, int* tableLength){
+// Configure the encoder and decoder of the mux as its options say
+void applyOptions(muxstate* mux){
+    int nNonZeros = SPARSE_MIN_NONZEROS << ((mux->options & BITMASK_OPTIONS_SPARSE) >> SHIFT_OPTIONS_SPARSE);
+    
+    int field = (mux->options & BITMASK_OPTIONS_FIELD) >> SHIFT_OPTIONS_FIELD;
+    int coeffs = (mux->options & BITMASK_OPTIONS_COEFFS) >> SHIFT_OPTIONS_COEFFS;
+    int isHighBdp = (mux->options & BITMASK_OPTIONS_HIGH_BDP) != 0;
+    
+    if((coeffs == COEFFS_MDS) && ((field == FIELD_GF2) || (field == FIELD_GF16))){
+        printf("Cauchy coefficients need at least 256 field elements : use random ones in GF(2^%d)\n", fieldSymbolBits(field));
+        coeffs = COEFFS_DENSE;
+    }
+    
+    mux->encoderState->codec = mux->options & BITMASK_OPTIONS_CODEC;
+    mux->encoderState->coeffs = coeffs;
+    mux->encoderState->sparseNonZeros = nNonZeros;
+    mux->encoderState->field = field;
+    mux->encoderState->congestion->algorithm = (mux->options & BITMASK_OPTIONS_CC) >> SHIFT_OPTIONS_CC;
+    mux->encoderState->congestion->maxWindow = isHighBdp ? HIGH_BDP_MAX_WINDOW : MAX_WINDOW;
+    mux->encoderState->isHighBdp = isHighBdp;
+    
+    mux->decoderState->codec = mux->options & BITMASK_OPTIONS_CODEC;
+    mux->decoderState->coeffs = coeffs;
+    mux->decoderState->sparseNonZeros = nNonZeros;
+    mux->decoderState->field = field;
+    decoderSelectKernels(mux->decoderState);
+    mux->decoderState->isHighBdp = isHighBdp;
+    mux->decoderState->lossBuffer->size = isHighBdp ? HIGH_BDP_LOSS_BUFFER_SIZE : LOSS_BUFFER_SIZE;
+}
+
+// In coupled mode, make the encoder of mux index use the congestion state of another coupled mux to the same peer. Returns true if there was one
+int coupleMux(int index, muxstate* statesTable, int tableLength){
+    int i;
+    muxstate* mux = &(statesTable[index]);
+    
+    if(!(mux->options & BITMASK_OPTIONS_COUPLED)){
+        return false;
+    }
+    for(i = 0; i < tableLength; i++){
+        if(
+            (i != index) &&
+            (statesTable[i].options & BITMASK_OPTIONS_COUPLED) &&
+            (statesTable[i].udpRemote.sin_addr.s_addr == mux->udpRemote.sin_addr.s_addr) &&
+            (statesTable[i].udpRemote.sin_port == mux->udpRemote.sin_port)
+        ){
+            congestionFree(mux->encoderState->congestion);
+            mux->encoderState->congestion = congestionShare(statesTable[i].encoderState->congestion);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Deficit round robin over the data packets the muxes may send : mux i has nReleasable[i] of them, and gets weights[i] quanta
+ * on each round. Fills order with the mux of each packet to send, in sending order, and returns their number. At most budget
+ * bytes are scheduled ; *next is the mux to serve first, and is updated for the next call. */
+int scheduleMuxes(muxstate* statesTable, int tableLength, int* nReleasable, int* weights, int budget, int* next, int* order){
+    int i, k, nOrdered = 0, isBacklogged = true, size;
+    int* nScheduled = calloc(tableLength, sizeof(int));
+    
+    while(isBacklogged && (budget > 0)){
+        isBacklogged = false;
+        for(k = 0; (k < tableLength) && (budget > 0); k++){
+            i = (*next + k) % tableLength;
+            if(nScheduled[i] >= nReleasable[i]){
+                statesTable[i].deficit = 0; // An idle mux does not save up credit
+                continue;
+            }
+            
+            statesTable[i].deficit += weights[i] * SCHEDULER_QUANTUM;
+            while(nScheduled[i] < nReleasable[i]){
+                size = statesTable[i].encoderState->dataToSendSize[nScheduled[i]] + MUX_HEADER_LENGTH;
+                if((size > statesTable[i].deficit) || (size > budget)){
+                    break;
+                }
+                statesTable[i].deficit -= size;
+                budget -= size;
+                order[nOrdered] = i;
+                nOrdered++;
+                nScheduled[i]++;
+            }
+            
+            if(nScheduled[i] == nReleasable[i]){
+                statesTable[i].deficit = 0;
+            } else {
+                isBacklogged = true;
+                if(budget < size){ // Resume with this mux next time
+                    *next = i;
+                    budget = 0;
+                }
+            }
+        }
+    }
+    if((budget > 0) && (tableLength > 0)){
+        *next = (*next + 1) % tableLength; // Do not always start with the same mux
+    }
+    
+    free(nScheduled);
+    return nOrdered;
+}
+
+// Options bits for sparse coefficients, with the largest level that does not exceed nNonZeros
+uint8_t sparseOptions(int nNonZeros){
+    uint8_t level = 0;
+    while((level < (BITMASK_OPTIONS_SPARSE >> SHIFT_OPTIONS_SPARSE)) && ((SPARSE_MIN_NONZEROS << (level + 1)) <= nNonZeros)){
+        level++;
+    }
+    return (COEFFS_SPARSE << SHIFT_OPTIONS_COEFFS) | (level << SHIFT_OPTIONS_SPARSE);
+}
+
+void removeMux(int index, muxstate** statesTable, int* tableLength, pathcache* pathCache){
     if(index >= (*tableLength)){
         my_err("in removeMux : index>= size\n");
         exit(1);
     } else {
         int i;
+        struct timeval currentTime;
         
         if((*statesTable)[index].sock_fd != -1){ // Make sure that the file descriptor really points to something
             if(close((*statesTable)[index].sock_fd) != 0){ // Try to close
@@ -112,6 +239,10 @@ void removeMux(int index, muxstate** statesTable, int* tableLength){
             printf("Removing a Mux whithout opened socket (fd == -1)\n");
         }
         
+        // Remember the path for the next muxes
+        gettimeofday(&currentTime, NULL);
+        pathCacheStore(pathCache, (*statesTable)[index].udpRemote, *((*statesTable)[index].encoderState), currentTime);
+        
         encoderStateFree((*statesTable)[index].encoderState);
         decoderStateFree((*statesTable)[index].decoderState);
         for(i = index; i < ((*tableLength) - 1); i++){
@@ -138,10 +269,14 @@ void bufferToMuxed(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate
     memcpy(dst + 8, &tmp8, 1);
     tmp16 = htons(mux.randomId);
     memcpy(dst + 9, &tmp16, 2);
+    tmp16 = htons(mux.options);
+    memcpy(dst + 11, &tmp16, 2);
+    tmp8 = PROTOCOL_VERSION;
+    memcpy(dst + 13, &tmp8, 1);
     
-    memcpy(dst + 11, src, srcLen);
+    memcpy(dst + MUX_HEADER_LENGTH, src, srcLen);
     
-    (*dstLen) = srcLen + 11;
+    (*dstLen) = srcLen + MUX_HEADER_LENGTH;
 }
 
 int muxedToBuffer(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate* mux, uint8_t* type){
@@ -149,7 +284,12 @@ int muxedToBuffer(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate*
     uint32_t tmp32;
     uint8_t tmp8;
     
-    if(srcLen >= 11){
+    if(srcLen >= MUX_HEADER_LENGTH){
+        memcpy(&tmp8, src + 13, 1);
+        if(tmp8 != PROTOCOL_VERSION){
+            do_debug("Received a packet of protocol version %u while we speak %u. Drop.\n", tmp8, PROTOCOL_VERSION);
+            return false;
+        }
         memcpy(&tmp16, src, 2);
         mux->sport = ntohs(tmp16);
         memcpy(&tmp16, src + 2, 2);
@@ -160,6 +300,8 @@ int muxedToBuffer(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate*
         (*type) = tmp8;
         memcpy(&tmp16, src + 9, 2);
         mux->randomId = ntohs(tmp16);
+        memcpy(&tmp16, src + 11, 2);
+        mux->options = ntohs(tmp16);
         if(  (*type == TYPE_ACK) // Test if the buffer indicates a legitimate type
           || (*type == TYPE_CLOSE)
           || (*type == TYPE_DATA)
@@ -171,8 +313,8 @@ int muxedToBuffer(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate*
           || (*type == TYPE_NO_OUTSTANDING_DATA)
           || (*type == TYPE_NO_OUTSTANDING_DATA_ACK)
         ){
-            memcpy(dst, src + 11, srcLen - 11);
-            (*dstLen) = srcLen - 11;
+            memcpy(dst, src + MUX_HEADER_LENGTH, srcLen - MUX_HEADER_LENGTH);
+            (*dstLen) = srcLen - MUX_HEADER_LENGTH;
             return true;
         } else {
             printf("In protocol.c/muxedToBuffer : We received an incoherent buffer. DIE.\n");
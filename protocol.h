@@ -22,6 +22,7 @@
 #include "packet.h"
 #include "decoding.h"
 #include "encoding.h"
+#include "pathcache.h"
 
 #define TYPE_DATA 0x00
 #define TYPE_ACK 0x01
@@ -45,6 +46,26 @@
 
 #define STATE_RETRANSMIT_TIMEOUT 500000
 
+#define SCHEDULER_QUANTUM 1500 // Bytes credited to a mux of weight 1 on each round of the scheduler
+#define SCHEDULER_BUDGET (64 * 1500) // Bytes of data packets sent per iteration of the loop, for all the muxes
+#define SCHEDULER_DEFAULT_WEIGHT 1
+
+#define MUX_HEADER_LENGTH 14 // sport | dport | remote_ip | type | randomId | options | version
+#define PROTOCOL_VERSION 6 // Both ends must derive the same coefficients : bump when their generation changes
+
+#define BITMASK_OPTIONS_CODEC 0b00000011 // CODEC_BLOCK, CODEC_SLIDING or CODEC_FOUNTAIN
+#define BITMASK_OPTIONS_COEFFS 0b00001100 // COEFFS_DENSE, COEFFS_SPARSE or COEFFS_MDS
+#define SHIFT_OPTIONS_COEFFS 2
+#define BITMASK_OPTIONS_FIELD 0b00110000 // FIELD_GF256, FIELD_GF2, FIELD_GF16 or FIELD_GF65536
+#define SHIFT_OPTIONS_FIELD 4
+#define BITMASK_OPTIONS_SPARSE 0b11000000 // With COEFFS_SPARSE, coded packets have (SPARSE_MIN_NONZEROS << level) non-zero coefficients
+#define SHIFT_OPTIONS_SPARSE 6
+#define SPARSE_MIN_NONZEROS 4
+#define BITMASK_OPTIONS_CC 0x0300 // Congestion control of both encoders : CC_VEGAS or CC_BBR
+#define SHIFT_OPTIONS_CC 8
+#define BITMASK_OPTIONS_HIGH_BDP 0x0400 // Large windows for long fat links : windows up to HIGH_BDP_MAX_WINDOW, buffers up to HIGH_BDP_MEMORY
+#define BITMASK_OPTIONS_COUPLED 0x0800 // The encoders of all the coupled muxes to the same UDP peer share one congestion window
+
 typedef struct muxstate_t {
     int sock_fd;    // local TCP socket
     
@@ -55,6 +76,7 @@ typedef struct muxstate_t {
     struct sockaddr_in udpRemote; // Remote UDP endpoint : either client system or proxy system
     
     uint16_t randomId; // Random connection identifier
+    uint16_t options; // Coding and congestion control options, chosen by the client and adopted by the proxy when it creates the mux
     
     // Encoder and decoder structures
     encoderstate* encoderState;
@@ -75,10 +97,15 @@ typedef struct muxstate_t {
     int localOutstandingData;
     struct timeval lastOutstandingSent;
     
+    long deficit; // Bytes the scheduler still owes the mux in the current round
 } muxstate;
 
-int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t randomId, int sock_fd, muxstate** statesTable, int* tableLength, struct sockaddr_in udpRemoteAddr);
-void removeMux(int i, muxstate** statesTable, int* tableLength);
+int assignMux(uint16_t sport, uint16_t dport, uint32_t remote_ip, uint16_t randomId, int sock_fd, muxstate** statesTable, int* tableLength, struct sockaddr_in udpRemoteAddr, uint16_t options, pathcache* pathCache);
+void removeMux(int i, muxstate** statesTable, int* tableLength, pathcache* pathCache);
+
+uint8_t sparseOptions(int nNonZeros);
+
+int scheduleMuxes(muxstate* statesTable, int tableLength, int* nReleasable, int* weights, int budget, int* next, int* order);
 
 void bufferToMuxed(uint8_t* src, uint8_t* dst, int srcLen, int* dstLen, muxstate mux, uint8_t type);
 
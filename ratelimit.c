@@ -0,0 +1,172 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "ratelimit.h"
+
+clientlimit* findLimit(ratelimiter* limiter, uint32_t addr);
+clientbucket* findBucket(ratelimiter* limiter, struct sockaddr_in client, clientlimit limit, struct timeval now);
+
+ratelimiter* rateLimiterInit(){
+    ratelimiter* ret = malloc(sizeof(ratelimiter));
+    
+    ret->limits = 0;
+    ret->nLimits = 0;
+    ret->buckets = 0;
+    ret->nBuckets = 0;
+    
+    return ret;
+}
+
+void rateLimiterFree(ratelimiter* limiter){
+    free(limiter->limits);
+    free(limiter->buckets);
+    free(limiter);
+}
+
+/* Read the limits from a file, one client per line : <client IP address, or * for the others> <rate in kbit/s> [<burst in bytes>].
+ * Lines starting with # are ignored. Returns false, keeping the previous limits, if the file cannot be used. */
+int rateLimiterLoad(ratelimiter* limiter, char* path){
+    FILE* file;
+    char line[256], address[64];
+    double rate, burst;
+    int nFields, nLimits = 0, lineNo = 0;
+    clientlimit* limits = 0;
+    
+    if((file = fopen(path, "r")) == NULL){
+        perror("In rateLimiterLoad : fopen()");
+        return false;
+    }
+    while(fgets(line, sizeof(line), file) != NULL){
+        lineNo++;
+        nFields = sscanf(line, "%63s %lf %lf", address, &rate, &burst);
+        if((nFields <= 0) || (address[0] == '#')){
+            continue;
+        }
+        if((nFields < 2) || (rate <= 0) || ((strcmp(address, "*") != 0) && (inet_addr(address) == INADDR_NONE))){
+            my_err("%s:%d : expected <client address|*> <rate in kbit/s> [<burst in bytes>]\n", path, lineNo);
+            fclose(file);
+            free(limits);
+            return false;
+        }
+        
+        limits = realloc(limits, (nLimits + 1) * sizeof(clientlimit));
+        limits[nLimits].addr = (strcmp(address, "*") == 0) ? htonl(INADDR_ANY) : inet_addr(address);
+        limits[nLimits].rate = rate * 1000 / 8 / 1000000; // kbit/s to bytes per uSecond
+        limits[nLimits].burst = (nFields == 3) ? burst : limits[nLimits].rate * RATE_LIMIT_BURST_TIME;
+        if(limits[nLimits].burst < RATE_LIMIT_MIN_BURST){
+            limits[nLimits].burst = RATE_LIMIT_MIN_BURST;
+        }
+        nLimits++;
+    }
+    fclose(file);
+    
+    free(limiter->limits);
+    limiter->limits = limits;
+    limiter->nLimits = nLimits;
+    printf("Loaded %d rate limits from %s\n", nLimits, path);
+    return true;
+}
+
+// Limit of the client : its own, or the default one. 0 if it is not limited
+clientlimit* findLimit(ratelimiter* limiter, uint32_t addr){
+    int i;
+    clientlimit* ret = 0;
+    
+    for(i = 0; i < limiter->nLimits; i++){
+        if(limiter->limits[i].addr == addr){
+            return &(limiter->limits[i]);
+        } else if(limiter->limits[i].addr == htonl(INADDR_ANY)){
+            ret = &(limiter->limits[i]);
+        }
+    }
+    return ret;
+}
+
+// Bucket of the client, refilled up to now. Buckets that would be full are forgotten : a new one starts full too
+clientbucket* findBucket(ratelimiter* limiter, struct sockaddr_in client, clientlimit limit, struct timeval now){
+    int i;
+    clientbucket* bucket;
+    clientlimit* bucketLimit;
+    
+    for(i = 0; i < limiter->nBuckets; i++){
+        bucket = &(limiter->buckets[i]);
+        if((bucket->addr == client.sin_addr.s_addr) && (bucket->port == client.sin_port)){
+            bucket->tokens += limit.rate * diffUSec(now, bucket->lastRefill);
+            if(bucket->tokens > limit.burst){
+                bucket->tokens = limit.burst;
+            }
+            bucket->lastRefill = now;
+            return bucket;
+        }
+        
+        bucketLimit = findLimit(limiter, bucket->addr);
+        if((bucketLimit == 0) || (bucket->tokens + bucketLimit->rate * diffUSec(now, bucket->lastRefill) >= bucketLimit->burst)){
+            limiter->buckets[i] = limiter->buckets[limiter->nBuckets - 1];
+            limiter->nBuckets--;
+            i--;
+        }
+    }
+    
+    limiter->buckets = realloc(limiter->buckets, (limiter->nBuckets + 1) * sizeof(clientbucket));
+    bucket = &(limiter->buckets[limiter->nBuckets]);
+    bucket->addr = client.sin_addr.s_addr;
+    bucket->port = client.sin_port;
+    bucket->tokens = limit.burst;
+    bucket->lastRefill = now;
+    limiter->nBuckets++;
+    return bucket;
+}
+
+// True if the client may send that many bytes now
+int rateLimiterAllows(ratelimiter* limiter, struct sockaddr_in client, int bytes, struct timeval now){
+    clientlimit* limit = findLimit(limiter, client.sin_addr.s_addr);
+    
+    if(limit == 0){
+        return true;
+    }
+    return (findBucket(limiter, client, *limit, now)->tokens >= bytes);
+}
+
+// Take the bytes sent by the client from its bucket ; follows a call to rateLimiterAllows()
+void rateLimiterConsume(ratelimiter* limiter, struct sockaddr_in client, int bytes){
+    int i;
+    
+    for(i = 0; i < limiter->nBuckets; i++){
+        if((limiter->buckets[i].addr == client.sin_addr.s_addr) && (limiter->buckets[i].port == client.sin_port)){
+            limiter->buckets[i].tokens -= bytes;
+            return;
+        }
+    }
+}
+
+// When the client's bucket will hold that many bytes, as of the last call to rateLimiterAllows() ; 0 (infinity) if the bucket does not hold it back
+struct timeval rateLimiterNextAllowed(ratelimiter* limiter, struct sockaddr_in client, int bytes){
+    int i;
+    struct timeval ret = {0, 0};
+    clientlimit* limit = findLimit(limiter, client.sin_addr.s_addr);
+    
+    for(i = 0; (i < limiter->nBuckets) && (limit != 0); i++){
+        if((limiter->buckets[i].addr == client.sin_addr.s_addr) && (limiter->buckets[i].port == client.sin_port)){
+            if(limiter->buckets[i].tokens < bytes){
+                ret = limiter->buckets[i].lastRefill;
+                addUSec(&ret, (long)ceil((bytes - limiter->buckets[i].tokens) / limit->rate));
+            }
+        }
+    }
+    return ret;
+}
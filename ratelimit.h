@@ -0,0 +1,59 @@
+/* Copyright 2013 Gregoire Delannoy
+ * 
+ * This file is a part of TCPeP.
+ * 
+ * TCPeP is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef _RATELIMIT_
+#define _RATELIMIT_
+
+#include "utils.h"
+
+#define RATE_LIMIT_MIN_BURST (4 * PACKETSIZE) // Buckets hold at least that many bytes, so that full packets always get through eventually
+#define RATE_LIMIT_BURST_TIME 100000 // Without an explicit burst, a bucket holds that long of traffic at its rate (uSeconds)
+
+typedef struct clientlimit_t {
+    uint32_t addr; // Client address (network order), INADDR_ANY for the clients without a limit of their own
+    double rate; // Bytes per uSecond
+    double burst; // Bucket size (bytes)
+} clientlimit;
+
+typedef struct clientbucket_t {
+    uint32_t addr; // Client UDP endpoint (network order) : all its muxes draw from the bucket
+    uint16_t port;
+    double tokens; // Bytes the client may send now
+    struct timeval lastRefill;
+} clientbucket;
+
+typedef struct ratelimiter_t {
+    clientlimit* limits; // From the configuration file ; no limit at all if empty
+    int nLimits;
+    clientbucket* buckets;
+    int nBuckets;
+} ratelimiter;
+
+ratelimiter* rateLimiterInit();
+
+void rateLimiterFree(ratelimiter* limiter);
+
+int rateLimiterLoad(ratelimiter* limiter, char* path);
+
+int rateLimiterAllows(ratelimiter* limiter, struct sockaddr_in client, int bytes, struct timeval now);
+
+void rateLimiterConsume(ratelimiter* limiter, struct sockaddr_in client, int bytes);
+
+struct timeval rateLimiterNextAllowed(ratelimiter* limiter, struct sockaddr_in client, int bytes);
+
+#endif
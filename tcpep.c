@@ -28,6 +28,17 @@ void usage(void) {
     fprintf(stderr, "-C <proxy IP address>: Client mode\n");
     fprintf(stderr, "-t <TCP port to listen on> (client only)\n");
     fprintf(stderr, "-u <UDP port to use>\n");
+    fprintf(stderr, "-c <block|sliding|fountain>: Coding scheme, block-based, sliding window or LT fountain code for bulk transfers (client only, default block)\n");
+    fprintf(stderr, "-s <non-zeros>: Sparse coding, with at most that many packets combined in a coded packet (client only, %d, %d, %d or %d)\n", SPARSE_MIN_NONZEROS, SPARSE_MIN_NONZEROS << 1, SPARSE_MIN_NONZEROS << 2, SPARSE_MIN_NONZEROS << 3);
+    fprintf(stderr, "-f <2|16|256|65536>: Size of the coding field ; 2 is XOR only, 16 suits slow CPUs, 65536 makes useless repairs rarer, at twice the coefficient bytes (client only, default 256)\n");
+    fprintf(stderr, "-a <vegas|bbr>: Congestion control, delay-based or BBR-like rate-based for lossy high bandwidth-delay paths (client only, default vegas)\n");
+    fprintf(stderr, "-m: MDS coding, repairs use the rows of a Cauchy matrix instead of random coefficients (client only)\n");
+    fprintf(stderr, "-S: Shared congestion control, the connections to the proxy draw from one window instead of competing (client only)\n");
+    fprintf(stderr, "-w <port>:<weight>: Scheduler weight of the connections to that server port, e.g. 22:8 to favour SSH over bulk transfers (repeatable, default weight %d)\n", SCHEDULER_DEFAULT_WEIGHT);
+    fprintf(stderr, "-l <file>: Rate limits of the clients, read again on SIGHUP. One client per line : <IP address|*> <kbit/s> [<burst bytes>] (proxy)\n");
+    fprintf(stderr, "-n <workers>: Proxy threads sharing the UDP port, each serving its own clients (proxy, 1 to %d, default 1)\n", MAX_WORKERS);
+    fprintf(stderr, "-j <threads>: Coding threads per loop, generating the coded packets of a window and reducing the waiting generations in parallel (0 to %d, default 0 : code in the loop thread)\n", MAX_CODING_THREADS);
+    fprintf(stderr, "-H: High bandwidth-delay mode, windows up to %d packets and %d MB of buffered blocks per direction (client only)\n", HIGH_BDP_MAX_WINDOW, HIGH_BDP_MEMORY >> 20);
     exit(1);
 }
 
@@ -39,7 +50,7 @@ int main(int argc, char *argv[]) {
     
     /* Check command line options */
     progname = argv[0];
-    while((option = getopt(argc, argv, "hPp:C:t:u:")) > 0) {
+    while((option = getopt(argc, argv, "hPp:C:t:u:c:s:mf:a:HSw:l:n:j:")) > 0) {
         switch(option) {
             case 'h':
                 usage();
@@ -57,6 +68,87 @@ int main(int argc, char *argv[]) {
             case 'u':
                 globalState->udpPort = atoi(optarg);
                 break;
+            case 'c':
+                globalState->muxOptions &= ~BITMASK_OPTIONS_CODEC;
+                if(strcmp(optarg, "sliding") == 0){
+                    globalState->muxOptions |= CODEC_SLIDING;
+                } else if(strcmp(optarg, "block") == 0){
+                    globalState->muxOptions |= CODEC_BLOCK;
+                } else if(strcmp(optarg, "fountain") == 0){
+                    globalState->muxOptions |= CODEC_FOUNTAIN;
+                } else {
+                    my_err("Unknown coding scheme %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 's':
+                globalState->muxOptions &= ~(BITMASK_OPTIONS_COEFFS | BITMASK_OPTIONS_SPARSE);
+                globalState->muxOptions |= sparseOptions(atoi(optarg));
+                // Only the SPARSE_MIN_NONZEROS << level counts fit in the options
+                if((SPARSE_MIN_NONZEROS << ((globalState->muxOptions & BITMASK_OPTIONS_SPARSE) >> SHIFT_OPTIONS_SPARSE)) != atoi(optarg)){
+                    my_err("Bad number of non-zeros %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'f':
+                globalState->muxOptions &= ~BITMASK_OPTIONS_FIELD;
+                if(strcmp(optarg, "2") == 0){
+                    globalState->muxOptions |= FIELD_GF2 << SHIFT_OPTIONS_FIELD;
+                } else if(strcmp(optarg, "16") == 0){
+                    globalState->muxOptions |= FIELD_GF16 << SHIFT_OPTIONS_FIELD;
+                } else if(strcmp(optarg, "256") == 0){
+                    globalState->muxOptions |= FIELD_GF256 << SHIFT_OPTIONS_FIELD;
+                } else if(strcmp(optarg, "65536") == 0){
+                    globalState->muxOptions |= FIELD_GF65536 << SHIFT_OPTIONS_FIELD;
+                } else {
+                    my_err("Unknown field size %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'a':
+                globalState->muxOptions &= ~BITMASK_OPTIONS_CC;
+                if(strcmp(optarg, "vegas") == 0){
+                    globalState->muxOptions |= CC_VEGAS << SHIFT_OPTIONS_CC;
+                } else if(strcmp(optarg, "bbr") == 0){
+                    globalState->muxOptions |= CC_BBR << SHIFT_OPTIONS_CC;
+                } else {
+                    my_err("Unknown congestion control %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'm':
+                globalState->muxOptions &= ~(BITMASK_OPTIONS_COEFFS | BITMASK_OPTIONS_SPARSE);
+                globalState->muxOptions |= COEFFS_MDS << SHIFT_OPTIONS_COEFFS;
+                break;
+            case 'H':
+                globalState->muxOptions |= BITMASK_OPTIONS_HIGH_BDP;
+                break;
+            case 'S':
+                globalState->muxOptions |= BITMASK_OPTIONS_COUPLED;
+                break;
+            case 'w':
+                addPortWeight(globalState, optarg);
+                break;
+            case 'l':
+                globalState->rateLimitPath = optarg;
+                if(!rateLimiterLoad(globalState->rateLimiter, optarg)){
+                    usage();
+                }
+                break;
+            case 'n':
+                globalState->nWorkers = atoi(optarg);
+                if((globalState->nWorkers < 1) || (globalState->nWorkers > MAX_WORKERS)){
+                    my_err("Bad number of workers %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'j':
+                globalState->nCodingThreads = atoi(optarg);
+                if((globalState->nCodingThreads < 0) || (globalState->nCodingThreads > MAX_CODING_THREADS)){
+                    my_err("Bad number of coding threads %s\n", optarg);
+                    usage();
+                }
+                break;
             default:
                 my_err("Unknown option %c\n", option);
                 usage();
@@ -80,6 +172,9 @@ int main(int argc, char *argv[]) {
     } else if(globalState->udpPort == 0 || (globalState->cliproxy == CLIENT && globalState->tcpListenerPort == 0 )){
         my_err("Must specify port numbers\n");
         usage();
+    } else if((globalState->cliproxy == CLIENT) && (globalState->nWorkers > 1)){
+        my_err("Workers are for the proxy only\n");
+        usage();
     }
     
     /* SIGPIPE will be generated by faulty write(). However, we'd rather handle the EPIPE error locally, so we ignore the global SIGPIPE signal */
@@ -88,6 +183,9 @@ int main(int argc, char *argv[]) {
     /* Initialize the network : create and bind sockets */
     initializeNetwork(globalState);
     
+    /* Start the other proxy workers, this thread is the first one */
+    startWorkers(globalState);
+    
     /* Start the infinite loop */
     infiniteWaitLoop(globalState);
     
@@ -27,6 +27,10 @@
 #include "encoding.h"
 #include "decoding.h"
 #include "protocol.h"
+#include "fountain.h"
+#include "ratelimit.h"
+#include "looper.h"
+#include "congestion.h"
 
 
 #define CLEAR_PACKETS 1000
@@ -194,6 +198,1382 @@ int codingTest(){
     return true;
 }
 
+/* Push nRounds chunks of a known byte stream through the encoder and decoder over a lossy link,
+ * pausing gapUSec between chunks, and check that the application receives the exact stream back.
+ * With isRowInput, the chunks are written into the rows from getInputRows(), as the looper reads them. */
+int codingSessionTest(encoderstate* encState, decoderstate* decState, int nRounds, int chunkSize, long gapUSec, int isRowInput){
+    uint8_t inputBuffer[INPUT_LENGTH], buf1[2 * PACKETSIZE], buf2[2 * PACKETSIZE], type;
+    int i, j, k, buf1Len, buf2Len, isOk = true, nRows, taken, len;
+    long totalIn = 0, totalOut = 0;
+    struct iovec rows[READ_MAX_ROWS];
+    muxstate mState;
+    mState.sport = 10; mState.dport = 10; mState.remote_ip = 10;
+    
+    for(i = 0; (i < nRounds) || ((i < nRounds + 500) && (totalOut < totalIn)); i++){
+        if((i < nRounds) && isMoreDataOk(*encState) && isRowInput){
+            nRows = getInputRows(encState, rows, READ_MAX_ROWS);
+            for(j = 0, taken = 0; (j < nRows) && (taken < chunkSize); j++){
+                len = (chunkSize - taken < rows[j].iov_len) ? chunkSize - taken : rows[j].iov_len;
+                for(k = 0; k < len; k++){
+                    ((uint8_t*)rows[j].iov_base)[k] = (uint8_t)((totalIn + taken + k) % 251);
+                }
+                taken += len;
+            }
+            handleInRows(encState, taken);
+            totalIn += taken;
+        } else if((i < nRounds) && isMoreDataOk(*encState)){
+            for(k = 0; k < chunkSize; k++){
+                inputBuffer[k] = (uint8_t)((totalIn + k) % 251);
+            }
+            totalIn += handleInClear(encState, inputBuffer, chunkSize);
+        } else if(i >= nRounds){
+            usleep(COMPUTING_DELAY); // Let the packets in flight expire
+            onTimeOut(encState); // Flush what is left
+        }
+        
+        for(j = 0; j < decState->nAckToSend; j++){
+            bufferToMuxed(decState->ackToSend[j], buf1, decState->ackToSendSize[j], &buf1Len, mState, TYPE_ACK);
+            muxedToBuffer(buf1, buf2, buf1Len, &buf2Len, &mState, &type);
+            if(((1.0 * random())/RAND_MAX) > LOSS){
+                onAck(encState, buf2, buf2Len);
+            }
+            free(decState->ackToSend[j]);
+        }
+        free(decState->ackToSend);
+        decState->ackToSend = 0;
+        free(decState->ackToSendSize);
+        decState->ackToSendSize = 0;
+        decState->nAckToSend = 0;
+        
+        for(j = 0; j < encState->nDataToSend; j++){
+            bufferToMuxed(encState->dataToSend[j], buf1, encState->dataToSendSize[j], &buf1Len, mState, TYPE_DATA);
+            muxedToBuffer(buf1, buf2, buf1Len, &buf2Len, &mState, &type);
+            if(((1.0 * random())/RAND_MAX) > LOSS){
+                handleInCoded(decState, buf2, buf2Len);
+            }
+            free(encState->dataToSend[j]);
+        }
+        free(encState->dataToSend);
+        encState->dataToSend = 0;
+        free(encState->dataToSendSize);
+        encState->dataToSendSize = 0;
+        encState->nDataToSend = 0;
+        
+        for(k = 0; k < decState->nDataToSend; k++){
+            if(decState->dataToSend[k] != (uint8_t)((totalOut + k) % 251)){
+                isOk = false;
+            }
+        }
+        totalOut += decState->nDataToSend;
+        if(decState->nDataToSend > 0){
+            free(decState->dataToSend);
+            decState->dataToSend = 0;
+            decState->nDataToSend = 0;
+        }
+        
+        if((gapUSec > 0) && (i < nRounds)){
+            usleep(gapUSec);
+        }
+    }
+    
+    if(!isOk){
+        printf("Decoded stream differs from the input stream\n");
+    }
+    if(totalOut != totalIn){
+        printf("Only %ld bytes out of %ld have been decoded\n", totalOut, totalIn);
+        isOk = false;
+    }
+    
+    if(decState->stats_nCoded > 0){
+        decoderStatePrint(*decState);
+    }
+    encoderStateFree(encState);
+    decoderStateFree(decState);
+    return isOk;
+}
+
+int adaptiveGenerationTest(){
+    int isOk = true;
+    
+    // Bulk : generations grow with the throughput
+    isOk = isOk && codingSessionTest(encoderStateInit(), decoderStateInit(), 2000, PACKETSIZE - 20, 0, false);
+    // Sparse : the generation gets closed every time the application goes idle
+    isOk = isOk && codingSessionTest(encoderStateInit(), decoderStateInit(), 20, 3 * PACKETSIZE / 2, 2 * IDLE_CLOSE_DELAY, false);
+    // ... and so it does when the looper reads the application's data straight into the rows
+    isOk = isOk && codingSessionTest(encoderStateInit(), decoderStateInit(), 20, 3 * PACKETSIZE / 2, 2 * IDLE_CLOSE_DELAY, true);
+    
+    if(!isOk){
+        printf("Adaptive generation test failed\n");
+    }
+    return isOk;
+}
+
+int slidingWindowTest(){
+    encoderstate* encState = encoderStateInit();
+    decoderstate* decState = decoderStateInit();
+    int size = (BLKSIZE + 10) * PACKETSIZE, taken;
+    uint8_t* data = calloc(size, sizeof(uint8_t));
+    encState->codec = CODEC_SLIDING;
+    decState->codec = CODEC_SLIDING;
+    
+    if(!codingSessionTest(encState, decState, 2000, PACKETSIZE - 20, 0, false)){
+        printf("Sliding window test failed\n");
+        free(data);
+        return false;
+    }
+    
+    // More than a window at once : the encoder takes what fits and leaves the rest to the caller
+    encState = encoderStateInit();
+    encState->codec = CODEC_SLIDING;
+    taken = handleInClear(encState, data, size);
+    encoderStateFree(encState);
+    free(data);
+    if((taken <= 0) || (taken >= size)){
+        printf("Sliding window test failed : %d bytes of %d taken by a full window\n", taken, size);
+        return false;
+    }
+    return true;
+}
+
+int sparseCodingTest(){
+    int isOk = true, codec;
+    encoderstate* encState;
+    decoderstate* decState;
+    
+    for(codec = CODEC_BLOCK; codec <= CODEC_SLIDING; codec++){
+        encState = encoderStateInit();
+        decState = decoderStateInit();
+        encState->codec = codec;
+        decState->codec = codec;
+        encState->coeffs = COEFFS_SPARSE;
+        decState->coeffs = COEFFS_SPARSE;
+        encState->sparseNonZeros = SPARSE_MIN_NONZEROS;
+        decState->sparseNonZeros = SPARSE_MIN_NONZEROS;
+        isOk = isOk && codingSessionTest(encState, decState, 2000, PACKETSIZE - 20, 0, false);
+    }
+    
+    if(!isOk){
+        printf("Sparse coding test failed\n");
+    }
+    return isOk;
+}
+
+/* Any k rows mixing clear packets and Cauchy repairs must have rank k */
+int isFullRank(matrix* m){
+    int i, j, pivot;
+    uint8_t* tmp;
+    
+    for(i = 0; i < m->nColumns; i++){
+        for(pivot = i; (pivot < m->nRows) && (m->data[pivot][i] == 0); pivot++);
+        if(pivot == m->nRows){
+            return false;
+        }
+        tmp = m->data[i]; m->data[i] = m->data[pivot]; m->data[pivot] = tmp;
+        rowReduce(m->data[i], m->data[i][i], m->nColumns);
+        for(j = i + 1; j < m->nRows; j++){
+            rowMulSub(m->data[j], m->data[i], m->data[j][i], m->nColumns);
+        }
+    }
+    return true;
+}
+
+int mdsCodingTest(){
+    int isOk = true, sizes[3] = {MIN_BLKSIZE, 32, BLKSIZE}, k, trial, i, nLost, repairNo;
+    uint8_t first[MAX_COEFFS_BYTES], wrapped[MAX_COEFFS_BYTES];
+    matrix* m;
+    encoderstate* encState;
+    decoderstate* decState;
+    
+    for(k = 0; k < 3; k++){
+        for(trial = 0; trial < 20; trial++){
+            m = mCreate(sizes[k], sizes[k]);
+            nLost = 0;
+            for(i = 0; i < sizes[k]; i++){
+                if(random() % 2){ // Lost : replaced by the next repair, starting from an arbitrary one
+                    repairNo = (7 * trial + nLost) % CAUCHY_ROWS;
+                    getCauchyCoefficients(FIELD_GF256, m->data[i], sizes[k], repairNo);
+                    nLost++;
+                } else {
+                    m->data[i][i] = 1;
+                }
+            }
+            if(!isFullRank(m)){
+                printf("MDS test : %d repairs for %d packets are not enough\n", nLost, sizes[k]);
+                isOk = false;
+            }
+            mFree(m);
+        }
+    }
+    
+    // Past the distinct Cauchy rows, repairs do not repeat the first ones
+    getRangeCoefficients(FIELD_GF256, true, first, 0, BLKSIZE, repairSeed(0, 0), 0, 0);
+    getRangeCoefficients(FIELD_GF256, true, wrapped, 0, BLKSIZE, repairSeed(0, CAUCHY_ROWS), 0, CAUCHY_ROWS);
+    if(memcmp(first, wrapped, BLKSIZE) == 0){
+        printf("MDS test : repair %d repeats repair 0\n", CAUCHY_ROWS);
+        isOk = false;
+    }
+    
+    encState = encoderStateInit();
+    decState = decoderStateInit();
+    encState->coeffs = COEFFS_MDS;
+    decState->coeffs = COEFFS_MDS;
+    isOk = isOk && codingSessionTest(encState, decState, 2000, PACKETSIZE - 20, 0, false);
+    
+    if(!isOk){
+        printf("MDS coding test failed\n");
+    }
+    return isOk;
+}
+
+int fountainCodingTest(){
+    int isOk = true, k = FOUNTAIN_BLKSIZE, i, j, degree, nSymbols = 0, nLost = 0;
+    int neighbours[FOUNTAIN_BLKSIZE];
+    uint8_t symbol[PACKETSIZE];
+    matrix* source = getRandomMatrix(k, PACKETSIZE);
+    fountaindecoder* decoder = fountainDecoderInit();
+    degreedistribution* degrees = degreeDistributionInit();
+    encoderstate* encState;
+    decoderstate* decState;
+    
+    // ~~ A whole generation : clear packets with losses, then repairs ~~
+    for(i = 0; i < k; i++){
+        if(((1.0 * random())/RAND_MAX) > LOSS){
+            fountainAddSymbol(decoder, &i, 1, source->data[i]);
+        } else {
+            nLost++;
+        }
+    }
+    while((decoder->nDecoded < k) && (nSymbols < 2 * k)){
+        degree = getFountainNeighbours(neighbours, k, nSymbols, degrees);
+        memset(symbol, 0, PACKETSIZE);
+        for(j = 0; j < degree; j++){
+            rowXor(symbol, source->data[neighbours[j]], PACKETSIZE);
+        }
+        fountainAddSymbol(decoder, neighbours, degree, symbol);
+        nSymbols++;
+    }
+    printf("Fountain : %d packets decoded, %d lost and recovered with %d repairs\n", decoder->nDecoded, nLost, nSymbols);
+    if(decoder->nDecoded < k){
+        isOk = false;
+    }
+    for(i = 0; (i < k) && isOk; i++){
+        if(memcmp(decoder->data[i], source->data[i], PACKETSIZE) != 0){
+            printf("Fountain : packet %d decoded wrong\n", i);
+            isOk = false;
+        }
+    }
+    fountainDecoderFree(decoder);
+    degreeDistributionFree(degrees);
+    mFree(source);
+    
+    // ~~ Through the encoder and decoder ~~
+    encState = encoderStateInit();
+    decState = decoderStateInit();
+    encState->codec = CODEC_FOUNTAIN;
+    decState->codec = CODEC_FOUNTAIN;
+    isOk = isOk && codingSessionTest(encState, decState, 2000, PACKETSIZE - 20, 0, false);
+    
+    if(!isOk){
+        printf("Fountain coding test failed\n");
+    }
+    return isOk;
+}
+
+int fieldCodingTest(){
+    int isOk = true, fields[4] = {FIELD_GF2, FIELD_GF16, FIELD_GF256, FIELD_GF65536}, f, codec, i;
+    uint16_t a, b, mask;
+    uint8_t row[4];
+    encoderstate* encState;
+    decoderstate* decState;
+    
+    galoisInit();
+    for(f = 0; f < 4; f++){
+        // ~~ Arithmetic : (a * b) / b = a, and packed symbols do not overlap ~~
+        mask = (1 << fieldSymbolBits(fields[f])) - 1;
+        for(i = 0; i < 1000; i++){
+            a = random() & mask;
+            b = fieldCoefficient(fields[f], random());
+            if((b != 0) && (fieldDiv(fields[f], fieldMul(fields[f], a, b), b) != a)){
+                printf("GF(2^%d) : (%x * %x) / %x != %x\n", fieldSymbolBits(fields[f]), a, b, b, a);
+                isOk = false;
+            }
+            memset(row, 0, 4);
+            fieldSet(fields[f], row, 1, a);
+            if((fieldGet(fields[f], row, 1) != a) || (fieldGet(fields[f], row, 0) != 0)){
+                printf("GF(2^%d) : symbol %x not stored properly\n", fieldSymbolBits(fields[f]), a);
+                isOk = false;
+            }
+        }
+        
+        // ~~ Coding sessions ~~
+        for(codec = CODEC_BLOCK; codec <= CODEC_SLIDING; codec++){
+            encState = encoderStateInit();
+            decState = decoderStateInit();
+            encState->codec = codec;
+            decState->codec = codec;
+            encState->field = fields[f];
+            decState->field = fields[f];
+            decoderSelectKernels(decState);
+            isOk = isOk && codingSessionTest(encState, decState, 1000, PACKETSIZE - 20, 0, false);
+        }
+    }
+    
+    if(!isOk){
+        printf("Field coding test failed\n");
+    }
+    return isOk;
+}
+
+int coefficientGeneratorTest(){
+    int isOk = true, i;
+    long before, after;
+    uint8_t a[MAX_COEFFS_BYTES], b[MAX_COEFFS_BYTES], buf1[100], buf2[100], type;
+    int buf1Len, buf2Len;
+    muxstate mState;
+    
+    // ~~ Same seed, same row ; the libc PRNG is left alone ~~
+    srandom(42);
+    before = random();
+    srandom(42);
+    getCoefficients(FIELD_GF256, a, BLKSIZE, 1234, 0);
+    after = random();
+    getCoefficients(FIELD_GF256, b, BLKSIZE, 1234, 0);
+    if((before != after) || (memcmp(a, b, BLKSIZE) != 0)){
+        printf("Coefficients are not reproducible, or clobber random()\n");
+        isOk = false;
+    }
+    for(i = 0; i < BLKSIZE; i++){
+        if(a[i] == 0){
+            printf("Zero coefficient at %d\n", i);
+            isOk = false;
+        }
+    }
+    getCoefficients(FIELD_GF256, b, BLKSIZE, 1235, 0);
+    if(memcmp(a, b, BLKSIZE) == 0){
+        printf("Different seeds give the same coefficients\n");
+        isOk = false;
+    }
+    
+    // ~~ Packets from another protocol version are dropped ~~
+    mState.sport = 10; mState.dport = 10; mState.remote_ip = 10; mState.randomId = 1; mState.options = 0;
+    bufferToMuxed(a, buf1, 10, &buf1Len, mState, TYPE_DATA);
+    buf1[MUX_HEADER_LENGTH - 1] = PROTOCOL_VERSION + 1;
+    if(muxedToBuffer(buf1, buf2, buf1Len, &buf2Len, &mState, &type)){
+        printf("A packet of another protocol version has been accepted\n");
+        isOk = false;
+    }
+    
+    if(!isOk){
+        printf("Coefficient generator test failed\n");
+    }
+    return isOk;
+}
+
+/* The receiver acknowledges the packets it decoded ; repairs over the rest of the block must complete it */
+int rangeCodingTest(){
+    int isOk = true, k = 40, prefix = 25, fields[4] = {FIELD_GF2, FIELD_GF16, FIELD_GF256, FIELD_GF65536}, f, n, i, bufLen;
+    uint16_t size = htons(PACKETSIZE - 2);
+    uint8_t buffer[PACKETSIZE + 100], coeffs[MAX_COEFFS_BYTES];
+    datapacket packet;
+    ackpacket* ack;
+    matrix* source = getRandomMatrix(k, PACKETSIZE);
+    decoderstate* decState;
+    
+    for(i = 0; i < k; i++){
+        memcpy(source->data[i], &size, 2);
+    }
+    
+    for(f = 0; f < 4; f++){
+        decState = decoderStateInit();
+        decState->field = fields[f];
+        decoderSelectKernels(decState);
+        packet.blockNo = 0;
+        packet.prevBlockSize = 0;
+        packet.repairNo = 0;
+        packet.size = PACKETSIZE;
+        packet.payloadAndSize = malloc(PACKETSIZE);
+        
+        // Clear packets 0..prefix-1 only
+        for(n = 0; n < prefix; n++){
+            packet.packetNumber = n | FLAG_CLEAR;
+            packet.seqNo = n;
+            packet.firstPacket = 0;
+            memcpy(packet.payloadAndSize, source->data[n], PACKETSIZE);
+            dataPacketToBuffer(packet, buffer, &bufLen);
+            handleInCoded(decState, buffer, bufLen);
+        }
+        ack = bufferToAck(decState->ackToSend[decState->nAckToSend - 1], decState->ackToSendSize[decState->nAckToSend - 1]);
+        if(ack->ack_decodedPrefix[0] != prefix){
+            printf("Decoded prefix is %u instead of %d in GF(2^%d)\n", ack->ack_decodedPrefix[0], prefix, fieldSymbolBits(fields[f]));
+            isOk = false;
+        }
+        free(ack->ack_dofs);
+        free(ack->ack_decodedPrefix);
+        free(ack);
+        
+        // Repairs over the suffix only, until the block decodes
+        for(n = prefix; (n < 4 * k) && (decState->nDataToSend < k * (PACKETSIZE - 2)); n++){
+            packet.packetNumber = k | FLAG_CODED;
+            packet.seqNo = n;
+            packet.firstPacket = prefix;
+            packet.repairNo = n - prefix;
+            getRangeCoefficients(fields[f], false, coeffs, prefix, k, repairSeed(packet.blockNo, packet.repairNo), 0, 0);
+            memset(packet.payloadAndSize, 0, PACKETSIZE);
+            for(i = prefix; i < k; i++){
+                fieldRowMulSub(fields[f], packet.payloadAndSize, source->data[i], fieldGet(fields[f], coeffs, i), PACKETSIZE);
+            }
+            dataPacketToBuffer(packet, buffer, &bufLen);
+            handleInCoded(decState, buffer, bufLen);
+        }
+        if((decState->nDataToSend != k * (PACKETSIZE - 2)) || (memcmp(decState->dataToSend + prefix * (PACKETSIZE - 2), source->data[prefix] + 2, PACKETSIZE - 2) != 0)){
+            printf("Repairs over the undecoded suffix did not decode the block in GF(2^%d)\n", fieldSymbolBits(fields[f]));
+            isOk = false;
+        }
+        
+        free(packet.payloadAndSize);
+        decoderStateFree(decState);
+    }
+    mFree(source);
+    
+    if(!isOk){
+        printf("Range coding test failed\n");
+    }
+    return isOk;
+}
+
+/* ACKs report on as many blocks as the encoder may have in flight */
+int ackPacketTest(){
+    int isOk = true, i, bufLen;
+    uint8_t buffer[ACK_MAX_LENGTH];
+    uint16_t dofs[MAX_BLOCKS], prefixes[MAX_BLOCKS];
+    ackpacket ack, *received;
+    
+    for(i = 0; i < MAX_BLOCKS; i++){
+        dofs[i] = 100 + i;
+        prefixes[i] = i;
+    }
+    ack.ack_currBlock = 65530;
+    ack.ack_seqNo = 123456;
+    ack.ack_loss = 3;
+    ack.ack_total = 50;
+    ack.ack_nBlocks = MAX_BLOCKS;
+    ack.ack_dofs = dofs;
+    ack.ack_decodedPrefix = prefixes;
+    
+    ackPacketToBuffer(ack, buffer, &bufLen);
+    received = bufferToAck(buffer, bufLen);
+    if((bufLen != ACK_HEADER_LENGTH + MAX_BLOCKS * ACK_BLOCK_LENGTH) || (received->ack_nBlocks != MAX_BLOCKS) || (received->ack_currBlock != 65530) || (received->ack_seqNo != 123456)){
+        isOk = false;
+    }
+    for(i = 0; i < MAX_BLOCKS; i++){
+        if((received->ack_dofs[i] != dofs[i]) || (received->ack_decodedPrefix[i] != prefixes[i])){
+            isOk = false;
+        }
+    }
+    free(received->ack_dofs);
+    free(received->ack_decodedPrefix);
+    free(received);
+    
+    if(!isOk){
+        printf("ACK packet test failed\n");
+    }
+    return isOk;
+}
+
+/* BBR state machine on a path of constant rate and RTT : startup, drain, then the probe bandwidth gain cycle,
+ * and a PROBE_RTT at a 4 packets window once the min RTT is older than BBR_MIN_RTT_WINDOW */
+int bbrStateTest(){
+    int isOk = true, i, modes[4] = {0, 0, 0, 0}, rtt = 20000, previousMode;
+    double rate = 0.01, gains[BBR_GAIN_CYCLE]; // packets per uSecond
+    uint32_t seqNo = 0;
+    struct timeval now;
+    congestionstate* cc = congestionInit(CC_BBR);
+    
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+    if((cc->mode != BBR_STARTUP) || (congestionPacingRate(*cc) != 0)){
+        printf("BBR does not start in startup, without a pacing rate\n");
+        isOk = false;
+    }
+    
+    // ~~ Startup, drain, probe bandwidth : each mode is entered once, in that order ~~
+    previousMode = cc->mode;
+    for(i = 0; (i < 20000) && isOk; i++, seqNo++){
+        addUSec(&now, (long)(1 / rate));
+        congestionOnSend(cc, seqNo + congestionWindow(*cc));
+        congestionOnAck(cc, seqNo, rtt, rtt, rtt, now);
+        if(cc->mode != previousMode){
+            if((cc->mode != previousMode + 1) || (modes[cc->mode] != 0)){
+                printf("BBR went from mode %d to mode %d\n", previousMode, cc->mode);
+                isOk = false;
+            }
+            if((cc->mode == BBR_DRAIN) && (fabs(cc->pacingGain - 1 / BBR_STARTUP_GAIN) > 0.001)){
+                printf("BBR drains at a gain of %f\n", cc->pacingGain);
+                isOk = false;
+            }
+            modes[cc->mode] = i;
+            previousMode = cc->mode;
+        }
+    }
+    if(isOk && ((modes[BBR_DRAIN] == 0) || (modes[BBR_PROBE_BW] == 0) || (modes[BBR_PROBE_RTT] != 0))){
+        printf("BBR modes entered at ACKs %d (drain), %d (probe bandwidth), %d (probe RTT)\n", modes[BBR_DRAIN], modes[BBR_PROBE_BW], modes[BBR_PROBE_RTT]);
+        isOk = false;
+    }
+    
+    // ~~ Probe bandwidth cycles its gain over the rounds : one round above 1, one below, then 1 ~~
+    for(i = 0; (i < BBR_GAIN_CYCLE) && isOk; i++){
+        gains[cc->cycleIndex] = cc->pacingGain;
+        while((int32_t)(seqNo - cc->roundEndSeqNo) < 0){
+            addUSec(&now, (long)(1 / rate));
+            congestionOnSend(cc, seqNo + congestionWindow(*cc));
+            congestionOnAck(cc, seqNo, rtt, rtt, rtt, now);
+            seqNo++;
+        }
+        addUSec(&now, (long)(1 / rate));
+        congestionOnSend(cc, seqNo + congestionWindow(*cc));
+        congestionOnAck(cc, seqNo, rtt, rtt, rtt, now); // Ends the round
+        seqNo++;
+    }
+    if(isOk && ((gains[0] <= 1) || (gains[1] >= 1) || (gains[2] != 1) || (gains[BBR_GAIN_CYCLE - 1] != 1))){
+        printf("BBR probe bandwidth gains : %f %f %f ... %f\n", gains[0], gains[1], gains[2], gains[BBR_GAIN_CYCLE - 1]);
+        isOk = false;
+    }
+    
+    // ~~ The min RTT expires : PROBE_RTT caps the window, for BBR_PROBE_RTT_DURATION, then probe bandwidth resumes ~~
+    addUSec(&now, BBR_MIN_RTT_WINDOW + 1);
+    congestionOnAck(cc, seqNo, rtt + 1000, rtt, rtt, now);
+    seqNo++;
+    if(isOk && ((cc->mode != BBR_PROBE_RTT) || (congestionWindow(*cc) != BBR_PROBE_RTT_WINDOW) || (cc->congestionWindow <= BBR_PROBE_RTT_WINDOW))){
+        printf("BBR probe RTT : mode %d, window %d\n", cc->mode, congestionWindow(*cc));
+        isOk = false;
+    }
+    for(i = 0; (i * (long)(1 / rate) <= BBR_PROBE_RTT_DURATION) && isOk; i++, seqNo++){
+        addUSec(&now, (long)(1 / rate));
+        congestionOnSend(cc, seqNo + congestionWindow(*cc));
+        congestionOnAck(cc, seqNo, rtt, rtt, rtt, now);
+    }
+    if(isOk && ((cc->mode != BBR_PROBE_BW) || (congestionWindow(*cc) <= BBR_PROBE_RTT_WINDOW) || (cc->minRtt != rtt))){
+        printf("BBR after probe RTT : mode %d, window %d, min RTT %f\n", cc->mode, congestionWindow(*cc), cc->minRtt);
+        isOk = false;
+    }
+    
+    congestionFree(cc);
+    if(!isOk){
+        printf("BBR state test failed\n");
+    }
+    return isOk;
+}
+
+/* Constant delivery rate and RTT : BBR must find the bandwidth and settle on a window of a few bandwidth-delay products */
+int congestionTest(){
+    int isOk = true, i, rtt = 20000;
+    double rate = 0.01; // packets per uSecond
+    struct timeval now;
+    congestionstate* cc = congestionInit(CC_BBR);
+    encoderstate* encState;
+    
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+    for(i = 0; i < 20000; i++){
+        addUSec(&now, (long)(1 / rate));
+        congestionOnSend(cc, i + congestionWindow(*cc));
+        congestionOnAck(cc, i, rtt, rtt, rtt, now);
+    }
+    if((fabs(cc->maxBandwidth - rate) > rate / 10) || (cc->minRtt != rtt) || (cc->mode != BBR_PROBE_BW)){
+        printf("BBR model is wrong : bandwidth = %f, min RTT = %f, mode = %d\n", cc->maxBandwidth, cc->minRtt, cc->mode);
+        isOk = false;
+    }
+    if(abs(congestionWindow(*cc) - (int)(BBR_CWND_GAIN * rate * rtt)) > BBR_CWND_GAIN * rate * rtt / 10){
+        printf("BBR window is %d instead of ~%d\n", congestionWindow(*cc), (int)(BBR_CWND_GAIN * rate * rtt));
+        isOk = false;
+    }
+    congestionOnTimeout(cc);
+    if(congestionWindow(*cc) != BASE_WINDOW){
+        isOk = false;
+    }
+    congestionFree(cc);
+    
+    // A whole session with BBR
+    encState = encoderStateInit();
+    encState->congestion->algorithm = CC_BBR;
+    isOk = isOk && codingSessionTest(encState, decoderStateInit(), 2000, PACKETSIZE - 20, 0, false);
+    
+    if(!isOk){
+        printf("Congestion control test failed\n");
+    }
+    return isOk;
+}
+
+/* A window of packets must leave at the pacing rate, not in a burst */
+int pacerTest(){
+    int isOk = true, n;
+    uint8_t data[8 * PACKETSIZE];
+    struct timeval now, next;
+    encoderstate* encState = encoderStateInit();
+    
+    encState->shortTermRttAverage = 80000; // 8 packets per 80 ms : one packet every 8 ms at PACING_GAIN 1.25
+    handleInClear(encState, data, sizeof(data));
+    
+    gettimeofday(&now, NULL);
+    n = pacerReleasable(encState, now);
+    pacerDequeue(encState, n);
+    if(n != (int)PACING_MAX_BURST){
+        printf("Pacer released %d packets at once\n", n);
+        isOk = false;
+    }
+    addUSec(&now, 4000);
+    if(pacerReleasable(encState, now) != 0){
+        isOk = false;
+    }
+    next = pacerNextRelease(*encState);
+    if(abs(diffUSec(next, now) - 4000) > 10){
+        printf("Next packet leaves %ld us later instead of 4000\n", diffUSec(next, now));
+        isOk = false;
+    }
+    n = pacerReleasable(encState, next);
+    pacerDequeue(encState, n);
+    if((n != 1) || (encState->pacingDelayMax < 8000)){
+        isOk = false;
+    }
+    encoderStateFree(encState);
+    
+    if(!isOk){
+        printf("Pacer test failed\n");
+    }
+    return isOk;
+}
+
+/* RTO backoff, and a timeout proved spurious by the ACK of a packet sent before it */
+int timeoutTest(){
+    int isOk = true, i, window;
+    uint8_t data[8 * PACKETSIZE];
+    long timeout;
+    struct timeval now;
+    encoderstate* encState = encoderStateInit();
+    decoderstate* decState = decoderStateInit();
+    
+    handleInClear(encState, data, sizeof(data));
+    for(i = 0; i < 4; i++){ // Packets 0 to 3 arrive
+        handleInCoded(decState, encState->dataToSend[i], encState->dataToSendSize[i]);
+        onAck(encState, decState->ackToSend[decState->nAckToSend - 1], decState->ackToSendSize[decState->nAckToSend - 1]);
+    }
+    window = congestionWindow(*(encState->congestion));
+    timeout = retransmissionTimeout(*encState);
+    if((timeout < RTO_MIN) || (timeout > RTO_INITIAL)){
+        printf("Timeout of %ld us\n", timeout);
+        isOk = false;
+    }
+    
+    // Two timeouts in a row : the second one waits four times the RTO
+    onTimeOut(encState);
+    onTimeOut(encState);
+    gettimeofday(&now, NULL);
+    if(labs(diffUSec(encState->nextTimeout, now) - 4 * timeout) > timeout / 2){
+        printf("Timeout after backoff is %ld us instead of %ld\n", diffUSec(encState->nextTimeout, now), 4 * timeout);
+        isOk = false;
+    }
+    if(congestionWindow(*(encState->congestion)) != BASE_WINDOW){
+        isOk = false;
+    }
+    
+    // Packet 4 was only delayed
+    handleInCoded(decState, encState->dataToSend[4], encState->dataToSendSize[4]);
+    onAck(encState, decState->ackToSend[decState->nAckToSend - 1], decState->ackToSendSize[decState->nAckToSend - 1]);
+    if((encState->stats_nSpuriousTimeouts != 1) || (congestionWindow(*(encState->congestion)) < window)){
+        printf("Spurious timeout not detected : window = %d instead of %d\n", congestionWindow(*(encState->congestion)), window);
+        isOk = false;
+    }
+    
+    encoderStateFree(encState);
+    decoderStateFree(decState);
+    if(!isOk){
+        printf("Timeout test failed\n");
+    }
+    return isOk;
+}
+
+int highBdpTest(){
+    int isOk = true, i, codec, nPackets = 20000, nLost = 0, chunk = 16 * (PACKETSIZE - 2);
+    uint8_t* data = calloc(chunk, sizeof(uint8_t));
+    uint32_t firstSeqNo = 0xFFFFFFFF - 1000;
+    encoderstate* encState;
+    decoderstate* decState;
+    
+    // ~~ Sequence and block numbers wrap around during the session ~~
+    for(codec = CODEC_BLOCK; codec <= CODEC_FOUNTAIN; codec++){
+        encState = encoderStateInit();
+        decState = decoderStateInit();
+        encState->codec = codec;
+        decState->codec = codec;
+        encState->currBlock = (codec == CODEC_SLIDING) ? 65000 : 65530;
+        decState->currBlock = encState->currBlock;
+        encState->seqNo_Next = firstSeqNo;
+        encState->seqNo_Una = firstSeqNo;
+        encState->seqNo_FirstSent = firstSeqNo;
+        encState->seqNo_FirstInFlight = firstSeqNo;
+        decState->lastSeqReceived = firstSeqNo - 1;
+        if(!codingSessionTest(encState, decState, 2000, PACKETSIZE - 20, 0, false)){
+            printf("Session across the wraparound failed with codec %d\n", codec);
+            isOk = false;
+        }
+    }
+    
+    // ~~ A window of nPackets, across many more blocks than MAX_BLOCKS ~~
+    encState = encoderStateInit();
+    decState = decoderStateInit();
+    encState->isHighBdp = true;
+    decState->isHighBdp = true;
+    decState->lossBuffer->size = HIGH_BDP_LOSS_BUFFER_SIZE;
+    encState->congestion->maxWindow = HIGH_BDP_MAX_WINDOW;
+    encState->congestion->congestionWindow = nPackets;
+    encState->shortTermRttAverage = 10000000; // Long enough that no packet leaves the flight during the test, even on a slow machine
+    encState->longTermRttAverage = 10000000;
+    encState->inputRate = 125;
+    for(i = 0; (i < nPackets / 16) && isMoreDataOk(*encState); i++){
+        handleInClear(encState, data, chunk);
+    }
+    if((encState->nDataToSend != nPackets) || (encState->nInFlight != nPackets) || (encState->numBlock <= MAX_BLOCKS)){
+        printf("%d packets sent, %d in flight, over %d blocks\n", encState->nDataToSend, encState->nInFlight, encState->numBlock);
+        isOk = false;
+    }
+    
+    // Every packet arrives except one in 100 : the ACK of the last one ends the flight of all of them
+    for(i = 0; i < encState->nDataToSend; i++){
+        if(i % 100 != 50){
+            handleInCoded(decState, encState->dataToSend[i], encState->dataToSendSize[i]);
+        } else if(i >= nPackets - HIGH_BDP_LOSS_BUFFER_SIZE){ // Older losses have left the buffer
+            nLost++;
+        }
+    }
+    if((decState->lossBuffer->nLost != nLost) || (decState->lossBuffer->nTotal != HIGH_BDP_LOSS_BUFFER_SIZE)){
+        printf("Loss buffer counts %d lost out of %d\n", decState->lossBuffer->nLost, decState->lossBuffer->nTotal);
+        isOk = false;
+    }
+    pacerDequeue(encState, encState->nDataToSend);
+    onAck(encState, decState->ackToSend[decState->nAckToSend - 1], decState->ackToSendSize[decState->nAckToSend - 1]);
+    if((encState->seqNo_FirstInFlight != encState->seqNo_Una) || (encState->nInFlight != encState->nDataToSend)){
+        printf("After the ACK : %d packets in flight, %d repairs sent\n", encState->nInFlight, encState->nDataToSend);
+        isOk = false;
+    }
+    
+    free(data);
+    encoderStateFree(encState);
+    decoderStateFree(decState);
+    if(!isOk){
+        printf("High-BDP test failed\n");
+    }
+    return isOk;
+}
+
+int pathCacheTest(){
+    int isOk = true, cold, warm;
+    uint8_t data[64 * (PACKETSIZE - 2)];
+    struct sockaddr_in remote;
+    struct timeval now;
+    pathcache* cache = pathCacheInit();
+    encoderstate* encState = encoderStateInit();
+    
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = inet_addr("10.0.0.1");
+    remote.sin_port = htons(5000);
+    gettimeofday(&now, NULL);
+    
+    // ~~ A mux that has measured the path closes ~~
+    encState->shortTermRttAverage = 50000;
+    encState->longTermRttAverage = 45000;
+    encState->rttVariation = 5000;
+    encState->congestion->congestionWindow = 100;
+    pathCacheStore(cache, remote, *encState, now);
+    encoderStateFree(encState);
+    
+    // ~~ Short flow : a cold encoder sends BASE_WINDOW packets in the first round trip, a warm one half the cached window ~~
+    encState = encoderStateInit();
+    handleInClear(encState, data, sizeof(data));
+    cold = encState->nDataToSend;
+    encoderStateFree(encState);
+    
+    encState = encoderStateInit();
+    if(!pathCacheSeed(cache, remote, encState, now)){
+        printf("Path metrics not found\n");
+        isOk = false;
+    }
+    handleInClear(encState, data, sizeof(data));
+    warm = encState->nDataToSend;
+    printf("Short flow of 64 packets : %d sent in the first round trip from a cold start, %d from the path cache\n", cold, warm);
+    if((cold != BASE_WINDOW) || (warm != 50) || (retransmissionTimeout(*encState) >= RTO_INITIAL)){
+        isOk = false;
+    }
+    encoderStateFree(encState);
+    
+    // ~~ Metrics age out ~~
+    encState = encoderStateInit();
+    addUSec(&now, PATH_CACHE_MAX_AGE + 1);
+    if(pathCacheSeed(cache, remote, encState, now) || (cache->nEntries != 0) || (congestionWindow(*(encState->congestion)) != BASE_WINDOW)){
+        printf("Expired path metrics have been used\n");
+        isOk = false;
+    }
+    encoderStateFree(encState);
+    
+    pathCacheFree(cache);
+    if(!isOk){
+        printf("Path cache test failed\n");
+    }
+    return isOk;
+}
+
+int coupledCongestionTest(){
+    int isOk = true, tableLength = 0;
+    uint8_t data[64 * (PACKETSIZE - 2)];
+    muxstate* muxTable = 0;
+    struct sockaddr_in remote;
+    pathcache* pathCache = pathCacheInit();
+    encoderstate* first = encoderStateInit();
+    encoderstate* second = encoderStateInit();
+    
+    // ~~ Two encoders share a window of 40 packets : the first one may take it all, the second one still gets its fair share ~~
+    congestionFree(second->congestion);
+    second->congestion = congestionShare(first->congestion);
+    first->congestion->congestionWindow = 40;
+    first->congestion->slowStartMode = false;
+    
+    handleInClear(first, data, sizeof(data));
+    handleInClear(second, data, sizeof(data));
+    if((first->nDataToSend != 40) || (second->nDataToSend != 20) || (first->congestion->nInFlight != 60)){
+        printf("Shared window : %d and %d packets sent, %d in flight\n", first->nDataToSend, second->nDataToSend, first->congestion->nInFlight);
+        isOk = false;
+    }
+    encoderStateFree(first);
+    if((second->congestion->nUsers != 1) || (second->congestion->nInFlight != 20)){
+        isOk = false;
+    }
+    encoderStateFree(second);
+    
+    // ~~ Coupled muxes to the same peer share their encoder's congestion state ~~
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_addr.s_addr = inet_addr("10.0.0.1");
+    remote.sin_port = htons(5000);
+    assignMux(1, 80, 1, 1, -1, &muxTable, &tableLength, remote, BITMASK_OPTIONS_COUPLED, pathCache);
+    assignMux(2, 80, 1, 2, -1, &muxTable, &tableLength, remote, BITMASK_OPTIONS_COUPLED, pathCache);
+    assignMux(3, 80, 1, 3, -1, &muxTable, &tableLength, remote, CODEC_BLOCK, pathCache);
+    if((muxTable[0].encoderState->congestion != muxTable[1].encoderState->congestion) || (muxTable[2].encoderState->congestion == muxTable[0].encoderState->congestion)){
+        printf("Coupled muxes do not share their congestion state\n");
+        isOk = false;
+    }
+    while(tableLength > 0){
+        removeMux(0, &muxTable, &tableLength, pathCache);
+    }
+    
+    pathCacheFree(pathCache);
+    if(!isOk){
+        printf("Coupled congestion test failed\n");
+    }
+    return isOk;
+}
+
+int schedulerTest(){
+    int isOk = true, i, nOrdered, next = 0, nFirst = 0, nReleasable[2], weights[2] = {1, 3}, order[40];
+    uint8_t data[20 * (PACKETSIZE - 2)];
+    muxstate muxTable[2];
+    
+    memset(muxTable, 0, sizeof(muxTable));
+    for(i = 0; i < 2; i++){
+        muxTable[i].encoderState = encoderStateInit();
+        muxTable[i].encoderState->congestion->congestionWindow = 40;
+        handleInClear(muxTable[i].encoderState, data, sizeof(data));
+        nReleasable[i] = muxTable[i].encoderState->nDataToSend;
+    }
+    
+    // ~~ Both muxes are backlogged : the second one sends three packets for each packet of the first one ~~
+    nOrdered = scheduleMuxes(muxTable, 2, nReleasable, weights, 40 * SCHEDULER_QUANTUM, &next, order);
+    for(i = 0; i < 16; i++){
+        nFirst += (order[i] == 0);
+    }
+    if((nOrdered != 40) || (nFirst != 4)){
+        printf("Scheduler : %d packets ordered, %d of the first 16 for the mux of weight 1\n", nOrdered, nFirst);
+        isOk = false;
+    }
+    
+    // ~~ The budget bounds an iteration ; the next one resumes where it stopped ~~
+    nOrdered = scheduleMuxes(muxTable, 2, nReleasable, weights, 5 * SCHEDULER_QUANTUM, &next, order);
+    if((nOrdered * (PACKETSIZE + DATA_HEADER_LENGTH) > 5 * SCHEDULER_QUANTUM) || (nOrdered < 4) || (next != 1)){
+        printf("Scheduler : %d packets ordered within the budget, next mux is %d\n", nOrdered, next);
+        isOk = false;
+    }
+    
+    for(i = 0; i < 2; i++){
+        encoderStateFree(muxTable[i].encoderState);
+    }
+    if(!isOk){
+        printf("Scheduler test failed\n");
+    }
+    return isOk;
+}
+
+int rateLimitTest(){
+    int isOk = true, i, nAllowed = 0;
+    char* path = "/tmp/tcpep_ratelimit_test.conf";
+    FILE* file;
+    struct timeval now, next;
+    struct sockaddr_in client, other;
+    ratelimiter* limiter = rateLimiterInit();
+    encoderstate* encState;
+    uint8_t data[4 * PACKETSIZE] = {0};
+    
+    memset(&client, 0, sizeof(client));
+    client.sin_addr.s_addr = inet_addr("10.0.0.1");
+    client.sin_port = htons(1000);
+    other = client;
+    other.sin_addr.s_addr = inet_addr("10.0.0.2");
+    gettimeofday(&now, NULL);
+    
+    // ~~ Without limits, every client is allowed ~~
+    if(!rateLimiterAllows(limiter, client, 1000000, now) || (rateLimiterNextAllowed(limiter, client, 1000000).tv_sec != 0)){
+        printf("Rate limit : client limited without limits\n");
+        isOk = false;
+    }
+    
+    file = fopen(path, "w");
+    fprintf(file, "# Test limits\n10.0.0.1 800 15000\n* 8000\n");
+    fclose(file);
+    if(!rateLimiterLoad(limiter, path) || (limiter->nLimits != 2)){
+        printf("Rate limit : could not load %s\n", path);
+        isOk = false;
+    }
+    
+    // ~~ The bucket allows its burst, then refills at the rate (800 kbit/s is 0.1 byte per uSecond) ~~
+    for(i = 0; i < 20; i++){
+        if(rateLimiterAllows(limiter, client, 1500, now)){
+            rateLimiterConsume(limiter, client, 1500);
+            nAllowed++;
+        }
+    }
+    next = rateLimiterNextAllowed(limiter, client, 1500);
+    if((nAllowed != 10) || (diffUSec(next, now) != 15000)){
+        printf("Rate limit : %d packets allowed in the burst, next one in %ld uSeconds\n", nAllowed, diffUSec(next, now));
+        isOk = false;
+    }
+    if(!rateLimiterAllows(limiter, client, 1500, next) || !rateLimiterAllows(limiter, other, 1500, now)){
+        printf("Rate limit : client not allowed after the refill, or other client limited\n");
+        isOk = false;
+    }
+    
+    // ~~ A bad file keeps the previous limits ~~
+    file = fopen(path, "w");
+    fprintf(file, "10.0.0.1 fast\n");
+    fclose(file);
+    if(rateLimiterLoad(limiter, path) || (limiter->nLimits != 2)){
+        printf("Rate limit : bad file accepted\n");
+        isOk = false;
+    }
+    
+    remove(path);
+    rateLimiterFree(limiter);
+    
+    // ~~ Nothing is coded for a client the limiter holds back, until the looper lets it go ~~
+    encState = encoderStateInit();
+    encState->isRateLimited = true;
+    handleInClear(encState, data, sizeof(data));
+    if(encState->nDataToSend != 0){
+        printf("Rate limit : %d packets coded for a limited client\n", encState->nDataToSend);
+        isOk = false;
+    }
+    encState->isRateLimited = false;
+    onWindowUpdate(encState);
+    if(encState->nDataToSend == 0){
+        printf("Rate limit : no packet coded once the client is let go\n");
+        isOk = false;
+    }
+    encoderStateFree(encState);
+    
+    if(!isOk){
+        printf("Rate limit test failed\n");
+    }
+    return isOk;
+}
+
+int workerTest(){
+    int isOk = true;
+    socklen_t len = sizeof(struct sockaddr_in);
+    struct sockaddr_in first, second;
+    globalstate state;
+    globalstate* worker;
+    
+    globalStateInit(&state);
+    state.cliproxy = PROXY;
+    state.udpPort = 47001;
+    state.nWorkers = 2;
+    addPortWeight(&state, "22:8");
+    
+    // ~~ Both workers bind the same UDP port, each with its own socket and muxes state ~~
+    initializeNetwork(&state);
+    worker = workerStateInit(&state);
+    getsockname(state.udpSock_fd, (struct sockaddr*)&first, &len);
+    getsockname(worker->udpSock_fd, (struct sockaddr*)&second, &len);
+    if((worker->udpSock_fd == state.udpSock_fd) || (first.sin_port != second.sin_port) || (ntohs(second.sin_port) != 47001)){
+        printf("Workers : sockets %d and %d on ports %d and %d\n", state.udpSock_fd, worker->udpSock_fd, ntohs(first.sin_port), ntohs(second.sin_port));
+        isOk = false;
+    }
+    if((worker->pathCache == state.pathCache) || (worker->rateLimiter == state.rateLimiter) || (worker->nWeightedPorts != 1) || (worker->portWeights[0] != 8)){
+        printf("Workers : state shared, or options lost\n");
+        isOk = false;
+    }
+    
+    close(worker->udpSock_fd);
+    close(state.udpSock_fd);
+    globalStateFree(worker);
+    free(worker);
+    globalStateFree(&state);
+    if(!isOk){
+        printf("Worker test failed\n");
+    }
+    return isOk;
+}
+
+void incrementJob(void* counter){
+    (*(int*)counter)++;
+}
+
+int codingPoolTest(){
+    int isOk = true, i, counters[1000];
+    uint8_t data[2 * BLKSIZE * (PACKETSIZE - 2)];
+    codingpool* pool = codingPoolInit(3);
+    atomic_int nPending;
+    encoderstate* encStates[2];
+    
+    // ~~ Every job runs once, more jobs than the rings hold ~~
+    memset(counters, 0, sizeof(counters));
+    atomic_init(&nPending, 0);
+    for(i = 0; i < 1000; i++){
+        codingPoolSubmit(pool, incrementJob, &(counters[i]), &nPending);
+    }
+    codingPoolWait(&nPending);
+    for(i = 0; i < 1000; i++){
+        if(counters[i] != 1){
+            printf("Coding pool : job %d ran %d times\n", i, counters[i]);
+            isOk = false;
+            break;
+        }
+    }
+    
+    // ~~ The coded payloads generated by the threads are those generated inline ~~
+    memset(data, 1, sizeof(data));
+    for(i = 0; i < 2; i++){
+        encStates[i] = encoderStateInit();
+        encStates[i]->congestion->congestionWindow = 1000;
+        encStates[i]->p = 0.9; // Plenty of repairs
+        encStates[i]->codingPool = (i == 1) ? pool : 0;
+        handleInClear(encStates[i], data, sizeof(data));
+    }
+    if((encStates[0]->nDataToSend != encStates[1]->nDataToSend) || (encStates[1]->nDataToSend <= 2 * BLKSIZE)){
+        printf("Coding pool : %d packets queued with the threads, %d inline\n", encStates[1]->nDataToSend, encStates[0]->nDataToSend);
+        isOk = false;
+    }
+    for(i = 0; isOk && (i < encStates[1]->nDataToSend); i++){
+        if((encStates[0]->dataToSendSize[i] != encStates[1]->dataToSendSize[i]) || (memcmp(encStates[0]->dataToSend[i], encStates[1]->dataToSend[i], encStates[1]->dataToSendSize[i]) != 0)){
+            printf("Coding pool : packet %d differs\n", i);
+            isOk = false;
+        }
+    }
+    encoderStateFree(encStates[0]);
+    encoderStateFree(encStates[1]);
+    
+    codingPoolFree(pool);
+    if(!isOk){
+        printf("Coding pool test failed\n");
+    }
+    return isOk;
+}
+
+int parallelDecodingTest(){
+    int isOk = true, i, pass, isFirstBlock;
+    uint16_t blockNo, packetNumber;
+    uint8_t data[12 * MIN_BLKSIZE * (PACKETSIZE - 2)]; // Generations start small, and the decoder buffers MAX_BLOCKS of them
+    codingpool* pool = codingPoolInit(3);
+    encoderstate* encState = encoderStateInit();
+    decoderstate* decState = decoderStateInit();
+    
+    for(i = 0; i < sizeof(data); i++){
+        data[i] = i % 251;
+    }
+    encState->congestion->congestionWindow = 10000;
+    encState->p = 0.5; // Repairs for every generation
+    handleInClear(encState, data, sizeof(data));
+    decState->codingPool = pool;
+    
+    // ~~ The first generation is late : the later ones are reduced meanwhile, and wait for it ~~
+    for(pass = 0; pass < 2; pass++){
+        for(i = 0; i < encState->nDataToSend; i++){
+            memcpy(&blockNo, encState->dataToSend[i], 2);
+            memcpy(&packetNumber, encState->dataToSend[i] + 2, 2);
+            isFirstBlock = (ntohs(blockNo) == 0);
+            if((ntohs(packetNumber) == (FLAG_CLEAR | 0)) && !isFirstBlock){
+                continue; // Lost : the generation needs a repair, and an actual reduction
+            }
+            if(isFirstBlock == (pass == 1)){
+                handleInCoded(decState, encState->dataToSend[i], encState->dataToSendSize[i]);
+            }
+        }
+        if((pass == 0) && ((decState->nDataToSend != 0) || (decState->stats_nParallelReductions == 0))){
+            printf("Parallel decoding : %d bytes delivered before the first generation, %lu generations reduced ahead\n", decState->nDataToSend, decState->stats_nParallelReductions);
+            isOk = false;
+        }
+    }
+    
+    // ~~ ... then everything is delivered in order ; the last generation is still open ~~
+    if((decState->nDataToSend < sizeof(data) - MIN_BLKSIZE * (PACKETSIZE - 2)) || (memcmp(decState->dataToSend, data, decState->nDataToSend) != 0)){
+        printf("Parallel decoding : %d bytes delivered out of %d, or out of order\n", decState->nDataToSend, (int)sizeof(data));
+        isOk = false;
+    }
+    
+    encoderStateFree(encState);
+    decoderStateFree(decState);
+    codingPoolFree(pool);
+    if(!isOk){
+        printf("Parallel decoding test failed\n");
+    }
+    return isOk;
+}
+
+int repairCacheTest(){
+    int isOk = true, i, j;
+    uint8_t data[6 * MIN_BLKSIZE * (PACKETSIZE - 2)];
+    codingpool* pool = codingPoolInit(2);
+    encoderstate* encStates[2];
+    
+    memset(data, 7, sizeof(data));
+    for(j = 0; j < 2; j++){ // Without, then with coding threads
+        for(i = 0; i < 2; i++){
+            encStates[i] = encoderStateInit();
+            encStates[i]->congestion->congestionWindow = 10000;
+            encStates[i]->p = 0.9;
+            encStates[i]->codingPool = (j == 1) ? pool : 0;
+            handleInClear(encStates[i], data, sizeof(data));
+        }
+        
+        // ~~ Repairs computed ahead are those computed when sending ~~
+        encoderPrecompute(encStates[1]);
+        for(i = 0; i < 2; i++){
+            encStates[i]->p = 0.95; // More repairs are due
+            handleInClear(encStates[i], data, 100);
+        }
+        if((encStates[0]->nDataToSend != encStates[1]->nDataToSend) || (encStates[1]->stats_nCachedRepairs == 0)){
+            printf("Repair cache : %d packets queued with the cache (%lu from it), %d without\n", encStates[1]->nDataToSend, encStates[1]->stats_nCachedRepairs, encStates[0]->nDataToSend);
+            isOk = false;
+        }
+        for(i = 0; isOk && (i < encStates[1]->nDataToSend); i++){
+            if((encStates[0]->dataToSendSize[i] != encStates[1]->dataToSendSize[i]) || (memcmp(encStates[0]->dataToSend[i], encStates[1]->dataToSend[i], encStates[1]->dataToSendSize[i]) != 0)){
+                printf("Repair cache : packet %d differs\n", i);
+                isOk = false;
+            }
+        }
+        encoderStateFree(encStates[0]);
+        encoderStateFree(encStates[1]);
+    }
+    
+    codingPoolFree(pool);
+    if(!isOk){
+        printf("Repair cache test failed\n");
+    }
+    return isOk;
+}
+
+int rowKernelTest(){
+    int isOk = true, coeff, size, i;
+    uint8_t a[PACKETSIZE], b[PACKETSIZE], expected[PACKETSIZE];
+    int sizes[5] = {1, 15, 17, 40, PACKETSIZE};
+    int kernelSizes[6] = {16, 64, 127, 1380, 1452, 8960};
+    uint8_t* bigA = malloc(8960);
+    uint8_t* bigB = malloc(8960);
+    uint8_t* bigExpected = malloc(8960);
+    rowkernels* kernels;
+    
+    for(i = 0; i < PACKETSIZE; i++){
+        b[i] = rand();
+        a[i] = rand();
+    }
+    // ~~ The vector and nibble table kernels against byte per byte multiplications, on sizes with a tail ~~
+    for(coeff = 0; isOk && (coeff < 256); coeff++){
+        for(size = 0; isOk && (size < 5); size++){
+            for(i = 0; i < sizes[size]; i++){
+                expected[i] = a[i] ^ gmul(coeff, b[i]);
+            }
+            rowMulSub(a, b, coeff, sizes[size]);
+            if(memcmp(a, expected, sizes[size]) != 0){
+                printf("GF(2^8) row kernel : coefficient %d on %d bytes\n", coeff, sizes[size]);
+                isOk = false;
+            }
+            if(coeff >= 16){
+                continue;
+            }
+            for(i = 0; i < sizes[size]; i++){
+                expected[i] = a[i] ^ fieldMul(FIELD_GF16, coeff, b[i] & 0x0F) ^ (fieldMul(FIELD_GF16, coeff, b[i] >> 4) << 4);
+            }
+            fieldRowMulSub(FIELD_GF16, a, b, coeff, sizes[size]);
+            if(memcmp(a, expected, sizes[size]) != 0){
+                printf("GF(2^4) row kernel : coefficient %d on %d bytes\n", coeff, sizes[size]);
+                isOk = false;
+            }
+        }
+    }
+    
+    // ~~ Kernels specialized for a size, against the generic ones ~~
+    for(size = 0; isOk && (size < 6); size++){
+        kernels = getRowKernels(kernelSizes[size]);
+        if(kernels == 0){
+            printf("Row kernels : none for %d bytes\n", kernelSizes[size]);
+            isOk = false;
+            break;
+        }
+        for(coeff = 0; isOk && (coeff < 256); coeff += (coeff < 16) ? 1 : 17){
+            for(i = 0; i < kernelSizes[size]; i++){
+                bigB[i] = rand();
+                bigA[i] = bigExpected[i] = rand();
+            }
+            fieldRowMulSub((coeff < 16) ? FIELD_GF16 : FIELD_GF256, bigExpected, bigB, coeff, kernelSizes[size]);
+            fieldRowMulSubKernels((coeff < 16) ? FIELD_GF16 : FIELD_GF256, kernels, bigA, bigB, coeff, kernelSizes[size]);
+            if(memcmp(bigA, bigExpected, kernelSizes[size]) != 0){
+                printf("Row kernels : coefficient %d on %d bytes\n", coeff, kernelSizes[size]);
+                isOk = false;
+            }
+        }
+    }
+    free(bigA);
+    free(bigB);
+    free(bigExpected);
+    
+    if(!isOk){
+        printf("Row kernel test failed\n");
+    }
+    return isOk;
+}
+
+int matrixProductTest(){
+    int isOk = true, i, j, k;
+    uint8_t expected;
+    codingpool* pool = codingPoolInit(4);
+    matrix* a = getRandomMatrix(150, 300); // More rows and columns than a tile
+    matrix* b = getRandomMatrix(300, MUL_TILE_COLUMNS + 100);
+    matrix* product = mMul(*a, *b);
+    matrix* parallelProduct = mMulParallel(*a, *b, pool);
+    
+    // ~~ Tiled product against the definition ~~
+    for(i = 0; isOk && (i < a->nRows); i++){
+        for(j = 0; isOk && (j < b->nColumns); j++){
+            expected = 0;
+            for(k = 0; k < a->nColumns; k++){
+                expected ^= gmul(a->data[i][k], b->data[k][j]);
+            }
+            if(product->data[i][j] != expected){
+                printf("Matrix product : wrong element (%d, %d)\n", i, j);
+                isOk = false;
+            }
+        }
+    }
+    // ~~ Row bands on the coding threads ~~
+    if(isOk && !mEqual(*product, *parallelProduct)){
+        printf("Matrix product : the coding threads disagree\n");
+        isOk = false;
+    }
+    
+    mFree(a);
+    mFree(b);
+    mFree(product);
+    mFree(parallelProduct);
+    codingPoolFree(pool);
+    if(!isOk){
+        printf("Matrix product test failed\n");
+    }
+    return isOk;
+}
+
+int inputRowsTest(){
+    int isOk = true, i, j, fds[2], nRows, nread, total = 0;
+    uint8_t data[20000];
+    struct iovec rows[READ_MAX_ROWS];
+    encoderstate* copied = encoderStateInit();
+    encoderstate* direct = encoderStateInit();
+    encoderstate* empty = encoderStateInit();
+    encoderstate* idle = encoderStateInit();
+    
+    for(i = 0; i < sizeof(data); i++){
+        data[i] = rand();
+    }
+    if(pipe(fds) != 0){
+        perror("pipe()");
+        return false;
+    }
+    
+    // ~~ Reads into the rows make the same packets as copies of the same reads ~~
+    for(i = 0; isOk && (i < 4); i++){
+        if(write(fds[1], data, sizeof(data)) != sizeof(data)){
+            perror("write()");
+            isOk = false;
+        }
+        while(isOk && (total < (i + 1) * sizeof(data))){
+            nRows = getInputRows(direct, rows, READ_MAX_ROWS);
+            nread = creadv(fds[0], rows, nRows);
+            handleInRows(direct, nread);
+            handleInClear(copied, data + total % sizeof(data), nread);
+            total += nread;
+        }
+    }
+    if(isOk && (copied->numBlock != direct->numBlock)){
+        printf("Input rows : %d generations instead of %d\n", direct->numBlock, copied->numBlock);
+        isOk = false;
+    }
+    for(i = 0; isOk && (i < direct->numBlock); i++){
+        for(j = 0; isOk && (j < copied->blocks[i].nPackets); j++){
+            if((copied->blocks[i].nPackets != direct->blocks[i].nPackets) || (memcmp(copied->blocks[i].dataMatrix->data[j], direct->blocks[i].dataMatrix->data[j], PACKETSIZE) != 0)){
+                printf("Input rows : packet %d of generation %d differs\n", j, i);
+                isOk = false;
+            }
+        }
+    }
+    
+    // ~~ After an idle gap, the generation is closed and the next read gets a new one ~~
+    nRows = getInputRows(idle, rows, READ_MAX_ROWS);
+    handleInRows(idle, 100);
+    usleep(2 * IDLE_CLOSE_DELAY);
+    nRows = getInputRows(idle, rows, READ_MAX_ROWS);
+    if(isOk && ((nRows == 0) || (idle->numBlock != 2) || (idle->blocks[0].maxPackets != 1) || (idle->blocks[1].nPackets != 0))){
+        printf("Input rows : %d rows in %d generations after an idle gap\n", nRows, idle->numBlock);
+        isOk = false;
+    }
+    handleInRows(idle, 0);
+    isOk = isOk && codingSessionTest(encoderStateInit(), decoderStateInit(), 10, 3 * PACKETSIZE / 2, 2 * IDLE_CLOSE_DELAY, true);
+    
+    // ~~ Reads follow the window the congestion control allows, not its raw value ~~
+    empty->congestion->algorithm = CC_BBR;
+    empty->congestion->mode = BBR_PROBE_RTT;
+    empty->congestion->congestionWindow = 1000;
+    nRows = getInputRows(empty, rows, READ_MAX_ROWS);
+    if(isOk && (nRows > BBR_PROBE_RTT_WINDOW) && (nRows > READ_ROOM)){
+        printf("Input rows : %d rows offered in PROBE_RTT\n", nRows);
+        isOk = false;
+    }
+    handleInRows(empty, 0);
+    
+    // ~~ A generation opened for a read that got nothing is dropped ~~
+    close(fds[1]);
+    nRows = getInputRows(empty, rows, READ_MAX_ROWS);
+    handleInRows(empty, creadv(fds[0], rows, nRows));
+    if(isOk && ((nRows == 0) || (empty->numBlock != 0))){
+        printf("Input rows : %d generations after the end of the input, read into %d rows\n", empty->numBlock, nRows);
+        isOk = false;
+    }
+    
+    close(fds[0]);
+    encoderStateFree(copied);
+    encoderStateFree(direct);
+    encoderStateFree(empty);
+    encoderStateFree(idle);
+    if(!isOk){
+        printf("Input rows test failed\n");
+    }
+    return isOk;
+}
+
 int statesTest(){
     muxstate** muxTable = malloc(sizeof(muxstate*));
     *muxTable = 0;
@@ -201,16 +1581,19 @@ int statesTest(){
     struct sockaddr_in udpRemoteAddr;
     memset(&udpRemoteAddr, 0, sizeof(udpRemoteAddr));
     
-    assignMux((uint16_t)random(), (uint16_t)random(), (uint32_t)random(), (uint16_t)random(), 0, muxTable, &tableLength, udpRemoteAddr);
+    pathcache* pathCache = pathCacheInit();
+    
+    assignMux((uint16_t)random(), (uint16_t)random(), (uint32_t)random(), (uint16_t)random(), 0, muxTable, &tableLength, udpRemoteAddr, CODEC_BLOCK, pathCache);
     printMux((*muxTable)[0]);
-    removeMux(0, muxTable, &tableLength);
+    removeMux(0, muxTable, &tableLength, pathCache);
+    pathCacheFree(pathCache);
     
     free(muxTable);
     return true;
 }
 
 int main(int argc, char **argv){
-    if(codingTest()){
+    if(codingTest() && adaptiveGenerationTest() && slidingWindowTest() && sparseCodingTest() && mdsCodingTest() && fountainCodingTest() && fieldCodingTest() && coefficientGeneratorTest() && rangeCodingTest() && ackPacketTest() && bbrStateTest() && congestionTest() && pacerTest() && timeoutTest() && highBdpTest() && pathCacheTest() && coupledCongestionTest() && schedulerTest() && rateLimitTest() && workerTest() && codingPoolTest() && parallelDecodingTest() && repairCacheTest() && rowKernelTest() && matrixProductTest() && inputRowsTest()){
     //if(statesTest()){
     //if(galoisTest() && matrixTest() && maxMinTest() && codingTest() && statesTest()){
         printf("All test passed.\n");
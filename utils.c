@@ -46,6 +46,16 @@ int cread(int fd, uint8_t *buf, int n){
     return nread;
 }
 
+int creadv(int fd, struct iovec* iov, int n){
+    int nread;
+
+    if((nread=readv(fd, iov, n)) < 0){
+        perror("in utils.c : Reading data");
+        return -1;
+    }
+    return nread;
+}
+
 int udpSend(int fd, uint8_t *buf, int n, struct sockaddr* remote){
     int ret = sendto(fd, buf, n, 0, remote, 16);
     if( n != ret){
@@ -98,6 +108,21 @@ void addUSec(struct timeval *a, long t){
     }
 }
 
+// Returns a - b, in micro-seconds
+long diffUSec(struct timeval a, struct timeval b){
+    return 1000000 * (a.tv_sec - b.tv_sec) + (a.tv_usec - b.tv_usec);
+}
+
+// Returns a - b for sequence numbers that wrap around (serial number arithmetic, RFC 1982). Valid while they are less than 2^15 apart
+int diffSerial16(uint16_t a, uint16_t b){
+    return (int16_t)(uint16_t)(a - b);
+}
+
+// Same for 32 bits sequence numbers, valid while they are less than 2^31 apart
+long diffSerial32(uint32_t a, uint32_t b){
+    return (int32_t)(a - b);
+}
+
 int regulator(){
     static struct timeval *last = 0;
     struct timeval current, tmp;
@@ -28,6 +28,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h> 
 #include <sys/select.h>
 #include <netdb.h>
@@ -53,6 +54,7 @@ void do_debug(char *msg, ...);
 void my_err(char *msg, ...);
 
 int cread(int fd, uint8_t *buf, int n);
+int creadv(int fd, struct iovec* iov, int n);
 
 int cwrite(int fd, uint8_t *buf, int n);
 
@@ -62,6 +64,12 @@ int isSooner(struct timeval a, struct timeval b);
 
 void addUSec(struct timeval *a, long t);
 
+long diffUSec(struct timeval a, struct timeval b);
+
+int diffSerial16(uint16_t a, uint16_t b);
+
+long diffSerial32(uint32_t a, uint32_t b);
+
 int regulator();
 
 #endif